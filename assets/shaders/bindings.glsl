@@ -0,0 +1,261 @@
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+/*                                                                          */
+/*                                                                          */
+/*                               BINDINGS					                */
+/*                   									                    */
+/*                                                                          */
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+
+/*
+	Constants and the descriptor set 0 layout shared by every compute
+	shader that traces the scene (the megakernel and the wavefront stages).
+	Must match the `compute_layout_bindings` on the cpp side.
+*/
+
+/*--------------------------------------------------------------------------*/
+
+#define PI 3.1415926535897932384626433832795
+#define TWO_PI 6.283185307179586476925286766559
+#define INV_PI 0.31830988618379067153776752674503
+#define RAY_MIN_DIST 0.01
+#define EPSILON 0.005
+#define ONE_MINUS_EPSILON 0.99999994
+#define MARCH_ITER 32
+#define MARCH_EPS 0.1
+#define INF 1.0/0.0
+
+#define UINT_8_MAX 255
+#define UINT_16_MAX 65535
+#define UINT_32_MAX 4294967295
+
+#define INT_8_MAX 127
+#define INT_16_MAX 32767
+#define INT_32_MAX 2147483647
+
+#define INT_8_MIN -127
+#define INT_16_MIN -32767
+#define INT_32_MIN -2147483647
+#include "structs.glsl"
+
+layout(binding = 0) uniform RenderSettings
+{
+    int max_bounces;
+    int aa;
+    uint current_frame;
+    int camera_mode;
+    int top_left_render_mode;
+    int top_right_render_mode;
+    int bottom_left_render_mode;
+    int bottom_right_render_mode;
+    vec2 split_ratio;
+    int light_sampling; /* next event estimation in integrator_Kajiya, LIGHT_SAMPLING_* */
+    int denoise;        /* write the features and moments for denoise_pass.comp */
+}
+render_settings;
+layout(binding = 1, rgba8) uniform writeonly image2D result_image;
+layout(binding = 2, rgba8) uniform image2D temporal_image;
+layout(binding = 3) buffer Random { float random_source[]; };
+layout(binding = 4) uniform Camera
+{
+    mat4 matrix;
+    vec4 params; /* aspect, hfov, scale, 0 */
+}
+cam;
+ivec2 dim = imageSize(result_image);
+vec2 inv_dim = 1.0f / vec2(dim);
+uint iframe = render_settings.current_frame;
+float current_frame = float(render_settings.current_frame);
+float inv_current_frame = 1.0f / float(render_settings.current_frame + 1);
+
+layout(std430, binding = 5) buffer BvhNodes { BvhNode bvh_nodes[]; };
+/* page pool of the indexed triangles, see triangle_vertex */
+layout(std430, binding = 6) buffer Vertices { vec4 vertices[]; };
+layout(std430, binding = 7) buffer Materials { Material materials[]; };
+layout(std430, binding = 8) buffer WorkQueue
+{
+    uint next_work_item; /* persistent threads: next pixel to render */
+};
+layout(std430, binding = 9) buffer TraversalTotals
+{
+    /* totals of the frame as (low, high) words, see ATOMIC_ADD_64 */
+    uvec2 total_rays;
+    uvec2 total_nodes_visited;
+    uvec2 total_aabb_tests;
+    uvec2 total_triangle_tests;
+};
+
+layout(std430, binding = 10) buffer Indices { uint indices[]; };
+layout(std430, binding = 11) buffer TriangleMaterials { uint triangle_materials[]; };
+
+/*
+	The triangles are streamed in pages of PAGE_TRIANGLES consecutive
+	triangles in bvh order (GEOMETRY_PAGE_TRIANGLES on the cpp side). The
+	page table maps every page to its slot in the page pool of bindings 6,
+	10 and 11, a pool slot holds the PAGE_TRIANGLES triangles of a page and
+	their indices point straight at the vertices of the slot. Every page a
+	ray touches is flagged in page_requests for the cpp side to load, rays
+	which need a page that isn't resident are deferred (see request_page).
+*/
+#define PAGE_TRIANGLES 1024
+#define PAGE_NOT_RESIDENT 4294967295u
+layout(std430, binding = 12) buffer PageTable
+{
+	uint triangle_count;
+	uint page_slots[]; /* per page, PAGE_NOT_RESIDENT when it isn't resident */
+};
+layout(std430, binding = 13) buffer PageFeedback { uint page_requests[]; };
+
+/* the emissive triangles with an alias table over their power, in primitive order */
+layout(std430, binding = 14) buffer Lights
+{
+	uint light_count;
+	float light_total_power;
+	LightTriangle lights[];
+};
+/* the light bvh over them, the root first */
+layout(std430, binding = 15) buffer LightNodes { LightNode light_nodes[]; };
+#define LIGHT_SAMPLING_OFF 0
+#define LIGHT_SAMPLING_POWER 1
+#define LIGHT_SAMPLING_BVH 2
+
+/* inputs of the denoiser, see features.glsl */
+layout(binding = 16, rgba8) uniform image2D feature_albedo_image;
+layout(binding = 17, rgba16f) uniform image2D feature_normal_depth_image;
+layout(binding = 18, rgba16f) uniform image2D moments_image;
+/* ping pong images of the denoiser: illumination and its variance */
+layout(binding = 19, rgba16f) uniform image2D denoise_image_0;
+layout(binding = 20, rgba16f) uniform image2D denoise_image_1;
+/* lower bound of the albedo the radiance is divided by */
+#define MIN_ALBEDO 0.01
+
+/* set when the invocation skipped geometry which wasn't resident */
+bool ray_deferred = false;
+
+/* 1 when the geometry doesn't fit the page pool and is streamed, see
+   request_page; without it every page is resident for good */
+layout(constant_id = 3) const int SPEC_PAGING = 0;
+
+/* 64 bit atomic add on a (low, high) pair, carries into the high word */
+#define ATOMIC_ADD_64(total, value)                 \
+    {                                               \
+        uint old_low = atomicAdd((total).x, value); \
+        if (old_low + (value) < old_low)            \
+            atomicAdd((total).y, 1);                \
+    }
+
+/*--------------------------------------------------------------------------*/
+
+bool request_page
+
+	(uint page)  /* page index, triangle index / PAGE_TRIANGLES */
+
+/*
+	Flags the page as used by this frame and returns whether it is
+	resident. When it isn't, the ray gets deferred: the caller skips the
+	triangles of the page and the frame is redone once it is loaded.
+*/
+
+{
+	if (SPEC_PAGING == 0) return true;
+
+	/* most pages are requested already, reading first saves the writes */
+	if (page_requests[page] == 0) page_requests[page] = 1;
+	if (page_slots[page] != PAGE_NOT_RESIDENT) return true;
+	ray_deferred = true;
+	return false;
+
+} /* request_page */
+
+/*--------------------------------------------------------------------------*/
+
+bool request_triangles
+
+	(uint first,  /* first triangle index in bvh order */
+	 uint count)  /* number of triangles, at least 1 */
+
+/*
+	request_page for the pages of a range of triangles, a bvh leaf is
+	much smaller than a page and spans two at most.
+*/
+
+{
+	bool first_resident = request_page(first / PAGE_TRIANGLES);
+	bool last_resident = request_page((first + count - 1) / PAGE_TRIANGLES);
+	return first_resident && last_resident;
+
+} /* request_triangles */
+
+/*--------------------------------------------------------------------------*/
+
+uint triangle_slot
+
+	(uint prim)  /* triangle index in bvh order, its page is resident */
+
+/*
+	Index of the triangle in the page pool.
+*/
+
+{
+	return page_slots[prim / PAGE_TRIANGLES] * PAGE_TRIANGLES + prim % PAGE_TRIANGLES;
+
+} /* triangle_slot */
+
+/*--------------------------------------------------------------------------*/
+
+vec3 triangle_vertex
+
+	(uint prim,    /* triangle index in bvh order, its page is resident */
+	 uint corner)  /* 0, 1 or 2 */
+
+/*
+	Position of a triangle corner, fetched through the index buffer.
+*/
+
+{
+	return vertices[indices[3*triangle_slot(prim) + corner]].xyz;
+
+} /* triangle_vertex */
+
+/*--------------------------------------------------------------------------*/
+
+Material triangle_material
+
+	(uint prim)  /* triangle index in bvh order, its page is resident */
+
+{
+	return materials[triangle_materials[triangle_slot(prim)]];
+
+} /* triangle_material */
+
+/*--------------------------------------------------------------------------*/
+
+int render_mode_at_pixel
+
+	(uvec2 pixel)  /* pixel coordinates */
+
+/*
+	Returns the render mode (integrator index) of the split screen
+	region the pixel falls in.
+*/
+
+{
+    int integrator_idx = render_settings.top_left_render_mode;
+    vec2 pixel_split = vec2(pixel) * inv_dim;
+    if (pixel_split.y > render_settings.split_ratio.y)
+    {
+        if (pixel_split.x < render_settings.split_ratio.x)
+            integrator_idx = render_settings.bottom_left_render_mode;
+        else
+            integrator_idx = render_settings.bottom_right_render_mode;
+    }
+    else if (pixel_split.x > render_settings.split_ratio.x)
+        integrator_idx = render_settings.top_right_render_mode;
+    return integrator_idx;
+
+} /* render_mode_at_pixel */
+
+/*--------------------------------------------------------------------------*/
@@ -98,4 +98,25 @@ Ray camera_spherical_ray
 
 } /* camera_spherical_ray */
 
+/*--------------------------------------------------------------------------*/
+
+Ray get_camera_ray
+
+	(int   camera_idx,
+	 float u,
+	 float v)
+	 
+{
+	switch (camera_idx)
+	{
+	case 0:
+		return camera_pinhole_ray(u, v);
+	case 1:
+		return camera_ortho_ray(u, v);
+	default:
+		return camera_spherical_ray(u, v);
+	}
+
+} /* get_camera_ray */
+
 /*--------------------------------------------------------------------------*/
\ No newline at end of file
@@ -88,10 +88,12 @@ float intersect_scene_st
     for (i=0; i<MARCH_ITER; ++i)
     {
         t_radius_idx = vec2(INF, -1);
-        for (int j=0; j<triangles.length(); ++j)
+        for (int j=0; j<int(triangle_count); ++j)
         {
-            Triangle tri = triangles[j];
-            float dist = distance_triangle(p, tri.vert0.xyz, tri.vert1.xyz, tri.vert2.xyz);
+            uint prim = uint(j);
+            if (!request_page(prim / PAGE_TRIANGLES)) continue;
+            float dist = distance_triangle(p, triangle_vertex(prim, 0), triangle_vertex(prim, 1),
+                                           triangle_vertex(prim, 2));
             t_radius_idx = min_idx(t_radius_idx, vec2(dist, j));
         }
         
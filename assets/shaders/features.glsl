@@ -0,0 +1,68 @@
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+/*                                                                          */
+/*                                                                          */
+/*                          DENOISER FEATURES				                */
+/*                   									                    */
+/*                                                                          */
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+
+/*
+	Inputs of the denoiser (denoise_pass.comp), written next to the
+	temporal accumulation when render_settings.denoise is set:
+
+	feature_albedo_image       -> albedo of the surface at the pixel center
+	feature_normal_depth_image -> its normal (facing the camera) and
+	                              distance, -1 for a miss
+	moments_image              -> mean luminance of the illumination and
+	                              mean of its square over the accumulated
+	                              frames
+
+	The illumination is the radiance divided by the albedo, so the
+	filter doesn't blur the texture of the surfaces. The features come
+	from a ray through the pixel center instead of the jittered samples,
+	they stay the same while the image accumulates.
+*/
+
+/*--------------------------------------------------------------------------*/
+
+void write_features
+
+	(uvec2 pixel,       /* pixel coordinates */
+	 int   camera_idx,  /* camera mode */
+	 vec3  sampled,     /* radiance of the samples of this frame */
+	 bool  deferred)    /* the samples were dropped */
+
+{
+	vec2 coord = (vec2(pixel) + 0.5) * inv_dim;
+	coord.y = 1.0 - coord.y; /* flip image vertically */
+	Ray ray = get_camera_ray(camera_idx, coord.x, coord.y);
+
+	Isect info;
+	vec3 albedo = vec3(1);
+	vec4 normal_depth = vec4(0, 0, 0, -1);
+	if (intersect_scene(ray, 0, INF, info))
+	{
+		albedo = info.mat.base_color;
+		normal_depth = vec4(faceforward(info.normal, ray.direction, info.normal),
+		                    info.t * length(ray.direction));
+	}
+	imageStore(feature_albedo_image, ivec2(pixel), vec4(albedo, 0));
+	imageStore(feature_normal_depth_image, ivec2(pixel), normal_depth);
+
+	/* the temporal image is 8 bit, the moments describe what it holds */
+	vec2 moments = imageLoad(moments_image, ivec2(pixel)).xy
+		* min(render_settings.current_frame, 1);
+	if (!deferred)
+	{
+		float l = luminance(clamp(sampled, 0, 1) / max(albedo, vec3(MIN_ALBEDO)));
+		moments = (moments * current_frame + vec2(l, l*l)) * inv_current_frame;
+	}
+	imageStore(moments_image, ivec2(pixel), vec4(moments, 0, 0));
+
+} /* write_features */
+
+/*--------------------------------------------------------------------------*/
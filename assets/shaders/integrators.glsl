@@ -544,6 +544,314 @@ vec3 integrator_Cook
 
 /*--------------------------------------------------------------------------*/
 
+float power_heuristic
+
+	(float pdf,        /* density of the strategy that took the sample */
+	 float other_pdf)  /* density of the other strategy for the same sample */
+
+{
+	return pdf*pdf / (pdf*pdf + other_pdf*other_pdf);
+
+} /* power_heuristic */
+
+/*--------------------------------------------------------------------------*/
+
+float cos_sub_clamped
+
+	(float sin_a,  /* sine and cosine of an angle a in [0, PI] */
+	 float cos_a,
+	 float sin_b,  /* sine and cosine of an angle b in [0, PI] */
+	 float cos_b)
+
+/*
+	cos(max(0, a - b))
+*/
+
+{
+	return cos_a > cos_b ? 1.0 : cos_a*cos_b + sin_a*sin_b;
+
+} /* cos_sub_clamped */
+
+/*--------------------------------------------------------------------------*/
+
+float sin_sub_clamped
+
+	(float sin_a,  /* sine and cosine of an angle a in [0, PI] */
+	 float cos_a,
+	 float sin_b,  /* sine and cosine of an angle b in [0, PI] */
+	 float cos_b)
+
+/*
+	sin(max(0, a - b))
+*/
+
+{
+	return cos_a > cos_b ? 0.0 : sin_a*cos_b - cos_a*sin_b;
+
+} /* sin_sub_clamped */
+
+/*--------------------------------------------------------------------------*/
+
+float light_importance
+
+	(LightNode node,    /* node of the light bvh */
+	 vec3      pos,     /* shading point */
+	 vec3      normal)  /* unit normal of the shading point */
+
+/*
+	Estimated contribution of the lights below the node to the shading
+	point: their power over the squared distance, times the cosines of
+	the smallest angles the bounds allow between a light normal and the
+	direction to the point, and between the surface normal and a light.
+	It is 0 only if none of the lights can reach the point, see
+	light_importance in light_sampling.cpp and
+
+    Importance Sampling of Many Lights with Adaptive Tree Splitting,
+    Alejandro Conty Estevez and Christopher Kulla, 2018
+*/
+
+{
+	vec3 center = 0.5*(node.bounds_min + node.bounds_max);
+	vec3 diagonal = node.bounds_max - node.bounds_min;
+	float radius_sqr = 0.25*dot(diagonal, diagonal);
+	vec3 to_center = center - pos;
+	float dist_sqr = dot(to_center, to_center);
+	/* inside the bounding sphere a light may be in any direction */
+	if (dist_sqr <= radius_sqr)
+		return node.power / radius_sqr;
+
+	/* theta_w to the axis, theta_b half angle of the bounding sphere */
+	vec3 dir = to_center / sqrt(dist_sqr);
+	float cos_theta_w = abs(dot(node.axis, dir));
+	float sin_theta_w = sqrt(max(0, 1 - cos_theta_w*cos_theta_w));
+	float cos_theta_b = sqrt(max(0, 1 - radius_sqr / dist_sqr));
+	float sin_theta_b = sqrt(max(0, 1 - cos_theta_b*cos_theta_b));
+	float sin_theta_o = sqrt(max(0, 1 - node.cos_theta_o*node.cos_theta_o));
+
+	/* the lights emit over the hemisphere of each side */
+	float cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+	float sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+	float cos_theta = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+	if (cos_theta <= 0)
+		return 0;
+
+	float cos_theta_i = dot(normal, dir);
+	float sin_theta_i = sqrt(max(0, 1 - cos_theta_i*cos_theta_i));
+	float cos_theta_s = cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+	if (cos_theta_s <= 0)
+		return 0;
+
+	return node.power * cos_theta * cos_theta_s / dist_sqr;
+
+} /* light_importance */
+
+/*--------------------------------------------------------------------------*/
+
+uint pick_light
+
+	(vec3      pos,     /* shading point */
+	 vec3      normal,  /* unit normal of the shading point */
+	 float     u,       /* uniform random number in [0, 1) */
+	 out float pmf)     /* probability of the pick */
+
+/*
+	Descends the light bvh from the root, taking each child with a
+	probability proportional to its importance. The random number is
+	rescaled to [0, 1) after every choice. Returns light_count if no
+	light can reach the point.
+*/
+
+{
+	pmf = 1;
+	uint idx = 0;
+	while (light_nodes[idx].light_count == 0)
+	{
+		uint child = light_nodes[idx].first_child_or_light;
+		float left = light_importance(light_nodes[child], pos, normal);
+		float right = light_importance(light_nodes[child + 1], pos, normal);
+		if (!(left + right > 0))
+			return light_count;
+
+		float p_left = left / (left + right);
+		if (u < p_left)
+		{
+			idx = child;
+			u /= p_left;
+			pmf *= p_left;
+		}
+		else
+		{
+			idx = child + 1;
+			u = (u - p_left) / (1 - p_left);
+			pmf *= 1 - p_left;
+		}
+		u = min(u, ONE_MINUS_EPSILON);
+	}
+	return light_nodes[idx].first_child_or_light;
+
+} /* pick_light */
+
+/*--------------------------------------------------------------------------*/
+
+float light_pick_pmf
+
+	(uint light,   /* index of the light */
+	 vec3 pos,     /* shading point */
+	 vec3 normal)  /* unit normal of the shading point */
+
+/*
+	Probability of pick_light choosing the light, from the choices on
+	the way from its leaf up to the root.
+*/
+
+{
+	float pmf = 1;
+	uint idx = lights[light].node;
+	while (idx != 0)
+	{
+		uint parent = light_nodes[idx].parent;
+		uint child = light_nodes[parent].first_child_or_light;
+		float left = light_importance(light_nodes[child], pos, normal);
+		float right = light_importance(light_nodes[child + 1], pos, normal);
+		if (!(left + right > 0))
+			return 0;
+		pmf *= (idx == child ? left : right) / (left + right);
+		idx = parent;
+	}
+	return pmf;
+
+} /* light_pick_pmf */
+
+/*--------------------------------------------------------------------------*/
+
+uint find_light
+
+	(uint prim)  /* index of the triangle */
+
+/*
+	Binary search for the light on the triangle, the lights are in
+	primitive order. Returns light_count if it isn't one.
+*/
+
+{
+	uint first = 0;
+	uint count = light_count;
+	while (count > 0)
+	{
+		uint half_count = count / 2;
+		if (lights[first + half_count].primitive < prim)
+		{
+			first += half_count + 1;
+			count -= half_count + 1;
+		}
+		else
+			count = half_count;
+	}
+	return first < light_count && lights[first].primitive == prim ? first : light_count;
+
+} /* find_light */
+
+/*--------------------------------------------------------------------------*/
+
+vec3 sample_light
+
+	(vec3 pos,     /* shading point, offset from the surface */
+	 vec3 normal)  /* unit normal on the side of the incoming ray */
+
+/*
+	Next event estimation for a Lambert surface: picks an emissive
+	triangle proportional to its power with the alias table, or by its
+	importance with the light bvh, a uniform point on it, and traces a
+	shadow ray to it. Returns the emission times the brdf without the
+	albedo (cos / PI) over the density of the sample, weighted against
+	cosine weighted bsdf sampling with the power heuristic.
+*/
+
+{
+	float u = rand();
+	uint idx;
+	float pick_pmf;
+	if (render_settings.light_sampling == LIGHT_SAMPLING_BVH)
+	{
+		idx = pick_light(pos, normal, u, pick_pmf);
+		if (idx >= light_count)
+			return vec3(0);
+	}
+	else
+	{
+		float v = rand();
+		idx = min(uint(u * float(light_count)), light_count - 1);
+		if (v >= lights[idx].probability) idx = lights[idx].alias;
+		pick_pmf = lights[idx].pdf;
+	}
+	LightTriangle light = lights[idx];
+
+	/* uniform point on the triangle */
+	float su = sqrt(rand());
+	float sv = rand();
+	vec3 point = light.vertex0.xyz + su*(1.0 - sv)*light.edge1.xyz + su*sv*light.edge2.xyz;
+
+	vec3 to_light = point - pos;
+	float dist_sqr = dot(to_light, to_light);
+	float dist = sqrt(dist_sqr);
+	vec3 dir = to_light / dist;
+	float cos_surface = dot(dir, normal);
+	/* the lights emit on both sides like a hit does */
+	float cos_light = abs(dot(dir, normalize(cross(light.edge1.xyz, light.edge2.xyz))));
+	if (cos_surface <= 0 || cos_light <= 0)
+		return vec3(0);
+
+	/* the shadow ray stops short of the light itself */
+	if (intersect_scene_any(Ray(pos, dir), 0, dist - EPSILON))
+		return vec3(0);
+
+	/* area density converted to solid angle */
+	float light_pdf = pick_pmf / light.area * dist_sqr / cos_light;
+	float bsdf_pdf = cos_surface * INV_PI;
+	return light.emission * cos_surface * INV_PI
+		* power_heuristic(light_pdf, bsdf_pdf) / light_pdf;
+
+} /* sample_light */
+
+/*--------------------------------------------------------------------------*/
+
+float emission_weight
+
+	(Ray   ray,           /* ray which hit the emitter */
+	 Isect info,          /* the hit */
+	 float bsdf_pdf,      /* density of the ray direction, 0 after a delta bsdf */
+	 vec3  light_pos,     /* where the previous bounce sampled a light from */
+	 vec3  light_normal)  /* and the normal it used */
+
+/*
+	MIS weight of emission found by bsdf sampling when the previous
+	bounce also sampled a light. With the alias table the area density
+	of a point on a light is luminance(emission) / total power for every
+	light, see LightList. The light bvh has to find the light and redo
+	the choices pick_light made for it.
+*/
+
+{
+	if (bsdf_pdf <= 0)
+		return 1;
+	float area_pdf;
+	if (render_settings.light_sampling == LIGHT_SAMPLING_BVH)
+	{
+		uint idx = find_light(info.prim);
+		area_pdf = idx < light_count ?
+			light_pick_pmf(idx, light_pos, light_normal) / lights[idx].area : 0;
+	}
+	else
+		area_pdf = luminance(info.mat.emissive) / light_total_power;
+	float dist = info.t * length(ray.direction);
+	float cos_light = abs(dot(normalize(ray.direction), info.normal));
+	float light_pdf = area_pdf * dist*dist / max(cos_light, 1e-6);
+	return power_heuristic(bsdf_pdf, light_pdf);
+
+} /* emission_weight */
+
+/*--------------------------------------------------------------------------*/
+
 vec3 integrator_Kajiya
 
 	(Ray   primary_ray, /* primary ray */
@@ -557,7 +865,12 @@ vec3 integrator_Kajiya
     
     The Rendering Equation, James Kajiya, 1986
 	
-	under construction
+	With render_settings.light_sampling, Lambert surfaces also sample
+	the emissive triangles directly (next event estimation), combined
+	with the bsdf samples by multiple importance sampling:
+
+    Optimally Combining Sampling Techniques for Monte Carlo Rendering,
+    Eric Veach and Leonidas Guibas, 1995
 */
 	 
 {
@@ -570,6 +883,12 @@ vec3 integrator_Kajiya
     vec3 white = vec3(1);
     vec3 blue = vec3(0.2,0.3,0.7);
 	vec3 background;
+	bool light_sampling = render_settings.light_sampling != LIGHT_SAMPLING_OFF && light_count > 0;
+	/* density of the direction of `ray` when the light was sampled too, 0 otherwise */
+	float bsdf_pdf = 0;
+	/* where the light was sampled from */
+	vec3 light_pos = vec3(0);
+	vec3 light_normal = vec3(0);
 	
 	for (int i=0; i<nbounce; ++i)
 	{
@@ -578,8 +897,10 @@ vec3 integrator_Kajiya
         if (!intersect_scene (ray, mint, maxt, info))
             return col + throughput*mix(white, blue, ray.direction.y * 0.5 + 0.5);
         
-        /* intersected an object -> add emission */
-        col += throughput*info.mat.emissive;
+        /* intersected an emitter -> add emission, only lights need the mis weight */
+        if (info.mat.emissive != vec3(0))
+            col += throughput*info.mat.emissive
+                *emission_weight(ray, info, bsdf_pdf, light_pos, light_normal);
         
         /* intersection data */
         vec3 pos = info.pos;
@@ -617,9 +938,18 @@ vec3 integrator_Kajiya
         case 0: /* Lambert */
             /* offset to upper hemisphere to avoid self-intersection */
             pos_out = pos + EPSILON * normal;
+            /* direct light, unless the bsdf sample couldn't reach it either */
+            if (light_sampling && i + 1 < nbounce)
+                col += throughput*info.mat.base_color*sample_light(pos_out, normal);
             /* scatter cosine weighted */
             dir_out = mat_scatter_Lambert_cos(normal);
             throughput *= mat_eval_Lambert_cos(info.mat.base_color*INV_PI);
+            if (light_sampling)
+            {
+                bsdf_pdf = max(dot(normalize(dir_out), normal), 0) * INV_PI;
+                light_pos = pos_out;
+                light_normal = normal;
+            }
             break;
             
         case 1: /* perfect mirror */
@@ -628,6 +958,7 @@ vec3 integrator_Kajiya
             /* reflect */
             dir_out = dir_in + (cos_in+cos_in)*normal;
             throughput *= mat_eval_mirror(info.mat.base_color);    
+            bsdf_pdf = 0;
             break;
             
         case 2: /* dielectric */
@@ -661,6 +992,7 @@ vec3 integrator_Kajiya
                 dir_out = eta*dir_in + (eta*cos_in-cos_out)*normal;
             }
             throughput *= mat_eval_dielectric(info.mat.base_color);   
+            bsdf_pdf = 0;
             break;
         }
         default:
@@ -671,8 +1003,8 @@ vec3 integrator_Kajiya
         ray = Ray(pos_out, dir_out);
 	}
 	
-	/* return black if it runs out of iterations */
-	return vec3(0);
+	/* the light gathered so far if it runs out of iterations */
+	return col;
 
 } /* integrator_Kajiya */
 	 
@@ -694,6 +1026,32 @@ vec3 integrator_Hart
 
 /*--------------------------------------------------------------------------*/
 
+#define HEATMAP_MAX_TESTS 200.0
+
+vec3 integrator_traversal_heatmap
+
+	(Ray   primary_ray, /* primary ray */
+	 float mint,        /* lower bound for t */
+	 float maxt)        /* upper bound for t */
+
+/*
+	Cost of tracing the primary ray through the BVH: the box and triangle
+	tests it took, from blue for none to red for HEATMAP_MAX_TESTS or
+	more. Needs the traversal counters, the cpp side specializes the
+	pipeline with them while this mode is shown.
+*/
+
+{
+	uint tests_before = traversal.aabb_tests + traversal.triangle_tests;
+	Isect info;
+	intersect_scene(primary_ray, mint, maxt, info);
+	uint tests = traversal.aabb_tests + traversal.triangle_tests - tests_before;
+	return heatmap(float(tests) / HEATMAP_MAX_TESTS);
+
+} /* integrator_traversal_heatmap */
+
+/*--------------------------------------------------------------------------*/
+
 
 
 
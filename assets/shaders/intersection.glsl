@@ -67,6 +67,7 @@ struct Isect
 	vec3  pos;    /* position in global coordinates */
 	vec3  normal; /* normal in global coordinates */
 	vec2  uv;     /* surface parametrization (for textures) */
+	uint  prim;   /* index of the intersected triangle */
 	Material_new mat;
 	
 }; /* Isect */
@@ -358,6 +359,26 @@ bool intersect_aabb
 
 /*--------------------------------------------------------------------------*/
 
+/*
+	Traversal statistics of the invocation, only counted when the pipeline
+	is specialized with SPEC_TRAVERSAL_STATS = 1, otherwise the counting
+	folds away. The megakernel adds them to the frame totals.
+*/
+
+layout(constant_id = 2) const int SPEC_TRAVERSAL_STATS = 0;
+
+struct TraversalStats
+{
+	uint rays;           /* calls of intersect_bvh and intersect_bvh_any */
+	uint nodes_visited;  /* nodes whose box the ray overlaps */
+	uint aabb_tests;
+	uint triangle_tests;
+};
+
+TraversalStats traversal = TraversalStats(0, 0, 0, 0);
+
+/*--------------------------------------------------------------------------*/
+
 bool intersect_bvh(in Ray ray, float mint, float maxt, out Isect info)
 {
 	uint[64] stack;
@@ -367,6 +388,7 @@ bool intersect_bvh(in Ray ray, float mint, float maxt, out Isect info)
 	info.t = INF;
 	info.pos = vec3(0);
 	info.normal = vec3(0);
+	if (SPEC_TRAVERSAL_STATS != 0) traversal.rays++;
 
 	stack[stack_ptr++] = ~0;
 	uint stack_top = 0;
@@ -375,26 +397,33 @@ bool intersect_bvh(in Ray ray, float mint, float maxt, out Isect info)
 		BvhNode node = bvh_nodes[stack_top];
 		vec3 node_min = vec3(node.bounds[0], node.bounds[2], node.bounds[4]);
 		vec3 node_max = vec3(node.bounds[1], node.bounds[3], node.bounds[5]);
+		if (SPEC_TRAVERSAL_STATS != 0) traversal.aabb_tests++;
 		if (!intersect_aabb(ray, node_min, node_max, mint, closest_t)) {
 			stack_top = stack[--stack_ptr];
 			continue;
 		}
+		if (SPEC_TRAVERSAL_STATS != 0) traversal.nodes_visited++;
 
 		uint first_child_or_primitive = node.first_child_or_primitive;
-		if (node.primitive_count > 0)
+		if (node.primitive_count > 0 &&
+			!request_triangles(first_child_or_primitive, node.primitive_count))
+		{
+			// A leaf whose geometry isn't resident, the ray is deferred
+			stack_top = stack[--stack_ptr];
+		}
+		else if (node.primitive_count > 0)
 		{
 			// This is a leaf
+			if (SPEC_TRAVERSAL_STATS != 0) traversal.triangle_tests += node.primitive_count;
 			for (uint i = first_child_or_primitive, n = i + node.primitive_count; i < n; ++i)
 			{
-				Triangle triangle = triangles[i];
-				vec3 v0 = triangle.vert0.xyz;
-				vec3 v1 = triangle.vert1.xyz;
-				vec3 v2 = triangle.vert2.xyz;
+				vec3 v0 = triangle_vertex(i, 0);
+				vec3 v1 = triangle_vertex(i, 1);
+				vec3 v2 = triangle_vertex(i, 2);
 				Isect temp_isect;
 				if (intersect_triangle_fast(ray, v0, v1, v2, mint, closest_t, temp_isect)) {
 					info = temp_isect;
-					Material mat = materials[int(triangle.mat_id.x)];
-					info.mat = convert_old_material(mat);
+					info.prim = i;
 					closest_t = temp_isect.t;
 				}
 			}
@@ -409,6 +438,8 @@ bool intersect_bvh(in Ray ray, float mint, float maxt, out Isect info)
 		}
 	}
 
+	/* only the material of the closest hit is fetched */
+	if (closest_t < maxt) info.mat = convert_old_material(triangle_material(info.prim));
 	return closest_t < maxt;
 }
 
@@ -420,6 +451,7 @@ bool intersect_bvh_any(in Ray ray, float mint, float maxt)
 	int stack_ptr = 0;
 
 	float closest_t = maxt;
+	if (SPEC_TRAVERSAL_STATS != 0) traversal.rays++;
 
 	stack[stack_ptr++] = ~0;
 	uint stack_top = 0;
@@ -428,21 +460,29 @@ bool intersect_bvh_any(in Ray ray, float mint, float maxt)
 		BvhNode node = bvh_nodes[stack_top];
 		vec3 node_min = vec3(node.bounds[0], node.bounds[2], node.bounds[4]);
 		vec3 node_max = vec3(node.bounds[1], node.bounds[3], node.bounds[5]);
+		if (SPEC_TRAVERSAL_STATS != 0) traversal.aabb_tests++;
 		if (!intersect_aabb(ray, node_min, node_max, mint, closest_t)) {
 			stack_top = stack[--stack_ptr];
 			continue;
 		}
+		if (SPEC_TRAVERSAL_STATS != 0) traversal.nodes_visited++;
 
 		uint first_child_or_primitive = node.first_child_or_primitive;
-		if (node.primitive_count > 0)
+		if (node.primitive_count > 0 &&
+			!request_triangles(first_child_or_primitive, node.primitive_count))
+		{
+			// A leaf whose geometry isn't resident, the ray is deferred
+			stack_top = stack[--stack_ptr];
+		}
+		else if (node.primitive_count > 0)
 		{
 			// This is a leaf
 			for (uint i = first_child_or_primitive, n = i + node.primitive_count; i < n; ++i)
 			{
-				Triangle triangle = triangles[i];
-				vec3 v0 = triangle.vert0.xyz;
-				vec3 v1 = triangle.vert1.xyz;
-				vec3 v2 = triangle.vert2.xyz;
+				if (SPEC_TRAVERSAL_STATS != 0) traversal.triangle_tests++;
+				vec3 v0 = triangle_vertex(i, 0);
+				vec3 v1 = triangle_vertex(i, 1);
+				vec3 v2 = triangle_vertex(i, 2);
 				Isect temp_isect;
 				if (intersect_triangle_fast(ray, v0, v1, v2, mint, closest_t, temp_isect)) {
 					return true;
@@ -708,12 +748,11 @@ bool intersect_scene
 bool intersect_triangles(Ray ray, inout Record record)
 {
     float lowest = record.distance;
-    for(int i = 0; i < triangles.length(); i++){
-        Triangle triangle = triangles[i];
-
-        vec3 o = triangle.vert0.xyz;
-        vec3 e0 = triangle.vert1.xyz - o;
-        vec3 e1 = triangle.vert2.xyz - o;
+    for(uint i = 0; i < triangle_count; i++){
+        if (!request_page(i / PAGE_TRIANGLES)) continue;
+        vec3 o = triangle_vertex(i, 0);
+        vec3 e0 = triangle_vertex(i, 1) - o;
+        vec3 e1 = triangle_vertex(i, 2) - o;
         vec3 intersectionMat[3] = {ray.direction * -1, e0, e1};
 
         vec3 c01 = cross(intersectionMat[0], intersectionMat[1]);
@@ -738,11 +777,11 @@ bool intersect_triangles(Ray ray, inout Record record)
                 lowest = t;
                 record.intersection = ray.origin + ray.direction * t;
                 record.distance = t;
-                record.normal = vec3(triangle.vert0.w, triangle.vert1.w, triangle.vert2.w);
+                record.normal = normalize(cross(e0, e1));
                 record.hit = true;
-                record.mat = materials[int(triangle.mat_id.x)];
-                record.albedo = materials[int(triangle.mat_id.x)].albedo.xyz;
-                record.emission = materials[int(triangle.mat_id).x].emission.xyz;
+                record.mat = triangle_material(i);
+                record.albedo = record.mat.albedo.xyz;
+                record.emission = record.mat.emission.xyz;
                 //            rec.u = tuv.y * vertices[1].u + tuv.z * vertices[2].u + (1.0f - tuv.y - tuv.z) * vertices[0].u;
                 //            rec.v = tuv.y * vertices[1].v + tuv.z * vertices[2].v + (1.0f - tuv.y - tuv.z) * vertices[0].v;
             }
@@ -0,0 +1,144 @@
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+/*                                                                          */
+/*                                                                          */
+/*                               MEGAKERNEL					                */
+/*                   									                    */
+/*                                                                          */
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+
+/*
+	Renders a whole pixel (all samples, all bounces) in one invocation.
+	Shared by compute_pass.comp (one invocation per pixel) and
+	persistent_pass.comp (invocations fetch pixels from a work counter).
+*/
+
+/*
+	Specialization constants, -1 selects at runtime from the render
+	settings. The cpp side builds one pipeline variant per integrator and
+	camera in use so the switches below fold away and only the selected
+	integrator is compiled in. constant_id 2 (SPEC_TRAVERSAL_STATS) is
+	declared in intersection.glsl, 3 (SPEC_PAGING) in bindings.glsl.
+*/
+
+layout(constant_id = 0) const int SPEC_INTEGRATOR = -1;
+layout(constant_id = 1) const int SPEC_CAMERA = -1;
+
+/*--------------------------------------------------------------------------*/
+
+vec3 eval_integrator
+
+	(int integrator_idx,
+	 Ray ray)
+	
+{
+	switch (integrator_idx)
+	{
+	case 0:
+		return integrator_binary(ray, 0, INF);
+    case 1:
+		return integrator_color(ray, 0, INF);
+	case 2:
+		return integrator_depth(ray, 0, INF);
+	case 3:
+		return integrator_normal(ray, 0, INF);
+    case 4:
+        return integrator_Utah(ray, 0, INF);
+	case 5:
+		return integrator_ao(ray, 0, INF, render_settings.max_bounces);
+    case 6:
+        return integrator_Appel(ray, 0, INF);
+    case 7:
+        return integrator_Whitted(ray, 0, INF, render_settings.max_bounces);    
+    case 8:
+        return integrator_Cook(ray, 0, INF, render_settings.max_bounces);
+	case 9:
+		return integrator_Kajiya(ray, 0, INF, render_settings.max_bounces);
+	case 11:
+		return integrator_traversal_heatmap(ray, 0, INF);
+    default:
+        return integrator_Hart(ray, 0, INF);
+	}
+}
+
+/*--------------------------------------------------------------------------*/
+
+void trace_pixel
+
+	(uvec2 pixel)  /* pixel coordinates */
+
+/*
+	Traces `render_settings.aa` samples for the pixel and blends them into
+	the temporal accumulation. Deferred samples (see request_page) are
+	dropped. Writes the inputs of the denoiser too when it is on.
+*/
+
+{
+	/*
+		Integrators enumeration:
+
+		0: binary
+		1: depth
+		2: normal
+		3: ao
+        4: Appel
+		5: Kajiya
+
+	*/
+    /* the PRNG is seeded per pixel, invocations may render several pixels. The frame goes
+       through the hash too: xorshift sequences from seeds one apart stay correlated, the
+       accumulation would converge slowly and the moments the denoiser takes the variance
+       from would understate it */
+    rng_state = wang_hash((pixel.x + pixel.y * uint(dim.x)) ^ wang_hash(iframe));
+    traversal = TraversalStats(0, 0, 0, 0);
+    ray_deferred = false;
+
+    int integrator_idx = SPEC_INTEGRATOR >= 0 ? SPEC_INTEGRATOR : render_mode_at_pixel(pixel);
+    int camera_idx = SPEC_CAMERA >= 0 ? SPEC_CAMERA : render_settings.camera_mode;
+
+    vec3 temporal_accumulation_sample =
+        (imageLoad(temporal_image, ivec2(pixel))).xyz *
+        min(render_settings.current_frame, 1);
+
+    vec3 sampled = vec3(0);
+    for (int i = 0; i < render_settings.aa; i++)
+    {
+        vec2 coord = (vec2(pixel) + vec2(rand(), rand())) * inv_dim;
+		coord.y = 1.0-coord.y; /* flip image vertically */
+        
+		Ray ray = get_camera_ray(camera_idx, coord.x, coord.y);
+		sampled += eval_integrator(integrator_idx, ray);
+	}
+
+
+    sampled /= render_settings.aa;
+    vec3 frame_sample = sampled;
+    bool deferred = ray_deferred;
+    sampled = (temporal_accumulation_sample * current_frame + sampled)
+              * inv_current_frame;
+    /*
+        a pixel which missed geometry that isn't resident keeps what it
+        had, the accumulation restarts once the pages are loaded
+    */
+    if (deferred) sampled = temporal_accumulation_sample;
+
+    imageStore(temporal_image, ivec2(pixel), vec4(sampled, 0));
+    imageStore(result_image, ivec2(pixel), vec4(sampled, 0));
+
+    if (SPEC_TRAVERSAL_STATS != 0)
+    {
+        ATOMIC_ADD_64(total_rays, traversal.rays);
+        ATOMIC_ADD_64(total_nodes_visited, traversal.nodes_visited);
+        ATOMIC_ADD_64(total_aabb_tests, traversal.aabb_tests);
+        ATOMIC_ADD_64(total_triangle_tests, traversal.triangle_tests);
+    }
+
+    if (render_settings.denoise != 0)
+        write_features(pixel, camera_idx, frame_sample, deferred);
+
+} /* trace_pixel */
+
+/*--------------------------------------------------------------------------*/
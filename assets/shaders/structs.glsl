@@ -1,11 +1,3 @@
-struct Triangle
-{
-    vec4 vert0;
-    vec4 vert1;
-    vec4 vert2;
-    vec4 mat_id;
-};
-
 struct BvhNode
 {
     uint first_child_or_primitive;
@@ -13,6 +5,34 @@ struct BvhNode
     float[6] bounds;
 };
 
+/* an emissive triangle, see LightTriangle in light_sampling.h */
+struct LightTriangle
+{
+    vec4 vertex0;
+    vec4 edge1;
+    vec4 edge2;
+    vec3 emission;
+    float area;
+    float probability; /* alias table: this light with `probability`, */
+    uint alias;        /* lights[alias] otherwise */
+    float pdf;         /* of sampling this light, power / total power */
+    uint primitive;
+    uint node;         /* its leaf in the light bvh */
+};
+
+/* a node of the light bvh, see LightNode in light_sampling.h */
+struct LightNode
+{
+    vec3 bounds_min;
+    float power;
+    vec3 bounds_max;
+    float cos_theta_o; /* the normals lie within theta_o of +-axis */
+    vec3 axis;
+    uint first_child_or_light;
+    uint light_count;  /* 0 for inner nodes */
+    uint parent;
+};
+
 struct Ray
 {
     vec3 origin;
@@ -33,7 +33,7 @@ uint wang_hash(uint seed)
 }
 
 uint p_idx = gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * image_size.x;
-uint rng_state = wang_hash(p_idx)+iframe;
+uint rng_state = wang_hash(p_idx ^ wang_hash(iframe));
 
 uint rand_xorshift()
 {
@@ -51,6 +51,22 @@ float rand()
     
 /*--------------------------------------------------------------------------*/
 
+vec3 heatmap
+
+	(float t) /* [0, 1], clamped */
+
+/*
+	Blue - cyan - green - yellow - red color ramp.
+*/
+
+{
+	t = clamp(t, 0.0, 1.0);
+	return clamp(vec3(1.5) - abs(4.0 * vec3(t) - vec3(3.0, 2.0, 1.0)), 0.0, 1.0);
+
+} /* heatmap */
+
+/*--------------------------------------------------------------------------*/
+
 vec3 spherical_to_cartesian
 
 	(float r,     /* radius */
@@ -155,4 +171,15 @@ vec3 map_to_unit_hemisphere_around_normal
 } /* map_to_unit_hemisphere_around_normal */
 
 
-/*--------------------------------------------------------------------------*/
\ No newline at end of file
+/*--------------------------------------------------------------------------*/
+
+float luminance
+
+	(vec3 color)  /* linear rgb */
+
+{
+	return dot(color, vec3(0.2126, 0.7152, 0.0722));
+
+} /* luminance */
+
+/*--------------------------------------------------------------------------*/
@@ -0,0 +1,219 @@
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+/*                                                                          */
+/*                                                                          */
+/*                               WAVEFRONT					                */
+/*                   									                    */
+/*                                                                          */
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+
+/*
+	Queues shared by the wavefront stages (descriptor set 1). Instead of
+	one invocation following a path through every bounce, each stage
+	does one kind of work for all active paths:
+
+	wf_generate   -> camera rays into the ray queue
+	wf_dispatch   -> turns the queue counters into indirect dispatch args
+	wf_shadow     -> occlusion tests for queued shadow rays
+	wf_extend     -> closest hit for every queued ray
+	wf_shade      -> material evaluation, pushes continuation/shadow rays
+	wf_accumulate -> temporal accumulation into the output images
+
+	Optionally extend and shade run in a binned order instead of queue
+	order (counting sort in three passes):
+
+	wf_sort_keys    -> key per queued ray/hit + histogram of the keys
+	wf_sort_scan    -> exclusive prefix sum of the histogram
+	wf_sort_scatter -> writes the permutation into `sort_index`
+
+	The ray queue is double buffered: shading reads from `queue` and
+	appends to `1 - queue`. The counts of the queues being consumed are
+	frozen into the `w` component of the dispatch args by wf_dispatch, so
+	the live counters can be reset for the stage that appends next.
+
+	Must match the structs in wavefront.h on the cpp side.
+*/
+
+/*--------------------------------------------------------------------------*/
+
+#define WF_GROUP_SIZE 64
+
+/* sort_flags */
+#define WF_SORT_RAYS 1  /* extend in (direction octant, origin Morton) order */
+#define WF_SORT_HITS 2  /* shade in material type order */
+
+/* sort_key */
+#define WF_KEY_RAY 0
+#define WF_KEY_HIT 1
+
+/* 3 bits direction octant + 3x3 bits origin Morton code */
+#define WF_SORT_BINS 4096
+
+/* lanes of the warps the sort statistics count key changes in */
+#define WF_WARP_SIZE 32
+
+struct WfRay
+{
+    vec3  origin;
+    uint  pixel;       /* linear pixel index */
+    vec3  direction;
+    uint  rng;         /* PRNG state carried between the stages */
+    vec3  throughput;
+    uint  depth;       /* bounce count */
+    vec3  radiance;    /* radiance gathered so far along the path */
+    int   integrator;  /* render mode of the path */
+};
+
+struct WfHit
+{
+    float t;     /* INF -> miss */
+    uint  prim;  /* triangle index */
+};
+
+struct WfShadowRay
+{
+    vec3  origin;
+    uint  pixel;
+    vec3  direction;
+    float maxt;
+    vec3  contribution; /* added to the pixel if the ray is unoccluded */
+    uint  pad;
+};
+
+layout(std430, set = 1, binding = 0) buffer WfCounters
+{
+    uint  ray_count;        /* rays appended to the output queue */
+    uint  shadow_count;     /* shadow rays appended */
+    uint  rays_traced;      /* statistics: rays traced this frame */
+    uint  pad;
+    uvec4 ray_dispatch;     /* xyz: indirect args, w: input queue size */
+    uvec4 shadow_dispatch;  /* xyz: indirect args, w: shadow queue size */
+    uvec4 sort_stats;       /* key changes between neighbours of a warp,
+                               statistics: x/y: ray keys in queue/sorted
+                               order, z/w: hit keys in queue/sorted order */
+    uvec2 sort_warps;       /* warps the changes were counted in, x: rays,
+                               y: hits */
+} wf;
+layout(std430, set = 1, binding = 1) buffer WfRays { WfRay ray_queue[]; };
+layout(std430, set = 1, binding = 2) buffer WfHits { WfHit hits[]; };
+layout(std430, set = 1, binding = 3) buffer WfShadowRays { WfShadowRay shadow_queue[]; };
+/* w is set when a ray of the pixel was deferred, see request_page */
+layout(std430, set = 1, binding = 4) buffer WfRadiance { vec4 radiance[]; };
+layout(std430, set = 1, binding = 5) buffer WfSortBins
+{
+    uint bin_count[WF_SORT_BINS];   /* histogram, reset by wf_sort_scan */
+    uint bin_offset[WF_SORT_BINS];  /* first slot of every bin */
+};
+layout(std430, set = 1, binding = 6) buffer WfSortKeys { uint sort_keys[]; };
+layout(std430, set = 1, binding = 7) buffer WfSortIndex { uint sort_index[]; };
+
+layout(push_constant) uniform WfPushConstants
+{
+    uint queue;         /* ray queue consumed by the current stage */
+    uint sample_index;  /* index of the sample in [0, aa) */
+    uint sort_flags;    /* WF_SORT_RAYS | WF_SORT_HITS */
+    uint sort_key;      /* key computed by wf_sort_keys */
+}
+wf_push;
+
+/* each queue holds one path per pixel */
+uint queue_capacity = uint(dim.x * dim.y);
+
+/*--------------------------------------------------------------------------*/
+
+uint queue_slot
+
+	(uint queue,  /* which of the two ray queues */
+	 uint index)  /* index in the queue */
+
+{
+	return queue * queue_capacity + index;
+
+} /* queue_slot */
+
+/*--------------------------------------------------------------------------*/
+
+uint sorted_index
+
+	(uint index,  /* index in processing order */
+	 uint flag)   /* sort flag of the calling stage */
+
+/*
+	Returns the queue index of the ray processed at `index`, which is
+	`index` itself unless the queue was binned for this stage. Binned
+	stages also count the key changes between neighbouring lanes of a
+	warp in the order they run, the counterpart of what wf_sort_keys
+	counts in queue order.
+*/
+
+{
+	if ((wf_push.sort_flags & flag) == 0) return index;
+
+	uint queue_index = sort_index[index];
+	if (index % WF_WARP_SIZE != 0 && sort_keys[sort_index[index - 1]] != sort_keys[queue_index])
+	{
+		if (flag == WF_SORT_RAYS)
+			atomicAdd(wf.sort_stats.y, 1);
+		else
+			atomicAdd(wf.sort_stats.w, 1);
+	}
+	return queue_index;
+
+} /* sorted_index */
+
+/*--------------------------------------------------------------------------*/
+
+uint ray_sort_key
+
+	(WfRay ray)  /* queued ray */
+
+/*
+	Direction octant in the high bits, so rays traversing the BVH in the
+	same child order end up next to each other, then the Morton code of
+	the origin on a 8x8x8 grid over the root bounds of the BVH.
+*/
+
+{
+	BvhNode root = bvh_nodes[0];
+	vec3 root_min = vec3(root.bounds[0], root.bounds[2], root.bounds[4]);
+	vec3 root_max = vec3(root.bounds[1], root.bounds[3], root.bounds[5]);
+
+	vec3 p = clamp((ray.origin - root_min) / max(root_max - root_min, vec3(1e-6)), 0.0, 1.0);
+	uvec3 cell = min(uvec3(p * 8), uvec3(7));
+
+	uint morton = 0;
+	for (uint i = 0; i < 3; ++i)
+	{
+		morton |= ((cell.x >> i) & 1) << (3 * i + 2);
+		morton |= ((cell.y >> i) & 1) << (3 * i + 1);
+		morton |= ((cell.z >> i) & 1) << (3 * i);
+	}
+
+	uint octant = uint(ray.direction.x < 0) | (uint(ray.direction.y < 0) << 1) |
+	              (uint(ray.direction.z < 0) << 2);
+
+	return (octant << 9) | morton;
+
+} /* ray_sort_key */
+
+/*--------------------------------------------------------------------------*/
+
+uint hit_sort_key
+
+	(WfHit hit)  /* closest hit of a queued ray */
+
+/*
+	0 for misses (background), 1 + material type otherwise.
+*/
+
+{
+	if (hit.t == INF) return 0;
+
+	return min(1 + uint(triangle_material(hit.prim).data.x), uint(WF_SORT_BINS - 1));
+
+} /* hit_sort_key */
+
+/*--------------------------------------------------------------------------*/
@@ -0,0 +1,253 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <map>
+#include <memory>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <fmt/format.h>
+#include <nlohmann/json.hpp>
+
+#include "image_io.h"
+#include "model_loader.h"
+#include "rvpt.h"
+#include "scene_file.h"
+
+CameraPose pose_at(std::vector<CameraPose> const& path, uint32_t frame, uint32_t frame_count)
+{
+    if (path.size() == 1 || frame_count == 1) return path.front();
+
+    float t = static_cast<float>(frame) / static_cast<float>(frame_count - 1) *
+              static_cast<float>(path.size() - 1);
+    size_t segment = std::min(static_cast<size_t>(t), path.size() - 2);
+    float local_t = t - static_cast<float>(segment);
+    return CameraPose{glm::mix(path[segment].position, path[segment + 1].position, local_t),
+                      glm::mix(path[segment].rotation, path[segment + 1].rotation, local_t)};
+}
+
+namespace
+{
+struct BatchJob
+{
+    std::string scene;
+    int width = 1024;
+    int height = 512;
+    uint32_t samples = 64;
+    int render_mode = 9;
+    int camera_mode = 0;
+    int aa = 1;
+    int max_bounces = 8;
+    float fov = 90.f;
+    std::vector<CameraPose> path;  // a single pose for still images
+    uint32_t frames = 1;
+    std::string output;
+};
+
+// An output of an animation needs a valid pattern giving each frame its own file
+bool valid_frame_pattern(std::string const& output)
+{
+    try
+    {
+        return fmt::format(output, 0) != fmt::format(output, 1);
+    }
+    catch (fmt::format_error const&)
+    {
+        return false;
+    }
+}
+
+CameraPose read_pose(nlohmann::json const& json)
+{
+    return CameraPose{read_vec3(json, "position", glm::vec3(0)),
+                      read_vec3(json, "rotation", glm::vec3(0))};
+}
+
+bool parse_job_file(std::string const& job_file,
+                    std::map<std::string, SceneDescription>& scenes, std::vector<BatchJob>& jobs)
+{
+    std::ifstream input(job_file);
+    if (!input)
+    {
+        fmt::print(stderr, "Failed to open job file {}\n", job_file);
+        return false;
+    }
+
+    try
+    {
+        nlohmann::json json;
+        input >> json;
+
+        for (auto& [name, scene_json] : json.at("scenes").items())
+            scenes[name] = read_scene_description(scene_json);
+
+        for (auto& job_json : json.at("jobs"))
+        {
+            BatchJob job;
+            job.scene = job_json.at("scene").get<std::string>();
+            job.width = job_json.value("width", job.width);
+            job.height = job_json.value("height", job.height);
+            job.samples = job_json.value("samples", job.samples);
+            job.render_mode = job_json.value("render_mode", job.render_mode);
+            job.camera_mode = job_json.value("camera_mode", job.camera_mode);
+            job.aa = job_json.value("aa", job.aa);
+            job.max_bounces = job_json.value("max_bounces", job.max_bounces);
+            job.fov = job_json.value("fov", job.fov);
+            job.output = job_json.at("output").get<std::string>();
+
+            if (job_json.contains("path"))
+            {
+                for (auto& pose : job_json["path"]) job.path.push_back(read_pose(pose));
+                job.frames = job_json.value("frames", static_cast<uint32_t>(job.path.size()));
+            }
+            else
+            {
+                job.path.push_back(read_pose(job_json.value("camera", nlohmann::json::object())));
+            }
+
+            if (scenes.count(job.scene) == 0 || job.path.empty() || job.frames == 0)
+            {
+                fmt::print(stderr, "Job writing {} has an unknown scene or no camera\n",
+                           job.output);
+                return false;
+            }
+            if (job.frames > 1 && !valid_frame_pattern(job.output))
+            {
+                fmt::print(stderr,
+                           "Job writing {} renders {} frames but its output isn't a pattern "
+                           "numbering them, like orbit_{{:04}}.ppm\n",
+                           job.output, job.frames);
+                return false;
+            }
+            jobs.push_back(job);
+        }
+    }
+    catch (nlohmann::json::exception const& e)
+    {
+        fmt::print(stderr, "Failed to parse job file {}: {}\n", job_file, e.what());
+        return false;
+    }
+    return true;
+}
+
+bool load_scene(RVPT& rvpt, SceneDescription const& scene)
+{
+    if (!scene.scene_file.empty())
+    {
+        std::string path = scene.scene_file;
+        rvpt.get_asset_path(path);
+        return rvpt.load_scene_file(path);
+    }
+    for (auto& model : scene.models) load_model(rvpt, model.file, model.material_id);
+    for (auto& material : scene.materials) rvpt.add_material(material);
+    return true;
+}
+}  // namespace
+
+int run_batch(std::string const& job_file)
+{
+    std::map<std::string, SceneDescription> scenes;
+    std::vector<BatchJob> jobs;
+    if (!parse_job_file(job_file, scenes, jobs)) return -1;
+
+    // group jobs sharing a device, then jobs sharing a scene
+    std::stable_sort(jobs.begin(), jobs.end(), [](BatchJob const& a, BatchJob const& b) {
+        return std::tie(a.width, a.height, a.scene) < std::tie(b.width, b.height, b.scene);
+    });
+
+    auto batch_start = std::chrono::high_resolution_clock::now();
+    uint32_t images_written = 0;
+    bool all_written = true;
+
+    // images are written while the next frames render
+    std::deque<std::future<bool>> pending_writes;
+    auto finish_writes = [&](size_t keep_pending) {
+        while (pending_writes.size() > keep_pending)
+        {
+            bool written = pending_writes.front().get();
+            all_written &= written;
+            images_written += written ? 1 : 0;
+            pending_writes.pop_front();
+        }
+    };
+
+    std::unique_ptr<RVPT> rvpt;
+    std::string current_scene;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        auto& job = jobs[i];
+        bool new_device = i == 0 || job.width != jobs[i - 1].width ||
+                          job.height != jobs[i - 1].height;
+        if (new_device)
+        {
+            if (rvpt) rvpt->shutdown();
+
+            Window::Settings settings;
+            settings.width = job.width;
+            settings.height = job.height;
+            rvpt = std::make_unique<RVPT>(settings);
+            if (!load_scene(*rvpt, scenes.at(job.scene)))
+            {
+                finish_writes(0);
+                return -1;
+            }
+            if (!rvpt->initialize())
+            {
+                fmt::print(stderr, "Failed to initialize RVPT for {}x{}\n", job.width,
+                           job.height);
+                finish_writes(0);
+                return -1;
+            }
+        }
+        else if (job.scene != current_scene)
+        {
+            rvpt->clear_scene();
+            if (!load_scene(*rvpt, scenes.at(job.scene)))
+            {
+                finish_writes(0);
+                return -1;
+            }
+            rvpt->upload_scene();
+        }
+        current_scene = job.scene;
+
+        auto& settings = rvpt->render_settings;
+        settings.top_left_render_mode = settings.top_right_render_mode =
+            settings.bottom_left_render_mode = settings.bottom_right_render_mode =
+                job.render_mode;
+        settings.aa = job.aa;
+        settings.max_bounces = job.max_bounces;
+        rvpt->scene_camera.set_camera_mode(job.camera_mode);
+        rvpt->scene_camera.set_fov(job.fov);
+
+        for (uint32_t frame = 0; frame < job.frames; frame++)
+        {
+            auto pose = pose_at(job.path, frame, job.frames);
+            rvpt->scene_camera.set_translation(pose.position);
+            rvpt->scene_camera.set_rotation(pose.rotation);
+
+            rvpt->render_samples(job.samples);
+            std::string output = job.frames > 1 ? fmt::format(job.output, frame) : job.output;
+            pending_writes.push_back(
+                std::async(std::launch::async, [output, pixels = rvpt->read_image(),
+                                                 width = static_cast<uint32_t>(job.width),
+                                                 height = static_cast<uint32_t>(job.height)] {
+                    return write_ppm(output, pixels, width, height);
+                }));
+            // bound the memory held by images waiting to be written
+            finish_writes(std::thread::hardware_concurrency());
+        }
+    }
+    if (rvpt) rvpt->shutdown();
+    finish_writes(0);
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - batch_start;
+    fmt::print("Rendered {} images in {:.1f} s ({:.0f} frames/hour)\n", images_written,
+               elapsed.count(), images_written / elapsed.count() * 3600.0);
+    return all_written ? 0 : -1;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Renders every job of a JSON job file headless and returns the process exit code.
+//
+// {
+//   "scenes": {
+//     "rabbit": {
+//       "models": [{"file": "models/rabbit.obj", "material": 1}],
+//       "materials": [{"albedo": [1, 1, 1], "emission": [0.1, 0.4, 0.6], "type": "lambert"},
+//                     {"albedo": [1, 1, 1], "type": "lambert"}]
+//     },
+//     "rabbit_converted": {"file": "scenes/rabbit.rvscene"}
+//   },
+//   "jobs": [
+//     {"scene": "rabbit", "width": 1024, "height": 512, "samples": 64, "render_mode": 9,
+//      "camera": {"position": [0, 0, 0], "rotation": [0, 0, 0]}, "output": "rabbit.ppm"},
+//     {"scene": "rabbit", "width": 1024, "height": 512, "samples": 16, "render_mode": 9,
+//      "path": [{"position": [0, 0, 0]}, {"position": [0, 0, 4], "rotation": [90, 0, 0]}],
+//      "frames": 48, "output": "orbit_{:04}.ppm"}
+//   ]
+// }
+//
+// A scene is either built from .obj files and materials or loaded from a scene file written by
+// rvpt_convert (see scene_file.h), both paths relative to the assets folder.
+//
+// Optional job fields: "aa", "max_bounces", "camera_mode", "fov". A path is interpolated
+// linearly over "frames" images, "output" is formatted with the frame index.
+//
+// Jobs are rendered grouped by resolution, then by scene: jobs with the same resolution share
+// one device with its pipelines, consecutive jobs with the same scene share the scene data.
+int run_batch(std::string const& job_file);
+
+struct CameraPose
+{
+    glm::vec3 position{};
+    glm::vec3 rotation{};
+};
+
+// Camera at `frame` of `frame_count` along the piecewise linear path
+CameraPose pose_at(std::vector<CameraPose> const& path, uint32_t frame, uint32_t frame_count);
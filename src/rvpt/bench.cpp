@@ -0,0 +1,274 @@
+// rvpt_bench [--output report.json] [--width W] [--height H] [--frames N] [--seed S]
+//            [--reference-samples N]
+//
+// Renders the canonical scenes along scripted camera paths with fixed seeds, headless so it also
+// runs on software implementations like lavapipe, and writes the measurements as JSON:
+// samples/s and GPU time per pass for every case, rays/s for the wavefront cases (the megakernel
+// doesn't count its rays), and the RMSE of short renders against a long reference render, with
+// and without the denoiser. The still path is also rendered with the megakernel and the wavefront
+// path at several max_bounces.
+//
+// Every scene starts its own RVPT, the report has the time each one took to create its pipelines.
+// Without a pipeline_cache.bin the first scene starts with a cold pipeline cache and the others
+// with the warm one it saved.
+
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+
+#include "batch.h"
+#include "image_io.h"
+#include "model_loader.h"
+#include "rvpt.h"
+
+namespace
+{
+struct BenchScene
+{
+    std::string name;
+    Material model_material;
+};
+
+struct BenchPath
+{
+    std::string name;
+    std::vector<CameraPose> poses;
+};
+
+struct BenchSettings
+{
+    int width = 512;
+    int height = 256;
+    uint32_t frames = 64;
+    uint32_t warmup_frames = 8;
+    uint32_t seed = 1;
+    uint32_t reference_samples = 256;
+};
+
+// the demo scene with the rabbit made of each material type
+std::vector<BenchScene> const bench_scenes = {
+    {"rabbit_lambert",
+     Material(glm::vec4(1.0, 1.0, 1.0, 0), glm::vec4(0), Material::Type::LAMBERT)},
+    {"rabbit_mirror", Material(glm::vec4(0.9, 0.9, 0.9, 0), glm::vec4(0), Material::Type::MIRROR)},
+    {"rabbit_glass",
+     Material(glm::vec4(1.0, 1.0, 1.0, 1.5), glm::vec4(0), Material::Type::DIELECTRIC)}};
+
+std::vector<BenchPath> const bench_paths = {
+    {"still", {{glm::vec3(0), glm::vec3(0)}}},
+    {"dolly", {{glm::vec3(0), glm::vec3(0)}, {glm::vec3(0, 0, 2), glm::vec3(0)}}},
+    {"pan", {{glm::vec3(0), glm::vec3(-30, 0, 0)}, {glm::vec3(0), glm::vec3(30, 10, 0)}}}};
+
+uint32_t const convergence_samples[] = {1, 4, 16, 64};
+
+// the bounce counts of the persistent threads benchmark in rvpt.cpp
+int const sweep_bounces[] = {1, 4, 16};
+
+constexpr int kajiya_render_mode = 9;
+
+void load_bench_scene(RVPT& rvpt, BenchScene const& scene)
+{
+    load_model(rvpt, "models/rabbit.obj", 1);
+    rvpt.add_material(
+        Material(glm::vec4(1, 1, 1, 0), glm::vec4(0.1, 0.4, 0.6, 0), Material::Type::LAMBERT));
+    rvpt.add_material(scene.model_material);
+}
+
+void set_pose(RVPT& rvpt, CameraPose const& pose)
+{
+    rvpt.scene_camera.set_translation(pose.position);
+    rvpt.scene_camera.set_rotation(pose.rotation);
+}
+
+nlohmann::json run_case(RVPT& rvpt, BenchSettings const& settings, BenchPath const& path,
+                        bool wavefront)
+{
+    rvpt.set_random_seed(settings.seed);
+    rvpt.set_wavefront(wavefront);
+
+    set_pose(rvpt, path.poses.front());
+    for (uint32_t i = 0; i < settings.warmup_frames; i++)
+    {
+        rvpt.update();
+        rvpt.draw();
+    }
+    rvpt.wait_idle();
+
+    // the counters read back during the measured frames belong to frames MAX_FRAMES_IN_FLIGHT
+    // earlier, which rendered the same case as well thanks to the warmup
+    uint64_t rays = 0;
+    std::array<double, GPU_PASS_COUNT> gpu_ms_sum{};
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t frame = 0; frame < settings.frames; frame++)
+    {
+        set_pose(rvpt, pose_at(path.poses, frame, settings.frames));
+        rvpt.update();
+        rays += rvpt.get_wavefront_stats().rays_traced;
+        auto const& pass_times = rvpt.get_latest_gpu_pass_times();
+        for (size_t i = 0; i < GPU_PASS_COUNT; i++) gpu_ms_sum[i] += pass_times[i];
+        rvpt.draw();
+    }
+    rvpt.wait_idle();
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    double seconds = elapsed.count();
+
+    double samples = static_cast<double>(settings.width) * settings.height *
+                     std::max(rvpt.render_settings.aa, 1) * settings.frames;
+
+    nlohmann::json result;
+    result["path"] = path.name;
+    result["wavefront"] = wavefront;
+    result["max_bounces"] = rvpt.render_settings.max_bounces;
+    result["frames"] = settings.frames;
+    result["seconds"] = seconds;
+    result["samples_per_second"] = samples / seconds;
+    if (wavefront)
+        result["rays_per_second"] = static_cast<double>(rays) / seconds;
+    else
+        result["rays_per_second"] = nullptr;
+    // mean over the measured frames, 0 without timestamp support
+    auto& gpu_ms = result["gpu_ms"];
+    for (size_t i = 0; i < GPU_PASS_COUNT; i++)
+        gpu_ms[GpuPassNames[i]] = gpu_ms_sum[i] / settings.frames;
+
+    rvpt.set_wavefront(false);
+    return result;
+}
+
+// RMSE of renders with few samples against one with many, from the start of the first path. The
+// reference isn't denoised, the short renders are measured as they are and denoised
+nlohmann::json run_convergence(RVPT& rvpt, BenchSettings const& settings)
+{
+    set_pose(rvpt, bench_paths.front().poses.front());
+    rvpt.set_random_seed(settings.seed);
+    rvpt.render_samples(settings.reference_samples);
+    auto reference = rvpt.read_image();
+
+    nlohmann::json points = nlohmann::json::array();
+    for (uint32_t samples : convergence_samples)
+    {
+        // a different seed than the reference, so its noise is not correlated with it
+        rvpt.set_random_seed(settings.seed + 1);
+        rvpt.render_samples(samples);
+        double rmse = rmse_rgba8(rvpt.read_image(), reference);
+
+        rvpt.set_random_seed(settings.seed + 1);
+        rvpt.render_settings.denoise = 1;
+        rvpt.render_samples(samples);
+        double denoised_rmse = rmse_rgba8(rvpt.read_image(), reference);
+        rvpt.render_settings.denoise = 0;
+
+        points.push_back({{"samples", samples}, {"rmse", rmse}, {"denoised_rmse", denoised_rmse}});
+    }
+    return nlohmann::json{{"reference_samples", settings.reference_samples}, {"points", points}};
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    BenchSettings settings;
+    std::string output = "rvpt_bench.json";
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            fmt::print(stderr, "Unknown or incomplete argument {}\n", arg);
+            return -1;
+        }
+        else if (arg == "--output")
+            output = argv[++i];
+        else if (arg == "--width")
+            settings.width = std::stoi(argv[++i]);
+        else if (arg == "--height")
+            settings.height = std::stoi(argv[++i]);
+        else if (arg == "--frames")
+            settings.frames = static_cast<uint32_t>(std::stoul(argv[++i]));
+        else if (arg == "--seed")
+            settings.seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+        else if (arg == "--reference-samples")
+            settings.reference_samples = static_cast<uint32_t>(std::stoul(argv[++i]));
+        else
+        {
+            fmt::print(stderr, "Unknown argument {}\n", arg);
+            return -1;
+        }
+    }
+
+    nlohmann::json report;
+    report["width"] = settings.width;
+    report["height"] = settings.height;
+    report["seed"] = settings.seed;
+    report["render_mode"] = RenderModes[kajiya_render_mode];
+
+    Window::Settings window_settings;
+    window_settings.width = settings.width;
+    window_settings.height = settings.height;
+    for (auto& scene : bench_scenes)
+    {
+        RVPT rvpt(window_settings);
+        load_bench_scene(rvpt, scene);
+        if (!rvpt.initialize())
+        {
+            fmt::print(stderr, "Failed to initialize RVPT\n");
+            return -1;
+        }
+        auto& render_settings = rvpt.render_settings;
+        render_settings.top_left_render_mode = render_settings.top_right_render_mode =
+            render_settings.bottom_left_render_mode = render_settings.bottom_right_render_mode =
+                kajiya_render_mode;
+
+        nlohmann::json scene_report;
+        scene_report["triangles"] = rvpt.get_triangles().size();
+        scene_report["pipelines_ms"] = rvpt.get_pipelines_ready_ms();
+        scene_report["pipeline_cache"] = rvpt.pipeline_cache_warm() ? "warm" : "cold";
+        for (auto& path : bench_paths)
+        {
+            for (bool wavefront : {false, true})
+            {
+                auto result = run_case(rvpt, settings, path, wavefront);
+                fmt::print("{:<15} {:<6} {:<10} {:8.2f} Msamples/s {:8.3f} ms/frame GPU\n",
+                           scene.name, path.name, wavefront ? "wavefront" : "megakernel",
+                           result["samples_per_second"].get<double>() / 1000000.0,
+                           result["gpu_ms"][GpuPassNames[0]].get<double>());
+                scene_report["cases"].push_back(std::move(result));
+            }
+        }
+
+        // megakernel against wavefront at several path lengths
+        int default_bounces = render_settings.max_bounces;
+        for (int bounces : sweep_bounces)
+        {
+            render_settings.max_bounces = bounces;
+            for (bool wavefront : {false, true})
+            {
+                auto result = run_case(rvpt, settings, bench_paths.front(), wavefront);
+                fmt::print("{:<15} {:<2} bounces {:<10} {:8.2f} Msamples/s {:8.3f} ms/frame GPU\n",
+                           scene.name, bounces, wavefront ? "wavefront" : "megakernel",
+                           result["samples_per_second"].get<double>() / 1000000.0,
+                           result["gpu_ms"][GpuPassNames[0]].get<double>());
+                scene_report["bounce_sweep"].push_back(std::move(result));
+            }
+        }
+        render_settings.max_bounces = default_bounces;
+
+        scene_report["convergence"] = run_convergence(rvpt, settings);
+        report["scenes"][scene.name] = std::move(scene_report);
+
+        rvpt.shutdown();
+    }
+
+    std::ofstream report_file(output);
+    if (!report_file)
+    {
+        fmt::print(stderr, "Failed to open {} for writing\n", output);
+        return -1;
+    }
+    report_file << report.dump(4) << '\n';
+    fmt::print("Wrote {}\n", output);
+    return 0;
+}
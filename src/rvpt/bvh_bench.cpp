@@ -0,0 +1,453 @@
+// bvh_bench [--model assets/models/rabbit.obj] [--baseline baseline.json] [--output report.json]
+//           [--repetitions N] [--rays N] [--tolerance T]
+//
+// Builds the BVH of synthetic and real meshes without a Vulkan device and measures the builder
+// and the CPU traversal: median build time, peak heap memory during the build, size of the BVH,
+// its SAH cost, the time of Bvh::permute_primitives and Bvh::collect_aabbs_by_depth, single ray
+// traversal throughput on one thread, and the size of the scene buffers on the GPU as indexed
+// triangles against one Triangle each. The meshes and rays come from a fixed seed, so the
+// quality metrics are the same on every machine.
+//
+// With --baseline the results are compared against an earlier report: the SAH cost and node
+// count always, times only when the baseline has them (timings of another machine mean nothing).
+// Any regression beyond the tolerance makes the exit code non zero. A report written with
+// --output serves as the baseline of later runs, assets/benchmarks/bvh_baseline.json holds the
+// quality metrics of the current builder.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+
+#include "bvh.h"
+#include "bvh_builder.h"
+#include "geometry.h"
+#include "indexed_mesh.h"
+#include "obj_loader.h"
+#include "ray_query.h"
+#include "thread_pool.h"
+
+// Heap usage of the whole program, to measure the temporary memory of the builder. The size of
+// every allocation is kept in front of it, aligned so the allocation itself stays aligned for
+// every fundamental type. Over-aligned allocations are not counted.
+namespace
+{
+std::atomic<size_t> heap_in_use{0};
+std::atomic<size_t> heap_peak{0};
+
+constexpr size_t allocation_header = alignof(std::max_align_t);
+
+void* counted_allocation(size_t size)
+{
+    void* memory = std::malloc(size + allocation_header);
+    if (!memory) throw std::bad_alloc();
+    *static_cast<size_t*>(memory) = size;
+
+    size_t in_use = heap_in_use.fetch_add(size) + size;
+    size_t peak = heap_peak.load();
+    while (in_use > peak && !heap_peak.compare_exchange_weak(peak, in_use))
+    {
+    }
+    return static_cast<char*>(memory) + allocation_header;
+}
+
+void counted_free(void* pointer) noexcept
+{
+    if (!pointer) return;
+    void* memory = static_cast<char*>(pointer) - allocation_header;
+    heap_in_use.fetch_sub(*static_cast<size_t*>(memory));
+    std::free(memory);
+}
+}  // namespace
+
+void* operator new(size_t size) { return counted_allocation(size); }
+void* operator new[](size_t size) { return counted_allocation(size); }
+void operator delete(void* pointer) noexcept { counted_free(pointer); }
+void operator delete[](void* pointer) noexcept { counted_free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { counted_free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { counted_free(pointer); }
+
+namespace
+{
+struct BenchSettings
+{
+    std::string model = "assets/models/rabbit.obj";
+    uint32_t repetitions = 5;
+    uint32_t ray_count = 1 << 16;
+    double tolerance = 0.15;      // relative slowdown of times which counts as a regression
+    double sah_tolerance = 0.01;  // relative increase of the SAH cost
+};
+
+// xorshift32, so the meshes don't depend on the standard library's distributions
+struct Random
+{
+    uint32_t state;
+
+    // in [0, 1)
+    float next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return static_cast<float>(state >> 8) * (1.0f / 16777216.0f);
+    }
+    float next(float min, float max) { return min + (max - min) * next(); }
+    glm::vec3 next_vec3(float min, float max)
+    {
+        float x = next(min, max);
+        float y = next(min, max);
+        return glm::vec3(x, y, next(min, max));
+    }
+};
+
+// Small triangles spread uniformly over a cube
+std::vector<Triangle> random_triangles(size_t count)
+{
+    Random random{0x9e3779b9u};
+    std::vector<Triangle> triangles;
+    triangles.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec3 center = random.next_vec3(-1.0f, 1.0f);
+        glm::vec3 v0 = center + random.next_vec3(-0.02f, 0.02f);
+        glm::vec3 v1 = center + random.next_vec3(-0.02f, 0.02f);
+        glm::vec3 v2 = center + random.next_vec3(-0.02f, 0.02f);
+        triangles.emplace_back(v0, v1, v2, 0);
+    }
+    return triangles;
+}
+
+// UV sphere of radius 1, with single triangles around the poles
+std::vector<Triangle> sphere_triangles(uint32_t rings, uint32_t segments)
+{
+    auto point = [&](uint32_t ring, uint32_t segment) {
+        float theta = 3.14159265f * static_cast<float>(ring) / static_cast<float>(rings);
+        float phi = 6.28318531f * static_cast<float>(segment) / static_cast<float>(segments);
+        return glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta),
+                         std::sin(theta) * std::sin(phi));
+    };
+
+    std::vector<Triangle> triangles;
+    for (uint32_t ring = 0; ring < rings; ring++)
+    {
+        for (uint32_t segment = 0; segment < segments; segment++)
+        {
+            glm::vec3 p00 = point(ring, segment);
+            glm::vec3 p01 = point(ring, segment + 1);
+            glm::vec3 p10 = point(ring + 1, segment);
+            glm::vec3 p11 = point(ring + 1, segment + 1);
+            if (ring != 0) triangles.emplace_back(p00, p10, p01, 0);
+            if (ring != rings - 1) triangles.emplace_back(p01, p10, p11, 0);
+        }
+    }
+    return triangles;
+}
+
+// Long thin triangles crossing half the scene in random directions, whose boxes overlap a lot,
+// the worst case for splitting by centroid
+std::vector<Triangle> sliver_triangles(size_t count)
+{
+    Random random{0x2545f491u};
+    std::vector<Triangle> triangles;
+    triangles.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec3 start = random.next_vec3(-1.0f, 1.0f);
+        glm::vec3 direction = random.next_vec3(-1.0f, 1.0f);
+        if (glm::dot(direction, direction) < 1e-4f) direction = glm::vec3(1, 0, 0);
+        glm::vec3 end = start + glm::normalize(direction);
+        glm::vec3 width = 0.001f * glm::normalize(glm::cross(direction, glm::vec3(0.3f, 1, 0.1f)));
+        triangles.emplace_back(start, end, start + width, 0);
+    }
+    return triangles;
+}
+
+struct BenchMesh
+{
+    std::string name;
+    std::function<bool(std::vector<Triangle>&)> create;
+};
+
+// Expected cost of tracing a ray through the tree, relative to testing the root box: a node costs
+// one box test weighted by the probability to reach it (its area over the root's), a leaf one
+// triangle test per primitive on top
+double sah_cost(Bvh const& bvh)
+{
+    constexpr double traversal_cost = 1.0;
+    constexpr double intersection_cost = 1.0;
+    if (bvh.nodes.empty()) return 0.0;
+
+    double root_area = bvh.nodes[0].aabb().half_area();
+    if (root_area <= 0.0) return 0.0;
+    double cost = 0.0;
+    for (auto const& node : bvh.nodes)
+    {
+        double probability = node.aabb().half_area() / root_area;
+        cost += probability * traversal_cost;
+        if (node.is_leaf()) cost += probability * node.primitive_count * intersection_cost;
+    }
+    return cost;
+}
+
+// Rays from a sphere around the scene towards random points inside its bounds
+std::vector<CpuRay> bench_rays(AABB const& bounds, uint32_t count)
+{
+    Random random{0x68e31da4u};
+    glm::vec3 center = bounds.center();
+    float radius = glm::length(bounds.diagonal());
+    std::vector<CpuRay> rays(count);
+    for (auto& ray : rays)
+    {
+        glm::vec3 offset = random.next_vec3(-1.0f, 1.0f);
+        if (glm::dot(offset, offset) < 1e-4f) offset = glm::vec3(0, 0, 1);
+        ray.origin = center + radius * glm::normalize(offset);
+        glm::vec3 target = bounds.min + random.next_vec3(0.0f, 1.0f) * bounds.diagonal();
+        ray.direction = glm::normalize(target - ray.origin);
+    }
+    return rays;
+}
+
+double milliseconds_since(std::chrono::high_resolution_clock::time_point start)
+{
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::high_resolution_clock::now() - start;
+    return elapsed.count();
+}
+
+double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+nlohmann::json run_mesh(BenchSettings const& settings, std::vector<Triangle> const& triangles)
+{
+    BinnedBvhBuilder builder;
+    std::vector<double> build_ms;
+    size_t build_peak_bytes = 0;
+    Bvh bvh;
+    for (uint32_t i = 0; i < settings.repetitions; i++)
+    {
+        bvh = Bvh{};
+        size_t heap_before = heap_in_use.load();
+        heap_peak.store(heap_before);
+        auto start = std::chrono::high_resolution_clock::now();
+        bvh = builder.build_bvh(triangles);
+        build_ms.push_back(milliseconds_since(start));
+        build_peak_bytes = heap_peak.load() - heap_before;
+    }
+
+    std::vector<double> permute_ms;
+    std::vector<Triangle> sorted_triangles;
+    for (uint32_t i = 0; i < settings.repetitions; i++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        sorted_triangles = bvh.permute_primitives(triangles);
+        permute_ms.push_back(milliseconds_since(start));
+    }
+
+    std::vector<double> collect_ms;
+    size_t depth = 0;
+    for (uint32_t i = 0; i < settings.repetitions; i++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        depth = bvh.collect_aabbs_by_depth().size();
+        collect_ms.push_back(milliseconds_since(start));
+    }
+
+    size_t leaves = static_cast<size_t>(std::count_if(
+        bvh.nodes.begin(), bvh.nodes.end(), [](BvhNode const& node) { return node.is_leaf(); }));
+    size_t bvh_bytes =
+        bvh.nodes.size() * sizeof(BvhNode) + bvh.primitive_indices.size() * sizeof(uint32_t);
+
+    // one ray at a time on this thread, the pool only satisfies the RayQuery constructor
+    ThreadPool pool(1);
+    RayQuery query(pool);
+    query.set_scene(bvh, sorted_triangles);
+    auto rays = bench_rays(bvh.nodes.empty() ? AABB(glm::vec3(0)) : bvh.nodes[0].aabb(),
+                           settings.ray_count);
+    uint32_t hits = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto const& ray : rays)
+    {
+        CpuIsect isect;
+        hits += query.intersect(ray, 0.0f, std::numeric_limits<float>::infinity(), isect) ? 1u : 0u;
+    }
+    double trace_seconds = milliseconds_since(start) / 1000.0;
+
+    nlohmann::json result;
+    result["triangles"] = triangles.size();
+    result["nodes"] = bvh.nodes.size();
+    result["leaves"] = leaves;
+    result["depth"] = depth;
+    result["sah_cost"] = sah_cost(bvh);
+    result["bvh_bytes"] = bvh_bytes;
+    result["triangle_buffer_bytes"] = triangles.size() * sizeof(Triangle);
+    result["indexed_buffer_bytes"] = index_triangles(triangles).byte_size();
+    result["build_peak_bytes"] = build_peak_bytes;
+    result["build_ms"] = median(build_ms);
+    result["permute_ms"] = median(permute_ms);
+    result["collect_aabbs_ms"] = median(collect_ms);
+    result["hit_ratio"] =
+        static_cast<double>(hits) / std::max(static_cast<double>(rays.size()), 1.0);
+    result["mrays_per_second"] = static_cast<double>(rays.size()) / trace_seconds / 1000000.0;
+    return result;
+}
+
+// Prints the differences to `baseline`, returns the number of regressions
+int compare_to_baseline(nlohmann::json const& report, nlohmann::json const& baseline,
+                        BenchSettings const& settings)
+{
+    int regressions = 0;
+    auto check = [&](std::string const& mesh, std::string const& key, double tolerance,
+                     bool lower_is_better) {
+        auto const& base_mesh = baseline["meshes"][mesh];
+        if (!base_mesh.contains(key)) return;
+        double base = base_mesh[key].get<double>();
+        // builds this short are mostly timer and scheduling noise
+        if (key == "build_ms" && base < 1.0) return;
+        double value = report["meshes"][mesh][key].get<double>();
+        double change = base != 0.0 ? (value - base) / base : 0.0;
+        bool regressed = lower_is_better ? change > tolerance : change < -tolerance;
+        if (regressed) regressions++;
+        fmt::print("  {:<10} {:<18} {:12.4f} -> {:12.4f} ({:+6.1f}%){}\n", mesh, key, base,
+                   value, change * 100.0, regressed ? "  REGRESSION" : "");
+    };
+
+    fmt::print("Against the baseline:\n");
+    for (auto const& [mesh, result] : report["meshes"].items())
+    {
+        if (!baseline["meshes"].contains(mesh))
+        {
+            fmt::print("  {:<10} not in the baseline\n", mesh);
+            continue;
+        }
+        check(mesh, "sah_cost", settings.sah_tolerance, true);
+        check(mesh, "nodes", settings.sah_tolerance, true);
+        check(mesh, "build_ms", settings.tolerance, true);
+        check(mesh, "mrays_per_second", settings.tolerance, false);
+    }
+    return regressions;
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    BenchSettings settings;
+    std::string baseline_file;
+    std::string output;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            fmt::print(stderr, "Unknown or incomplete argument {}\n", arg);
+            return -1;
+        }
+        else if (arg == "--model")
+            settings.model = argv[++i];
+        else if (arg == "--baseline")
+            baseline_file = argv[++i];
+        else if (arg == "--output")
+            output = argv[++i];
+        else if (arg == "--repetitions")
+            settings.repetitions = std::max(static_cast<uint32_t>(std::stoul(argv[++i])), 1u);
+        else if (arg == "--rays")
+            settings.ray_count = static_cast<uint32_t>(std::stoul(argv[++i]));
+        else if (arg == "--tolerance")
+            settings.tolerance = std::stod(argv[++i]);
+        else
+        {
+            fmt::print(stderr, "Unknown argument {}\n", arg);
+            return -1;
+        }
+    }
+
+    std::vector<BenchMesh> const meshes = {
+        {"random",
+         [](std::vector<Triangle>& triangles) {
+             triangles = random_triangles(100000);
+             return true;
+         }},
+        {"sphere",
+         [](std::vector<Triangle>& triangles) {
+             triangles = sphere_triangles(256, 512);
+             return true;
+         }},
+        {"rabbit",
+         [&](std::vector<Triangle>& triangles) {
+             return load_obj(settings.model, 0, triangles);
+         }},
+        {"slivers", [](std::vector<Triangle>& triangles) {
+             triangles = sliver_triangles(20000);
+             return true;
+         }}};
+
+    nlohmann::json report;
+    report["repetitions"] = settings.repetitions;
+    report["rays"] = settings.ray_count;
+    fmt::print("{:<10} {:>9} {:>9} {:>9} {:>10} {:>10} {:>10} {:>9} {:>10}\n", "mesh", "tris",
+               "build ms", "peak MB", "bvh MB", "SAH cost", "permute ms", "Mrays/s",
+               "indexed %");
+    for (auto const& mesh : meshes)
+    {
+        std::vector<Triangle> triangles;
+        if (!mesh.create(triangles))
+        {
+            fmt::print(stderr, "Skipping {}, its mesh couldn't be loaded\n", mesh.name);
+            continue;
+        }
+
+        auto result = run_mesh(settings, triangles);
+        fmt::print(
+            "{:<10} {:>9} {:>9.2f} {:>9.2f} {:>10.2f} {:>10.2f} {:>10.3f} {:>9.2f} {:>10.1f}\n",
+            mesh.name, triangles.size(), result["build_ms"].get<double>(),
+            result["build_peak_bytes"].get<double>() / 1048576.0,
+            result["bvh_bytes"].get<double>() / 1048576.0, result["sah_cost"].get<double>(),
+            result["permute_ms"].get<double>(), result["mrays_per_second"].get<double>(),
+            100.0 * result["indexed_buffer_bytes"].get<double>() /
+                result["triangle_buffer_bytes"].get<double>());
+        report["meshes"][mesh.name] = std::move(result);
+    }
+
+    if (!output.empty())
+    {
+        std::ofstream report_file(output);
+        if (!report_file)
+        {
+            fmt::print(stderr, "Failed to open {} for writing\n", output);
+            return -1;
+        }
+        report_file << report.dump(4) << '\n';
+        fmt::print("Wrote {}\n", output);
+    }
+
+    if (!baseline_file.empty())
+    {
+        std::ifstream baseline_input(baseline_file);
+        nlohmann::json baseline = nlohmann::json::parse(baseline_input, nullptr, false);
+        if (baseline.is_discarded() || !baseline.contains("meshes"))
+        {
+            fmt::print(stderr, "Failed to read the baseline {}\n", baseline_file);
+            return -1;
+        }
+        int regressions = compare_to_baseline(report, baseline, settings);
+        if (regressions > 0)
+        {
+            fmt::print("{} regressions\n", regressions);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -41,7 +41,7 @@ Bvh BinnedBvhBuilder::build_bvh(const std::vector<glm::vec3>& primitive_centers,
 size_t BinnedBvhBuilder::compute_bin_index(int axis, const glm::vec3& center,
                                            const AABB& aabb) noexcept
 {
-    int index = static_cast<int>((center[axis] - aabb.min[axis]) * (center[axis] - aabb.min[axis]) *
+    int index = static_cast<int>((center[axis] - aabb.min[axis]) *
                                  (static_cast<float>(bin_count) / aabb.diagonal()[axis]));
     return std::min(int{bin_count - 1}, std::max(0, index));
 }
@@ -164,7 +164,7 @@ void BinnedBvhBuilder::build_bvh_node(Bvh& bvh, BvhNode& node_to_build,
                   [&primitive_centers, min_axis = min_axis](size_t i, size_t j) {
                       return primitive_centers[i][min_axis] < primitive_centers[j][min_axis];
                   });
-        right_partition_begin = primitives_begin + node_to_build.primitive_count >> 1;
+        right_partition_begin = primitives_begin + (node_to_build.primitive_count >> 1);
     }
     else
     {
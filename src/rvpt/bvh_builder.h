@@ -10,6 +10,7 @@
 
 #include "bvh.h"
 #include "geometry.h"
+#include "indexed_mesh.h"
 
 class BvhBuilder
 {
@@ -27,6 +28,19 @@ public:
         return build_bvh(primitive_centers, bounding_boxes);
     }
 
+    // Bounds of the triangles fetched through the index buffer, the primitives are its triangles
+    Bvh build_bvh(const IndexedMesh& mesh)
+    {
+        std::vector<AABB> bounding_boxes(mesh.triangle_count());
+        std::vector<glm::vec3> primitive_centers(mesh.triangle_count());
+        for (size_t i = 0, n = mesh.triangle_count(); i < n; ++i)
+        {
+            bounding_boxes[i] = mesh.aabb(i);
+            primitive_centers[i] = mesh.center(i);
+        }
+        return build_bvh(primitive_centers, bounding_boxes);
+    }
+
     virtual Bvh build_bvh(
         const std::vector<glm::vec3>& primitive_centers,
         const std::vector<AABB>& bounding_boxes) = 0;
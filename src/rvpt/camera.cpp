@@ -38,6 +38,10 @@ void Camera::rotate(const glm::vec3 &in_rotation)
     if (vertical_view_angle_clamp) rotation.y = glm::clamp(rotation.y, -90.f, 90.f);
 }
 
+void Camera::set_translation(const glm::vec3 &in_translation) { translation = in_translation; }
+
+void Camera::set_rotation(const glm::vec3 &in_rotation) { rotation = in_rotation; }
+
 void Camera::set_fov(float in_fov) { fov = in_fov; }
 
 void Camera::set_scale(float in_scale) { scale = in_scale; }
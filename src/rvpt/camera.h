@@ -17,6 +17,10 @@ public:
     void translate(const glm::vec3 &in_translation);
     void rotate(const glm::vec3 &in_rotation);
 
+    // Absolute pose, rotation is in degrees like rotate
+    void set_translation(const glm::vec3 &in_translation);
+    void set_rotation(const glm::vec3 &in_rotation);
+
     void set_fov(float fov);
 
     void set_scale(float scale);
@@ -0,0 +1,486 @@
+#include "cpu_tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#include <glm/gtc/constants.hpp>
+
+#include "profiler.h"
+
+namespace
+{
+// keep in sync with bindings.glsl
+constexpr float INF = std::numeric_limits<float>::infinity();
+constexpr float EPSILON = 0.005f;
+
+uint32_t wang_hash(uint32_t seed)
+{
+    seed = (seed ^ 61u) ^ (seed >> 16u);
+    seed *= 9u;
+    seed = seed ^ (seed >> 4u);
+    seed *= 0x27d4eb2du;
+    seed = seed ^ (seed >> 15u);
+    return seed;
+}
+
+float rand(uint32_t& rng_state)
+{
+    // Xorshift algorithm from George Marsaglia's paper, as in util.glsl
+    rng_state ^= (rng_state << 13u);
+    rng_state ^= (rng_state >> 17u);
+    rng_state ^= (rng_state << 5u);
+    return static_cast<float>(rng_state) / 4294967296.0f;
+}
+
+glm::vec3 map_uniform_sphere(float u, float v)
+{
+    float phi = glm::two_pi<float>() * u;
+    float cos_theta = 1 - v - v;
+    float sin_theta = std::sqrt(std::max(0.0f, 1 - cos_theta * cos_theta));
+    return glm::vec3(sin_theta * glm::vec2(std::cos(phi), std::sin(phi)), cos_theta);
+}
+
+// Cosine weighted, not normalized (samples_mapping.glsl)
+glm::vec3 map_cosine_hemisphere_simple(float u, float v, glm::vec3 n)
+{
+    return n + map_uniform_sphere(u, v);
+}
+
+float power_heuristic(float pdf, float other_pdf)
+{
+    return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+}
+
+float frensel_reflectance(float cos_in, float cos_out, float eta)
+{
+    float r_perp = (eta * cos_in - cos_out) / (eta * cos_in + cos_out);
+    float r_parallel = (cos_in - eta * cos_out) / (cos_in + eta * cos_out);
+    return 0.5f * (r_perp * r_perp + r_parallel * r_parallel);
+}
+}  // namespace
+
+CpuRay camera_ray(glm::mat4 const& matrix, glm::vec4 const& params, int camera_mode, float x,
+                  float y)
+{
+    float aspect = params.x;
+    float u = aspect * (x + x - 1.0f);
+    float v = y + y - 1.0f;
+    glm::vec3 origin = glm::vec3(matrix[3]);
+
+    switch (camera_mode)
+    {
+        case 0:  // pinhole
+        {
+            float w = 1.0f / std::tan(0.5f * params.y);
+            glm::vec3 direction = glm::vec3(matrix * glm::vec4(u, v, w, 0.0f));
+            return {origin, glm::normalize(direction)};
+        }
+        case 1:  // orthographic
+        {
+            float scale = params.z;
+            return {glm::vec3(matrix * glm::vec4(scale * u, scale * v, 0.0f, 1.0f)),
+                    glm::vec3(matrix[2])};
+        }
+        default:  // spherical
+        {
+            float phi = x * glm::two_pi<float>();
+            float theta = y * glm::pi<float>();
+            float sin_theta = std::sin(theta);
+            glm::vec3 local_dir(sin_theta * std::cos(phi), std::cos(theta),
+                                sin_theta * std::sin(phi));
+            return {origin, glm::vec3(matrix * glm::vec4(local_dir, 0.0f))};
+        }
+    }
+}
+
+CpuTracer::CpuTracer(size_t thread_count) : pool(thread_count), query(pool)
+{
+    query.set_scene(bvh, sorted_triangles);
+}
+
+void CpuTracer::set_scene(std::vector<Triangle> const& triangles,
+                          std::vector<Material> const& materials)
+{
+    this->materials = materials;
+    if (triangles.empty())
+    {
+        bvh = Bvh{};
+        sorted_triangles.clear();
+        lights = LightList{};
+        return;
+    }
+    bvh = bvh_builder.build_bvh(triangles);
+    sorted_triangles = bvh.permute_primitives(triangles);
+    lights = build_light_list(sorted_triangles, materials);
+}
+
+CpuTracer::RayBenchmark CpuTracer::benchmark_camera_rays(std::vector<glm::vec4> const& camera_data,
+                                                         Settings const& settings,
+                                                         uint32_t repetitions)
+{
+    this->settings = settings;
+    CameraData camera{glm::mat4(camera_data[0], camera_data[1], camera_data[2], camera_data[3]),
+                      camera_data[4]};
+
+    // one packet per 8 pixels of a row, rays through the pixel centers
+    uint32_t width = static_cast<uint32_t>(PACKET_WIDTH);
+    uint32_t packets_x = (settings.width + width - 1) / width;
+    std::vector<RayPacket> packets(static_cast<size_t>(packets_x) * settings.height);
+    for (uint32_t y = 0; y < settings.height; y++)
+        for (uint32_t px = 0; px < packets_x; px++)
+        {
+            RayPacket& packet = packets[y * packets_x + px];
+            packet = RayPacket{};
+            packet.active_mask = 0;
+            for (uint32_t lane = 0; lane < width; lane++)
+            {
+                uint32_t x = px * width + lane;
+                if (x >= settings.width) break;
+                float u = (static_cast<float>(x) + 0.5f) / static_cast<float>(settings.width);
+                float v =
+                    1.0f - (static_cast<float>(y) + 0.5f) / static_cast<float>(settings.height);
+                CpuRay ray = camera_ray(camera.matrix, camera.params, settings.camera_mode, u, v);
+                packet.set_ray(lane, ray.origin, ray.direction, 0.0f, INF);
+                packet.active_mask |= 1u << lane;
+            }
+        }
+
+    std::vector<PacketHit> scalar_hits(packets.size());
+    std::vector<PacketHit> packet_hits(packets.size());
+    uint64_t ray_count = static_cast<uint64_t>(settings.width) * settings.height * repetitions;
+    auto run = [&](auto&& trace) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < repetitions; i++) pool.parallel_for(packets.size(), trace);
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        return static_cast<double>(ray_count) / elapsed.count() * 1e-6;
+    };
+
+    RayBenchmark result;
+    result.scalar_mrays = run([&](size_t i) {
+        PacketHit& hit = scalar_hits[i];
+        RayPacket const& packet = packets[i];
+        hit.hit_mask = 0;
+        for (size_t lane = 0; lane < PACKET_WIDTH; lane++)
+        {
+            CpuIsect info;
+            hit.prim[lane] = ~0u;
+            CpuRay ray{glm::vec3(packet.origin_x[lane], packet.origin_y[lane],
+                                 packet.origin_z[lane]),
+                       glm::vec3(packet.direction_x[lane], packet.direction_y[lane],
+                                 packet.direction_z[lane])};
+            if ((packet.active_mask >> lane) & 1u && query.intersect(ray, 0, INF, info))
+                hit.prim[lane] = info.prim;
+        }
+    });
+    result.packet_mrays =
+        run([&](size_t i) { query.trace_packet(packets[i], packet_hits[i]); });
+
+    for (size_t i = 0; i < packets.size(); i++)
+        for (size_t lane = 0; lane < PACKET_WIDTH; lane++)
+            if ((packets[i].active_mask >> lane) & 1u &&
+                scalar_hits[i].prim[lane] != packet_hits[i].prim[lane])
+                result.mismatches++;
+    return result;
+}
+
+void CpuTracer::render(std::vector<glm::vec4> const& camera_data, Settings const& settings,
+                       uint32_t sample_count)
+{
+    this->settings = settings;
+    accumulation.assign(static_cast<size_t>(settings.width) * settings.height, glm::vec3(0));
+
+    CameraData camera{glm::mat4(camera_data[0], camera_data[1], camera_data[2], camera_data[3]),
+                      camera_data[4]};
+
+    tiles_x = (settings.width + tile_size - 1) / tile_size;
+    uint32_t tiles_y = (settings.height + tile_size - 1) / tile_size;
+
+    uint32_t samples_per_frame = static_cast<uint32_t>(std::max(settings.aa, 1));
+    uint32_t frame_count = (sample_count + samples_per_frame - 1) / samples_per_frame;
+    for (uint32_t frame = 0; frame < frame_count; frame++)
+        pool.parallel_for(tiles_x * tiles_y, [&](size_t tile) {
+            render_tile(static_cast<uint32_t>(tile), camera, frame);
+        });
+}
+
+std::vector<uint8_t> CpuTracer::read_image() const
+{
+    std::vector<uint8_t> rgba(accumulation.size() * 4);
+    for (size_t i = 0; i < accumulation.size(); i++)
+    {
+        // same as storing into the rgba8 temporal image
+        glm::vec3 c = glm::clamp(accumulation[i], 0.0f, 1.0f) * 255.0f + 0.5f;
+        rgba[i * 4 + 0] = static_cast<uint8_t>(c.x);
+        rgba[i * 4 + 1] = static_cast<uint8_t>(c.y);
+        rgba[i * 4 + 2] = static_cast<uint8_t>(c.z);
+        rgba[i * 4 + 3] = 0;
+    }
+    return rgba;
+}
+
+void CpuTracer::render_tile(uint32_t tile, CameraData const& camera, uint32_t frame)
+{
+    Profiler::Zone zone("cpu tile");
+    uint32_t x0 = (tile % tiles_x) * tile_size;
+    uint32_t y0 = (tile / tiles_x) * tile_size;
+    uint32_t x1 = std::min(x0 + tile_size, settings.width);
+    uint32_t y1 = std::min(y0 + tile_size, settings.height);
+
+    glm::vec2 inv_dim = 1.0f / glm::vec2(settings.width, settings.height);
+    float inv_frame = 1.0f / static_cast<float>(frame + 1);
+    int aa = std::max(settings.aa, 1);
+
+    // the camera rays of up to 8 neighbouring pixels of a row are traced as one packet, the
+    // paths continue one ray at a time
+    for (uint32_t y = y0; y < y1; y++)
+        for (uint32_t x_begin = x0; x_begin < x1; x_begin += PACKET_WIDTH)
+        {
+            uint32_t lane_count = std::min(static_cast<uint32_t>(PACKET_WIDTH), x1 - x_begin);
+
+            uint32_t rng[PACKET_WIDTH];
+            glm::vec3 sampled[PACKET_WIDTH];
+            for (uint32_t lane = 0; lane < lane_count; lane++)
+            {
+                // seeded like trace_pixel in megakernel.glsl
+                rng[lane] = wang_hash((x_begin + lane + y * settings.width) ^ wang_hash(frame));
+                sampled[lane] = glm::vec3(0);
+            }
+
+            for (int i = 0; i < aa; i++)
+            {
+                RayPacket packet{};
+                packet.active_mask = (1u << lane_count) - 1;
+                CpuRay rays[PACKET_WIDTH];
+                for (uint32_t lane = 0; lane < lane_count; lane++)
+                {
+                    float u = rand(rng[lane]);
+                    float v = rand(rng[lane]);
+                    glm::vec2 coord = (glm::vec2(x_begin + lane, y) + glm::vec2(u, v)) * inv_dim;
+                    coord.y = 1.0f - coord.y;  // flip image vertically
+
+                    rays[lane] = camera_ray(camera.matrix, camera.params, settings.camera_mode,
+                                            coord.x, coord.y);
+                    packet.set_ray(lane, rays[lane].origin, rays[lane].direction, 0, INF);
+                }
+
+                PacketHit hit;
+                query.trace_packet(packet, hit);
+
+                for (uint32_t lane = 0; lane < lane_count; lane++)
+                {
+                    CpuIsect primary_hit;
+                    primary_hit.t = INF;
+                    if ((hit.hit_mask >> lane) & 1u)
+                    {
+                        Triangle const& triangle = sorted_triangles[hit.prim[lane]];
+                        glm::vec3 v0(triangle.vertex0);
+                        primary_hit.t = hit.t[lane];
+                        primary_hit.pos = rays[lane].origin + hit.t[lane] * rays[lane].direction;
+                        primary_hit.normal = glm::cross(glm::vec3(triangle.vertex1) - v0,
+                                                        glm::vec3(triangle.vertex2) - v0);
+                        primary_hit.uv = glm::vec2(hit.u[lane], hit.v[lane]);
+                        primary_hit.prim = hit.prim[lane];
+                    }
+                    sampled[lane] += integrator_kajiya(rays[lane], 0, INF, rng[lane], &primary_hit);
+                }
+            }
+
+            for (uint32_t lane = 0; lane < lane_count; lane++)
+            {
+                size_t index = static_cast<size_t>(y) * settings.width + x_begin + lane;
+                glm::vec3 sample = sampled[lane] / static_cast<float>(aa);
+                accumulation[index] =
+                    (accumulation[index] * static_cast<float>(frame) + sample) * inv_frame;
+            }
+        }
+}
+
+glm::vec3 CpuTracer::integrator_kajiya(CpuRay ray, float mint, float maxt, uint32_t& rng,
+                                        CpuIsect const* primary_hit) const
+{
+    CpuIsect info;
+
+    glm::vec3 col(0);
+    glm::vec3 throughput(1);
+    glm::vec3 white(1);
+    glm::vec3 blue(0.2f, 0.3f, 0.7f);
+    bool light_sampling = settings.light_sampling != LIGHT_SAMPLING_OFF && !lights.empty();
+    // density of the direction of `ray` when the light was sampled too, 0 otherwise
+    float bsdf_pdf = 0.0f;
+    // where the light was sampled from
+    glm::vec3 light_pos(0);
+    glm::vec3 light_normal(0);
+
+    for (int i = 0; i < settings.max_bounces; ++i)
+    {
+        if (i == 0 && primary_hit)
+            info = *primary_hit;
+        else if (!query.intersect(ray, mint, maxt, info))
+            info.t = INF;
+        bool hit = info.t < INF;
+        // intersected nothing -> background
+        if (!hit)
+            return col + throughput * glm::mix(white, blue, ray.direction.y * 0.5f + 0.5f);
+
+        Material const& mat =
+            materials[static_cast<size_t>(sorted_triangles[info.prim].material_id.x)];
+        glm::vec3 base_color(mat.albedo);
+
+        glm::vec3 pos = info.pos;
+        glm::vec3 normal = glm::normalize(info.normal);
+
+        // intersected an emitter -> add emission, weighted against the light sample of the last
+        // bounce (emission_weight in integrators.glsl)
+        glm::vec3 emission = glm::vec3(mat.emission);
+        if (emission != glm::vec3(0.0f))
+        {
+            float emission_weight = 1.0f;
+            if (bsdf_pdf > 0.0f)
+            {
+                float dist = info.t * glm::length(ray.direction);
+                float cos_light = std::abs(glm::dot(glm::normalize(ray.direction), normal));
+                float pdf = light_pdf(info.prim, emission, light_pos, light_normal) * dist *
+                            dist / std::max(cos_light, 1e-6f);
+                emission_weight = power_heuristic(bsdf_pdf, pdf);
+            }
+            col += throughput * emission * emission_weight;
+        }
+        glm::vec3 dir_in = glm::normalize(ray.direction);
+        glm::vec3 pos_out;
+        glm::vec3 dir_out;
+
+        float cos_view = glm::dot(dir_in, normal);
+        float cos_in;
+        // indices of refraction, the outside is always air (1.0)
+        float eta = mat.albedo.w;
+        if (cos_view > 0.0f)
+        {
+            // ray arrives from the inside
+            cos_in = cos_view;
+            normal = -normal;
+        }
+        else
+        {
+            cos_in = -cos_view;
+            eta = 1.0f / eta;
+        }
+
+        switch (static_cast<Material::Type>(static_cast<int>(mat.data.x)))
+        {
+            case Material::Type::LAMBERT:
+            {
+                pos_out = pos + EPSILON * normal;
+                // direct light, unless the bsdf sample couldn't reach it either
+                if (light_sampling && i + 1 < settings.max_bounces)
+                    col += throughput * base_color * sample_light(pos_out, normal, rng);
+                float u = rand(rng);
+                float v = rand(rng);
+                dir_out = map_cosine_hemisphere_simple(u, v, normal);
+                // mat_eval_Lambert_cos(base_color * INV_PI)
+                throughput *= base_color;
+                if (light_sampling)
+                {
+                    bsdf_pdf = std::max(glm::dot(glm::normalize(dir_out), normal), 0.0f) *
+                               glm::one_over_pi<float>();
+                    light_pos = pos_out;
+                    light_normal = normal;
+                }
+                break;
+            }
+            case Material::Type::MIRROR:
+                pos_out = pos + EPSILON * normal;
+                dir_out = dir_in + (cos_in + cos_in) * normal;
+                throughput *= base_color;
+                bsdf_pdf = 0.0f;
+                break;
+
+            case Material::Type::DIELECTRIC:
+            {
+                float cos_out_sqr = 1.0f - eta * eta * (1.0f - cos_in * cos_in);
+                float cos_out = 0.0f;
+
+                bool refl = cos_out_sqr <= 0;
+                if (!refl)
+                {
+                    cos_out = std::sqrt(std::max(0.0f, cos_out_sqr));
+                    float f_refl = frensel_reflectance(cos_in, cos_out, eta);
+                    // total internal reflection or Fresnel reflectance
+                    refl = rand(rng) < f_refl;
+                }
+
+                if (refl)
+                {
+                    pos_out = pos + EPSILON * normal;
+                    dir_out = dir_in + (cos_in + cos_in) * normal;
+                }
+                else
+                {
+                    pos_out = pos - EPSILON * normal;
+                    dir_out = eta * dir_in + (eta * cos_in - cos_out) * normal;
+                }
+                throughput *= base_color;
+                bsdf_pdf = 0.0f;
+                break;
+            }
+            default:
+                return glm::vec3(0);
+        }
+
+        ray = CpuRay{pos_out, dir_out};
+    }
+
+    // the light gathered so far if it runs out of bounces
+    return col;
+}
+
+glm::vec3 CpuTracer::sample_light(glm::vec3 pos, glm::vec3 normal, uint32_t& rng) const
+{
+    float u = rand(rng);
+    float v = rand(rng);
+    LightTriangle const* picked = &lights.sample(u, v);
+    float pick_pmf = picked->pdf;
+    if (settings.light_sampling == LIGHT_SAMPLING_BVH)
+    {
+        picked = lights.pick(pos, normal, u, pick_pmf);
+        if (!picked) return glm::vec3(0);
+    }
+    LightTriangle const& light = *picked;
+
+    // uniform point on the triangle
+    float su = std::sqrt(rand(rng));
+    float w = rand(rng);
+    glm::vec3 point = glm::vec3(light.vertex0) + su * (1.0f - w) * glm::vec3(light.edge1) +
+                      su * w * glm::vec3(light.edge2);
+
+    glm::vec3 to_light = point - pos;
+    float dist_sqr = glm::dot(to_light, to_light);
+    float dist = std::sqrt(dist_sqr);
+    glm::vec3 dir = to_light / dist;
+    float cos_surface = glm::dot(dir, normal);
+    // the lights emit on both sides like a hit does
+    float cos_light = std::abs(glm::dot(
+        dir, glm::normalize(glm::cross(glm::vec3(light.edge1), glm::vec3(light.edge2)))));
+    if (cos_surface <= 0.0f || cos_light <= 0.0f) return glm::vec3(0);
+
+    // the shadow ray stops short of the light itself
+    if (query.intersect_any(CpuRay{pos, dir}, 0, dist - EPSILON)) return glm::vec3(0);
+
+    // area density converted to solid angle
+    float light_pdf = pick_pmf / light.area * dist_sqr / cos_light;
+    float bsdf_pdf = cos_surface * glm::one_over_pi<float>();
+    return light.emission * cos_surface * glm::one_over_pi<float>() *
+           power_heuristic(light_pdf, bsdf_pdf) / light_pdf;
+}
+
+float CpuTracer::light_pdf(uint32_t primitive, glm::vec3 emission, glm::vec3 light_pos,
+                           glm::vec3 light_normal) const
+{
+    if (settings.light_sampling != LIGHT_SAMPLING_BVH)
+        return luminance(emission) / lights.total_power;
+    size_t light = lights.find(primitive);
+    if (light == lights.lights.size()) return 0.0f;
+    return lights.pick_pmf(static_cast<uint32_t>(light), light_pos, light_normal) /
+           lights.lights[light].area;
+}
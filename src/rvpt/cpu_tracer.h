@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "bvh_builder.h"
+#include "geometry.h"
+#include "light_sampling.h"
+#include "material.h"
+#include "ray_query.h"
+#include "thread_pool.h"
+
+// CPU port of the triangle path of the megakernel: the camera rays from camera.glsl and
+// integrator_Kajiya from integrators.glsl using the same PRNG seeding, on top of the BVH
+// traversal of RayQuery (intersect_bvh and intersect_triangle_fast from intersection.glsl).
+// It works on the same Bvh/Triangle/Material data that is uploaded to the GPU and needs no Vulkan
+// device, so it can render when there is no usable GPU and serves as a reference to validate the
+// shaders against.
+
+// Ray through the film point (x, y) in [0, 1]^2 like get_camera_ray in camera.glsl. `matrix` and
+// `params` are the camera uniform, see Camera::get_data
+[[nodiscard]] CpuRay camera_ray(glm::mat4 const& matrix, glm::vec4 const& params, int camera_mode,
+                                float x, float y);
+
+class CpuTracer
+{
+public:
+    // 0 uses one thread per hardware thread
+    explicit CpuTracer(size_t thread_count = 0);
+
+    // Copies the scene and builds its BVH
+    void set_scene(std::vector<Triangle> const& triangles, std::vector<Material> const& materials);
+
+    struct Settings
+    {
+        uint32_t width = 1024;
+        uint32_t height = 512;
+        int max_bounces = 8;
+        int aa = 1;
+        int camera_mode = 0;
+        // next event estimation with multiple importance sampling, a LightSampling like the
+        // light_sampling render setting
+        int light_sampling = LIGHT_SAMPLING_BVH;
+    };
+
+    // Starts a new accumulation and renders `sample_count` frames of `settings.aa` samples per
+    // pixel into it. `camera_data` is the layout of Camera::get_data
+    void render(std::vector<glm::vec4> const& camera_data, Settings const& settings,
+                uint32_t sample_count);
+    // The accumulated image, RGBA8 like RVPT::read_image
+    [[nodiscard]] std::vector<uint8_t> read_image() const;
+
+    [[nodiscard]] RayQuery const& ray_query() const noexcept { return query; }
+
+    struct RayBenchmark
+    {
+        double scalar_mrays = 0.0;  // millions of camera rays per second, one ray at a time
+        double packet_mrays = 0.0;  // with trace_packet
+        uint32_t mismatches = 0;    // rays which hit a different triangle in the two paths
+    };
+    // Traces the camera rays (closest hit only) `repetitions` times with both paths on all threads
+    [[nodiscard]] RayBenchmark benchmark_camera_rays(std::vector<glm::vec4> const& camera_data,
+                                                     Settings const& settings,
+                                                     uint32_t repetitions);
+
+    [[nodiscard]] size_t thread_count() const noexcept { return pool.thread_count(); }
+
+private:
+    static constexpr uint32_t tile_size = 16;
+
+    struct CameraData
+    {
+        glm::mat4 matrix;
+        glm::vec4 params;  // aspect, hfov, scale, 0
+    };
+
+    void render_tile(uint32_t tile, CameraData const& camera, uint32_t frame);
+    // `primary_hit` is the intersection of `ray` when it was already traced (t = INF for a miss)
+    [[nodiscard]] glm::vec3 integrator_kajiya(CpuRay ray, float mint, float maxt, uint32_t& rng,
+                                              CpuIsect const* primary_hit) const;
+    // sample_light from integrators.glsl
+    [[nodiscard]] glm::vec3 sample_light(glm::vec3 pos, glm::vec3 normal, uint32_t& rng) const;
+    // light_pdf from integrators.glsl
+    [[nodiscard]] float light_pdf(uint32_t primitive, glm::vec3 emission, glm::vec3 light_pos,
+                                  glm::vec3 light_normal) const;
+
+    ThreadPool pool;
+    RayQuery query;
+    BinnedBvhBuilder bvh_builder;
+    Bvh bvh;
+    std::vector<Triangle> sorted_triangles;
+    std::vector<Material> materials;
+    LightList lights;
+
+    Settings settings;
+    uint32_t tiles_x = 0;
+    std::vector<glm::vec3> accumulation;
+};
@@ -0,0 +1,101 @@
+#include "geometry_pages.h"
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+#include "profiler.h"
+
+uint32_t GeometryPages::page_triangles(size_t page) const noexcept
+{
+    size_t first = page * GEOMETRY_PAGE_TRIANGLES;
+    return static_cast<uint32_t>(std::min<size_t>(GEOMETRY_PAGE_TRIANGLES, triangle_count - first));
+}
+
+size_t GeometryPages::slot_bytes() const noexcept
+{
+    return slot_vertices * sizeof(glm::vec4) +
+           GEOMETRY_PAGE_TRIANGLES * (3 * sizeof(uint32_t) + sizeof(uint32_t));
+}
+
+GeometryPages split_into_pages(IndexedMesh const& mesh)
+{
+    Profiler::Zone zone("split into pages");
+
+    GeometryPages result;
+    result.triangle_count = mesh.triangle_count();
+    result.indices.resize(mesh.indices.size());
+    result.materials = mesh.materials;
+
+    // the vertices of the mesh used by the page, in order of first use
+    std::unordered_map<uint32_t, uint32_t> local_vertices;
+    size_t page_count =
+        (result.triangle_count + GEOMETRY_PAGE_TRIANGLES - 1) / GEOMETRY_PAGE_TRIANGLES;
+    for (size_t page = 0; page < page_count; page++)
+    {
+        local_vertices.clear();
+        auto first_vertex = static_cast<uint32_t>(result.vertices.size());
+        size_t first_index = page * GEOMETRY_PAGE_TRIANGLES * 3;
+        size_t end_index = first_index + result.page_triangles(page) * size_t{3};
+        for (size_t i = first_index; i < end_index; i++)
+        {
+            auto inserted = local_vertices.emplace(
+                mesh.indices[i], static_cast<uint32_t>(result.vertices.size()) - first_vertex);
+            if (inserted.second) result.vertices.push_back(mesh.vertices[mesh.indices[i]]);
+            result.indices[i] = inserted.first->second;
+        }
+
+        auto vertex_count = static_cast<uint32_t>(result.vertices.size()) - first_vertex;
+        result.pages.push_back({first_vertex, vertex_count});
+        result.slot_vertices = std::max(result.slot_vertices, vertex_count);
+    }
+    return result;
+}
+
+PageCache::PageCache(size_t page_count, size_t slot_count)
+    : slots(page_count, PAGE_NOT_RESIDENT),
+      slot_pages(std::min(page_count, slot_count), PAGE_NOT_RESIDENT),
+      slot_last_use(slot_pages.size(), 0)
+{
+}
+
+std::vector<PageCache::Upload> PageCache::update(std::vector<uint32_t> const& requests,
+                                                 size_t max_uploads)
+{
+    current_update++;
+    std::vector<uint32_t> missing;
+    for (size_t page = 0; page < std::min(requests.size(), slots.size()); page++)
+    {
+        if (requests[page] == 0) continue;
+        if (slots[page] == PAGE_NOT_RESIDENT)
+            missing.push_back(static_cast<uint32_t>(page));
+        else
+            slot_last_use[slots[page]] = current_update;
+    }
+    misses = missing.size();
+    if (missing.empty()) return {};
+
+    // free slots first (never used, last use 0), then the least recently used ones
+    std::vector<uint32_t> candidates(slot_pages.size());
+    std::iota(candidates.begin(), candidates.end(), 0u);
+    std::sort(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b) {
+        return slot_last_use[a] < slot_last_use[b];
+    });
+
+    std::vector<Upload> uploads;
+    for (size_t i = 0; i < std::min({missing.size(), candidates.size(), max_uploads}); i++)
+    {
+        uint32_t slot = candidates[i];
+        if (slot_last_use[slot] == current_update) break;  // the frame needs all the others
+
+        if (slot_pages[slot] != PAGE_NOT_RESIDENT)
+            slots[slot_pages[slot]] = PAGE_NOT_RESIDENT;
+        else
+            resident++;
+        slot_pages[slot] = missing[i];
+        slots[missing[i]] = slot;
+        slot_last_use[slot] = current_update;
+        uploads.push_back({missing[i], slot});
+    }
+    return uploads;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "indexed_mesh.h"
+
+// Triangles per page, PAGE_TRIANGLES in bindings.glsl
+constexpr uint32_t GEOMETRY_PAGE_TRIANGLES = 1024;
+constexpr uint32_t PAGE_NOT_RESIDENT = ~0u;
+
+// The geometry of a scene split into pages of GEOMETRY_PAGE_TRIANGLES consecutive triangles in
+// BVH order, so the page of a triangle is its index divided by the page size and the triangles
+// of a subtree share few pages. Every page has its own vertices, which makes the pages
+// independent of each other and lets any page go into any slot of the page pool on the GPU
+// (see PageCache). The BVH and the materials always stay resident.
+struct GeometryPages
+{
+    struct Page
+    {
+        uint32_t first_vertex;  // into `vertices`
+        uint32_t vertex_count;
+    };
+
+    std::vector<Page> pages;
+    std::vector<glm::vec4> vertices;  // the vertices of each page, one page after the other
+    std::vector<uint32_t> indices;    // three per triangle, relative to the vertices of its page
+    std::vector<uint32_t> materials;  // one per triangle
+    size_t triangle_count = 0;
+    // the most vertices of any page, the vertex capacity of a slot of the page pool
+    uint32_t slot_vertices = 0;
+
+    [[nodiscard]] size_t page_count() const noexcept { return pages.size(); }
+    [[nodiscard]] uint32_t page_triangles(size_t page) const noexcept;
+    // Bytes of one slot of the page pool: vertices, indices and materials
+    [[nodiscard]] size_t slot_bytes() const noexcept;
+};
+
+GeometryPages split_into_pages(IndexedMesh const& mesh);
+
+// Which page of the scene is in which slot of a page pool with a fixed number of slots. The GPU
+// flags every page a frame touched; pages which aren't resident get a slot, taking the one of the
+// page which was used longest ago, but never one which the frame used itself.
+class PageCache
+{
+public:
+    struct Upload
+    {
+        uint32_t page;
+        uint32_t slot;
+    };
+
+    PageCache() = default;
+    PageCache(size_t page_count, size_t slot_count);
+
+    // `requests` has a non zero entry for every page the frame touched. Returns the pages to copy
+    // into their new slots, at most `max_uploads`, the other missing pages stay requested.
+    std::vector<Upload> update(std::vector<uint32_t> const& requests, size_t max_uploads);
+
+    // the slot of every page, PAGE_NOT_RESIDENT for pages which aren't resident
+    [[nodiscard]] std::vector<uint32_t> const& page_slots() const noexcept { return slots; }
+    [[nodiscard]] size_t slot_count() const noexcept { return slot_pages.size(); }
+    // false when every page has a slot of its own, nothing is ever requested nor evicted then
+    [[nodiscard]] bool streaming() const noexcept { return slot_pages.size() < slots.size(); }
+    [[nodiscard]] size_t resident_count() const noexcept { return resident; }
+    // pages the last update got requested which weren't resident
+    [[nodiscard]] size_t missed_pages() const noexcept { return misses; }
+
+private:
+    std::vector<uint32_t> slots;          // per page
+    std::vector<uint32_t> slot_pages;     // per slot, PAGE_NOT_RESIDENT when free
+    std::vector<uint64_t> slot_last_use;  // per slot, the update it was requested last
+    uint64_t current_update = 0;
+    size_t resident = 0;
+    size_t misses = 0;
+};
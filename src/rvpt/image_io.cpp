@@ -0,0 +1,42 @@
+#include "image_io.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include <fmt/core.h>
+
+bool write_ppm(std::string const& filename, std::vector<uint8_t> const& rgba, uint32_t width,
+               uint32_t height)
+{
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        fmt::print(stderr, "Failed to open {} for writing\n", filename);
+        return false;
+    }
+    file << "P6\n" << width << " " << height << "\n255\n";
+
+    std::vector<uint8_t> rgb;
+    rgb.reserve(static_cast<size_t>(width) * height * 3);
+    for (size_t i = 0; i + 3 < rgba.size(); i += 4)
+        rgb.insert(rgb.end(), rgba.begin() + i, rgba.begin() + i + 3);
+    file.write(reinterpret_cast<const char*>(rgb.data()), static_cast<std::streamsize>(rgb.size()));
+
+    return static_cast<bool>(file);
+}
+
+double rmse_rgba8(std::vector<uint8_t> const& a, std::vector<uint8_t> const& b)
+{
+    size_t count = std::min(a.size(), b.size());
+    if (count < 4) return 0.0;
+
+    double sum = 0.0;
+    for (size_t i = 0; i + 3 < count; i += 4)
+        for (size_t c = 0; c < 3; c++)
+        {
+            double d = (static_cast<double>(a[i + c]) - static_cast<double>(b[i + c])) / 255.0;
+            sum += d * d;
+        }
+    return std::sqrt(sum / static_cast<double>(count / 4 * 3));
+}
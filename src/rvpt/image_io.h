@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Writes RGBA8 pixels as a binary PPM, dropping the alpha channel
+bool write_ppm(std::string const& filename, std::vector<uint8_t> const& rgba, uint32_t width,
+               uint32_t height);
+
+// Root mean square error of the RGB channels in [0, 1], the images must have the same size
+double rmse_rgba8(std::vector<uint8_t> const& a, std::vector<uint8_t> const& b);
@@ -230,16 +230,14 @@ auto create_pipeline(VkDevice device, VK::PipelineBuilder& pipeline_builder,
     pipe_details.enable_blending = true;
     pipe_details.render_pass = render_pass;
     pipe_details.extent = extent;
-    auto pipeline = pipeline_builder.create_immutable_pipeline(pipe_details);
-
-    return VK::HandleWrapper<VkPipeline, PFN_vkDestroyPipeline>(device, pipeline,
-                                                                vkDestroyPipeline);
+    return pipeline_builder.create_pipeline(pipe_details);
 }
 
 ImguiImpl::ImguiImpl(VkDevice device, VK::Queue& graphics_queue,
                      VK::PipelineBuilder& pipeline_builder, VK::MemoryAllocator& memory_allocator,
                      VkRenderPass render_pass, VkExtent2D extent, uint32_t max_frames_in_flight)
     : device(device),
+      pipeline_builder(pipeline_builder),
       memory_allocator(memory_allocator),
       font_image(create_font_texture(device, memory_allocator, graphics_queue)),
       pool(create_descriptor_pool(device, font_image.sampler.handle)),
@@ -322,7 +320,8 @@ void ImguiImpl::draw(VkCommandBuffer command_buffer, uint32_t frame_index)
     }
 
     // Bind pipeline and descriptor sets:
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.handle);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      pipeline_builder.get_pipeline(pipeline));
     vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1,
                             &descriptor_set.set, 0, NULL);
 
@@ -14,12 +14,13 @@ public:
 
 private:
     VkDevice device;
+    VK::PipelineBuilder& pipeline_builder;
     VK::MemoryAllocator& memory_allocator;
     VK::Image font_image;
     VK::DescriptorPool pool;
     VK::DescriptorSet descriptor_set;
     VkPipelineLayout pipeline_layout;
-    VK::HandleWrapper<VkPipeline, PFN_vkDestroyPipeline> pipeline;
+    VK::GraphicsPipelineHandle pipeline;
 
     std::vector<VK::Buffer> vertex_buffers;
     std::vector<VK::Buffer> index_buffers;
@@ -0,0 +1,70 @@
+#include "indexed_mesh.h"
+
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+struct PositionKey
+{
+    uint32_t bits[3];
+
+    bool operator==(PositionKey const& other) const noexcept
+    {
+        return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+    }
+};
+
+struct PositionHash
+{
+    size_t operator()(PositionKey const& key) const noexcept
+    {
+        // FNV-1a over the three words
+        uint64_t hash = 14695981039346656037ull;
+        for (uint32_t word : key.bits) hash = (hash ^ word) * 1099511628211ull;
+        return static_cast<size_t>(hash);
+    }
+};
+}  // namespace
+
+IndexedMesh IndexedMesh::permute_triangles(std::vector<uint32_t> const& order) const
+{
+    IndexedMesh permuted;
+    permuted.vertices = vertices;
+    permuted.indices.resize(order.size() * 3);
+    permuted.materials.resize(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        for (size_t corner = 0; corner < 3; ++corner)
+            permuted.indices[3 * i + corner] = indices[3 * order[i] + corner];
+        permuted.materials[i] = materials[order[i]];
+    }
+    return permuted;
+}
+
+IndexedMesh index_triangles(std::vector<Triangle> const& triangles)
+{
+    IndexedMesh mesh;
+    mesh.indices.reserve(triangles.size() * 3);
+    mesh.materials.reserve(triangles.size());
+
+    std::unordered_map<PositionKey, uint32_t, PositionHash> vertex_indices;
+    vertex_indices.reserve(triangles.size());
+    auto add_vertex = [&](glm::vec4 const& vertex) {
+        PositionKey key;
+        std::memcpy(key.bits, &vertex.x, sizeof(key.bits));
+        auto [it, inserted] =
+            vertex_indices.try_emplace(key, static_cast<uint32_t>(mesh.vertices.size()));
+        if (inserted) mesh.vertices.emplace_back(vertex.x, vertex.y, vertex.z, 0.0f);
+        mesh.indices.push_back(it->second);
+    };
+
+    for (auto const& triangle : triangles)
+    {
+        add_vertex(triangle.vertex0);
+        add_vertex(triangle.vertex1);
+        add_vertex(triangle.vertex2);
+        mesh.materials.push_back(static_cast<uint32_t>(triangle.material_id.x));
+    }
+    return mesh;
+}
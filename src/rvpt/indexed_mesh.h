@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "geometry.h"
+
+// Triangles sharing their vertices, the layout of the scene on the GPU: a Triangle takes 64 bytes,
+// an indexed triangle 16 (three indices and a material) plus its share of the 16 byte vertices,
+// about half a vertex per triangle in a closed mesh.
+struct IndexedMesh
+{
+    std::vector<glm::vec4> vertices;  // xyz, w is padding
+    std::vector<uint32_t> indices;    // three per triangle
+    std::vector<uint32_t> materials;  // one per triangle
+
+    [[nodiscard]] size_t triangle_count() const noexcept { return materials.size(); }
+
+    [[nodiscard]] glm::vec3 vertex(size_t triangle, size_t corner) const noexcept
+    {
+        return glm::vec3(vertices[indices[3 * triangle + corner]]);
+    }
+    [[nodiscard]] Triangle triangle(size_t triangle) const
+    {
+        return Triangle(vertex(triangle, 0), vertex(triangle, 1), vertex(triangle, 2),
+                        static_cast<int>(materials[triangle]));
+    }
+    [[nodiscard]] AABB aabb(size_t triangle) const noexcept
+    {
+        return AABB(vertex(triangle, 0)).expand(vertex(triangle, 1)).expand(vertex(triangle, 2));
+    }
+    [[nodiscard]] glm::vec3 center(size_t triangle) const noexcept
+    {
+        return (vertex(triangle, 0) + vertex(triangle, 1) + vertex(triangle, 2)) * (1.0f / 3.0f);
+    }
+
+    // Triangles reordered so that triangle i is triangle order[i] of this mesh, like
+    // Bvh::permute_primitives. The vertices are shared and stay as they are.
+    [[nodiscard]] IndexedMesh permute_triangles(std::vector<uint32_t> const& order) const;
+
+    [[nodiscard]] size_t byte_size() const noexcept
+    {
+        return vertices.size() * sizeof(glm::vec4) + indices.size() * sizeof(uint32_t) +
+               materials.size() * sizeof(uint32_t);
+    }
+};
+
+// Welds the vertices with bitwise equal positions, the triangles keep their order
+IndexedMesh index_triangles(std::vector<Triangle> const& triangles);
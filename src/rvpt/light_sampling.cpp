@@ -0,0 +1,398 @@
+#include "light_sampling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include <glm/gtc/constants.hpp>
+
+#include "profiler.h"
+
+namespace
+{
+constexpr float ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+constexpr int LIGHT_BIN_COUNT = 12;
+
+float safe_sqrt(float x) noexcept { return std::sqrt(std::max(x, 0.0f)); }
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b in [0, pi]
+float cos_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b) noexcept
+{
+    if (cos_a > cos_b) return 1.0f;
+    return cos_a * cos_b + sin_a * sin_b;
+}
+
+float sin_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b) noexcept
+{
+    if (cos_a > cos_b) return 0.0f;
+    return sin_a * cos_b - cos_a * sin_b;
+}
+
+// the bounds of a set of lights while building the light BVH
+struct LightBounds
+{
+    AABB aabb;
+    float power = 0.0f;
+    glm::vec3 axis{0.0f};
+    float cos_theta_o = 1.0f;
+
+    void expand(LightBounds const& other) noexcept
+    {
+        if (other.power <= 0.0f) return;
+        if (power <= 0.0f)
+        {
+            *this = other;
+            return;
+        }
+        aabb.expand(other.aabb);
+        power += other.power;
+
+        // smallest cone holding both, a cone stands for its negation too
+        glm::vec3 other_axis = glm::dot(axis, other.axis) < 0.0f ? -other.axis : other.axis;
+        float theta_a = std::acos(std::clamp(cos_theta_o, -1.0f, 1.0f));
+        float theta_b = std::acos(std::clamp(other.cos_theta_o, -1.0f, 1.0f));
+        float theta_d = std::acos(std::clamp(glm::dot(axis, other_axis), -1.0f, 1.0f));
+        if (std::min(theta_d + theta_b, glm::pi<float>()) <= theta_a) return;
+        if (std::min(theta_d + theta_a, glm::pi<float>()) <= theta_b)
+        {
+            axis = other_axis;
+            cos_theta_o = other.cos_theta_o;
+            return;
+        }
+        float theta_o = 0.5f * (theta_a + theta_d + theta_b);
+        glm::vec3 rotation_axis = glm::cross(axis, other_axis);
+        if (theta_o >= glm::pi<float>() || glm::dot(rotation_axis, rotation_axis) == 0.0f)
+        {
+            cos_theta_o = -1.0f;
+            return;
+        }
+        // rotate the axis towards the other one until the cone touches both
+        float theta_r = theta_o - theta_a;
+        axis = axis * std::cos(theta_r) +
+               glm::cross(glm::normalize(rotation_axis), axis) * std::sin(theta_r);
+        axis = glm::normalize(axis);
+        cos_theta_o = std::cos(theta_o);
+    }
+
+    // surface area orientation heuristic of Conty and Kulla, `extent_ratio` penalizes splitting
+    // thin nodes along their short axes
+    [[nodiscard]] float cost(float extent_ratio) const noexcept
+    {
+        if (power <= 0.0f) return 0.0f;
+        // solid angle measure of the cone widened by the emission angle, theta_e = pi / 2
+        float theta_o = std::acos(std::clamp(cos_theta_o, -1.0f, 1.0f));
+        float theta_w = std::min(theta_o + glm::half_pi<float>(), glm::pi<float>());
+        float sin_theta_o = safe_sqrt(1.0f - cos_theta_o * cos_theta_o);
+        float orientation = glm::two_pi<float>() * (1.0f - cos_theta_o) +
+                            glm::half_pi<float>() *
+                                (2.0f * theta_w * sin_theta_o - std::cos(theta_o - 2.0f * theta_w) -
+                                 2.0f * theta_o * sin_theta_o + cos_theta_o);
+        return power * orientation * extent_ratio * aabb.half_area();
+    }
+};
+
+void build_light_bvh(LightList& list, std::vector<double> const& powers)
+{
+    size_t light_count = list.lights.size();
+    if (light_count == 0) return;
+
+    std::vector<LightBounds> bounds(light_count);
+    std::vector<glm::vec3> centers(light_count);
+    for (size_t i = 0; i < light_count; i++)
+    {
+        auto const& light = list.lights[i];
+        glm::vec3 v0(light.vertex0);
+        glm::vec3 v1 = v0 + glm::vec3(light.edge1);
+        glm::vec3 v2 = v0 + glm::vec3(light.edge2);
+        bounds[i].aabb = AABB(v0).expand(v1).expand(v2);
+        bounds[i].power = static_cast<float>(powers[i]);
+        bounds[i].axis = glm::normalize(glm::cross(glm::vec3(light.edge1), glm::vec3(light.edge2)));
+        centers[i] = bounds[i].aabb.center();
+    }
+
+    std::vector<uint32_t> order(light_count);
+    std::iota(order.begin(), order.end(), 0u);
+
+    // a tree with a light per leaf has 2 * lights - 1 nodes
+    list.nodes.reserve(2 * light_count - 1);
+    list.nodes.push_back(LightNode{});
+    struct Task
+    {
+        uint32_t node;
+        size_t begin;
+        size_t end;
+    };
+    std::vector<Task> tasks{{0, 0, light_count}};
+    while (!tasks.empty())
+    {
+        Task task = tasks.back();
+        tasks.pop_back();
+
+        LightBounds node_bounds;
+        AABB center_bounds;
+        for (size_t i = task.begin; i < task.end; i++)
+        {
+            node_bounds.expand(bounds[order[i]]);
+            center_bounds.expand(centers[order[i]]);
+        }
+        LightNode& node = list.nodes[task.node];
+        node.bounds_min = node_bounds.aabb.min;
+        node.bounds_max = node_bounds.aabb.max;
+        node.power = node_bounds.power;
+        node.axis = node_bounds.axis;
+        node.cos_theta_o = node_bounds.cos_theta_o;
+        if (task.end - task.begin == 1)
+        {
+            node.first_child_or_light = order[task.begin];
+            node.light_count = 1;
+            list.lights[order[task.begin]].node = task.node;
+            continue;
+        }
+
+        // binned split with the lowest cost, lights with the same center are split in half
+        glm::vec3 extent = node_bounds.aabb.diagonal();
+        float max_extent = std::max({extent.x, extent.y, extent.z});
+        float min_cost = std::numeric_limits<float>::max();
+        int split_axis = -1;
+        int split_bin = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float axis_extent = center_bounds.max[axis] - center_bounds.min[axis];
+            if (!(axis_extent > 0.0f)) continue;
+            auto bin_of = [&](uint32_t light) {
+                auto bin = static_cast<int>((centers[light][axis] - center_bounds.min[axis]) /
+                                            axis_extent * LIGHT_BIN_COUNT);
+                return std::clamp(bin, 0, LIGHT_BIN_COUNT - 1);
+            };
+            LightBounds bins[LIGHT_BIN_COUNT];
+            size_t counts[LIGHT_BIN_COUNT] = {};
+            for (size_t i = task.begin; i < task.end; i++)
+            {
+                int bin = bin_of(order[i]);
+                bins[bin].expand(bounds[order[i]]);
+                counts[bin]++;
+            }
+
+            float extent_ratio = max_extent / std::max(extent[axis], 1e-6f * max_extent);
+            // the cost of the left side of every split from a sweep, then the right side
+            float left_costs[LIGHT_BIN_COUNT - 1];
+            size_t left_counts[LIGHT_BIN_COUNT - 1];
+            LightBounds left;
+            size_t left_count = 0;
+            for (int bin = 0; bin < LIGHT_BIN_COUNT - 1; bin++)
+            {
+                left.expand(bins[bin]);
+                left_count += counts[bin];
+                left_costs[bin] = left.cost(extent_ratio);
+                left_counts[bin] = left_count;
+            }
+            LightBounds right;
+            for (int bin = LIGHT_BIN_COUNT - 1; bin > 0; bin--)
+            {
+                right.expand(bins[bin]);
+                size_t count = left_counts[bin - 1];
+                if (count == 0 || count == task.end - task.begin) continue;
+                float cost = left_costs[bin - 1] + right.cost(extent_ratio);
+                if (cost < min_cost)
+                {
+                    min_cost = cost;
+                    split_axis = axis;
+                    split_bin = bin;
+                }
+            }
+        }
+
+        size_t middle = task.begin + (task.end - task.begin) / 2;
+        if (split_axis >= 0)
+        {
+            float axis_extent = center_bounds.max[split_axis] - center_bounds.min[split_axis];
+            auto split = std::partition(
+                order.begin() + task.begin, order.begin() + task.end, [&](uint32_t light) {
+                    auto bin = static_cast<int>(
+                        (centers[light][split_axis] - center_bounds.min[split_axis]) /
+                        axis_extent * LIGHT_BIN_COUNT);
+                    return std::clamp(bin, 0, LIGHT_BIN_COUNT - 1) < split_bin;
+                });
+            middle = static_cast<size_t>(split - order.begin());
+        }
+
+        auto child = static_cast<uint32_t>(list.nodes.size());
+        node.first_child_or_light = child;
+        node.light_count = 0;
+        // `node` is invalid from here on
+        list.nodes.push_back(LightNode{});
+        list.nodes.push_back(LightNode{});
+        list.nodes[child].parent = task.node;
+        list.nodes[child + 1].parent = task.node;
+        tasks.push_back({child, task.begin, middle});
+        tasks.push_back({child + 1, middle, task.end});
+    }
+}
+
+}  // namespace
+
+LightTriangle const& LightList::sample(float u, float v) const noexcept
+{
+    auto index = std::min(static_cast<size_t>(u * static_cast<float>(lights.size())),
+                          lights.size() - 1);
+    return v < lights[index].probability ? lights[index] : lights[lights[index].alias];
+}
+
+LightTriangle const* LightList::pick(glm::vec3 pos, glm::vec3 normal, float u,
+                                     float& pmf) const noexcept
+{
+    pmf = 1.0f;
+    if (nodes.empty()) return nullptr;
+    uint32_t index = 0;
+    while (nodes[index].light_count == 0)
+    {
+        uint32_t child = nodes[index].first_child_or_light;
+        float left = light_importance(nodes[child], pos, normal);
+        float right = light_importance(nodes[child + 1], pos, normal);
+        if (!(left + right > 0.0f)) return nullptr;
+
+        // the choice is made with the same number, rescaled to [0, 1) again
+        float p_left = left / (left + right);
+        if (u < p_left)
+        {
+            index = child;
+            u /= p_left;
+            pmf *= p_left;
+        }
+        else
+        {
+            index = child + 1;
+            u = (u - p_left) / (1.0f - p_left);
+            pmf *= 1.0f - p_left;
+        }
+        u = std::min(u, ONE_MINUS_EPSILON);
+    }
+    return &lights[nodes[index].first_child_or_light];
+}
+
+float LightList::pick_pmf(uint32_t light, glm::vec3 pos, glm::vec3 normal) const noexcept
+{
+    // the choices from the leaf of the light up to the root
+    float pmf = 1.0f;
+    uint32_t index = lights[light].node;
+    while (index != 0)
+    {
+        uint32_t parent = nodes[index].parent;
+        uint32_t child = nodes[parent].first_child_or_light;
+        float left = light_importance(nodes[child], pos, normal);
+        float right = light_importance(nodes[child + 1], pos, normal);
+        if (!(left + right > 0.0f)) return 0.0f;
+        pmf *= (index == child ? left : right) / (left + right);
+        index = parent;
+    }
+    return pmf;
+}
+
+size_t LightList::find(uint32_t primitive) const noexcept
+{
+    auto it = std::lower_bound(
+        lights.begin(), lights.end(), primitive,
+        [](LightTriangle const& light, uint32_t value) { return light.primitive < value; });
+    if (it == lights.end() || it->primitive != primitive) return lights.size();
+    return static_cast<size_t>(it - lights.begin());
+}
+
+float luminance(glm::vec3 color) noexcept
+{
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+float light_importance(LightNode const& node, glm::vec3 pos, glm::vec3 normal) noexcept
+{
+    glm::vec3 center = 0.5f * (node.bounds_min + node.bounds_max);
+    glm::vec3 diagonal = node.bounds_max - node.bounds_min;
+    float radius_sqr = 0.25f * glm::dot(diagonal, diagonal);
+    glm::vec3 to_center = center - pos;
+    float dist_sqr = glm::dot(to_center, to_center);
+    // inside the bounding sphere any light below may face the surface from any direction
+    if (dist_sqr <= radius_sqr) return node.power / radius_sqr;
+
+    // the angles from the center to the surface: theta_w to the axis, and the half angle
+    // theta_b of the bounding sphere as seen from the surface
+    glm::vec3 dir = to_center / std::sqrt(dist_sqr);
+    float cos_theta_w = std::abs(glm::dot(node.axis, dir));
+    float sin_theta_w = safe_sqrt(1.0f - cos_theta_w * cos_theta_w);
+    float cos_theta_b = safe_sqrt(1.0f - radius_sqr / dist_sqr);
+    float sin_theta_b = safe_sqrt(1.0f - cos_theta_b * cos_theta_b);
+    float sin_theta_o = safe_sqrt(1.0f - node.cos_theta_o * node.cos_theta_o);
+
+    // the smallest angle between a normal of a light and the direction to the surface
+    float cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+    float sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+    float cos_theta = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+    if (cos_theta <= 0.0f) return 0.0f;
+
+    // and the smallest one between the normal of the surface and a light
+    float cos_theta_i = glm::dot(normal, dir);
+    float sin_theta_i = safe_sqrt(1.0f - cos_theta_i * cos_theta_i);
+    float cos_theta_s = cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+    if (cos_theta_s <= 0.0f) return 0.0f;
+
+    return node.power * cos_theta * cos_theta_s / dist_sqr;
+}
+
+LightList build_light_list(std::vector<Triangle> const& triangles,
+                           std::vector<Material> const& materials)
+{
+    Profiler::Zone zone("build light list");
+
+    LightList result;
+    std::vector<double> powers;
+    for (size_t i = 0; i < triangles.size(); i++)
+    {
+        auto const& triangle = triangles[i];
+        auto material = static_cast<size_t>(triangle.material_id.x);
+        if (material >= materials.size()) continue;
+        glm::vec3 emission(materials[material].emission);
+        glm::vec3 v0(triangle.vertex0);
+        glm::vec3 edge1 = glm::vec3(triangle.vertex1) - v0;
+        glm::vec3 edge2 = glm::vec3(triangle.vertex2) - v0;
+        float area = 0.5f * glm::length(glm::cross(edge1, edge2));
+        float power = luminance(emission) * area;
+        if (!(power > 0.0f)) continue;
+
+        result.lights.push_back(LightTriangle{glm::vec4(v0, 0), glm::vec4(edge1, 0),
+                                              glm::vec4(edge2, 0), emission, area, 1.0f,
+                                              static_cast<uint32_t>(result.lights.size()), 0.0f,
+                                              static_cast<uint32_t>(i), 0, {}});
+        powers.push_back(power);
+    }
+
+    double total_power = 0.0;
+    for (double power : powers) total_power += power;
+    result.total_power = static_cast<float>(total_power);
+
+    // Vose's alias method: every entry gets the scaled probability of its light and the rest of
+    // its 1 / n share from a light with more than its share
+    auto count = static_cast<double>(powers.size());
+    std::vector<double> scaled(powers.size());
+    std::vector<uint32_t> small;
+    std::vector<uint32_t> large;
+    for (size_t i = 0; i < powers.size(); i++)
+    {
+        result.lights[i].pdf = static_cast<float>(powers[i] / total_power);
+        scaled[i] = powers[i] / total_power * count;
+        (scaled[i] < 1.0 ? small : large).push_back(static_cast<uint32_t>(i));
+    }
+    while (!small.empty() && !large.empty())
+    {
+        uint32_t less = small.back();
+        small.pop_back();
+        uint32_t more = large.back();
+        large.pop_back();
+
+        result.lights[less].probability = static_cast<float>(scaled[less]);
+        result.lights[less].alias = more;
+        scaled[more] -= 1.0 - scaled[less];
+        (scaled[more] < 1.0 ? small : large).push_back(more);
+    }
+    // what is left has a share of 1 up to rounding, it keeps probability 1 and itself as alias
+
+    build_light_bvh(result, powers);
+    return result;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "geometry.h"
+#include "material.h"
+
+// An emissive triangle, the layout of LightTriangle in structs.glsl. The light keeps its own
+// copy of the geometry, so sampling it needs neither the index buffer nor a resident page.
+struct LightTriangle
+{
+    glm::vec4 vertex0;
+    glm::vec4 edge1;  // vertex1 - vertex0
+    glm::vec4 edge2;  // vertex2 - vertex0
+    glm::vec3 emission;
+    float area;
+    // alias table entry: this light is taken with `probability`, light `alias` otherwise
+    float probability;
+    uint32_t alias;
+    float pdf;           // of sampling this light, its power over the total power
+    uint32_t primitive;  // triangle index in BVH order
+    uint32_t node;       // its leaf in the light BVH
+    uint32_t padding[3];
+};
+
+// A node of the light BVH, the layout of LightNode in structs.glsl. The normals of the lights
+// below lie within theta_o of the axis or of its negation, the lights are two sided. Triangles
+// emit over the hemisphere around their normal, so unlike the cones of Conty and Kulla the node
+// needs no emission angle. The children of a node are adjacent, a leaf holds a single light.
+struct LightNode
+{
+    glm::vec3 bounds_min;
+    float power;  // of the lights below
+    glm::vec3 bounds_max;
+    float cos_theta_o;
+    glm::vec3 axis;
+    uint32_t first_child_or_light;
+    uint32_t light_count;  // 0 for inner nodes
+    uint32_t parent;
+    uint32_t padding[2];
+};
+
+// Header of the light buffer, followed by the LightTriangle array (Lights in bindings.glsl)
+struct LightBufferHeader
+{
+    uint32_t light_count;
+    float total_power;
+    uint32_t padding[2];
+};
+
+// The values of the light_sampling render setting
+enum LightSampling
+{
+    LIGHT_SAMPLING_OFF = 0,
+    LIGHT_SAMPLING_POWER = 1,  // proportional to power with the alias table
+    LIGHT_SAMPLING_BVH = 2     // by estimated importance with the light BVH
+};
+
+// The emissive triangles of a scene with an alias table over their power, the luminance of their
+// emission times their area, so next event estimation picks a light proportional to its power
+// in constant time. The area density of a point on any light is luminance(emission) over the
+// total power, which lets a path that hits a light by chance weight it without a lookup.
+//
+// Picking by power alone wastes most samples once a scene has many lights far away from or
+// facing away from the shading point. The light BVH over the same lights (Importance Sampling of
+// Many Lights with Adaptive Tree Splitting, Conty and Kulla 2018) bounds the position, power and
+// orientation of every subtree, and pick descends it choosing a child by its importance for the
+// shading point. The lights stay in primitive order, so a hit finds its light with find.
+struct LightList
+{
+    std::vector<LightTriangle> lights;
+    float total_power = 0.0f;
+    std::vector<LightNode> nodes;  // the light BVH, the root first
+
+    [[nodiscard]] bool empty() const noexcept { return lights.empty(); }
+    // Picks a light with two uniform numbers in [0, 1)
+    [[nodiscard]] LightTriangle const& sample(float u, float v) const noexcept;
+    // Picks a light for a surface at `pos` with `normal` with a uniform number in [0, 1) and sets
+    // `pmf` to the probability of the pick. Returns nullptr if no light can reach the surface.
+    [[nodiscard]] LightTriangle const* pick(glm::vec3 pos, glm::vec3 normal, float u,
+                                            float& pmf) const noexcept;
+    // The probability of pick choosing `light` for a surface at `pos` with `normal`
+    [[nodiscard]] float pick_pmf(uint32_t light, glm::vec3 pos, glm::vec3 normal) const noexcept;
+    // The index of the light on triangle `primitive`, lights.size() if it isn't one
+    [[nodiscard]] size_t find(uint32_t primitive) const noexcept;
+};
+
+[[nodiscard]] float luminance(glm::vec3 color) noexcept;
+
+// Estimated contribution of the lights below `node` to a surface at `pos` with `normal`, 0 only if
+// none of them can reach it (light_importance in integrators.glsl)
+[[nodiscard]] float light_importance(LightNode const& node, glm::vec3 pos,
+                                     glm::vec3 normal) noexcept;
+
+// `triangles` in BVH order, the indices of the lights refer to them. Builds the light BVH too.
+LightList build_light_list(std::vector<Triangle> const& triangles,
+                           std::vector<Material> const& materials);
@@ -5,61 +5,11 @@
 #include <imgui.h>
 #include <fmt/core.h>
 #include "rvpt.h"
-
-#define TINYOBJLOADER_IMPLEMENTATION  // define this in only *one* .cc
-#include "tinyobjloader/tiny_obj_loader.h"
-
-void load_model(RVPT& rvpt, std::string inputfile, int material_id)
-{
-    rvpt.get_asset_path(inputfile);
-
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-
-    std::string warn;
-    std::string err;
-
-    tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, inputfile.c_str());
-
-    if (!warn.empty())
-    {
-        fmt::print("[{}: {}] {}\n", "WARNING", "MODEL-LOADING", warn);
-    }
-
-    if (!err.empty())
-    {
-        fmt::print("[{}: {}] {}\n", "ERROR", "MODEL-LOADING", err);
-        exit(-1);
-    }
-
-    // Loop over shapes
-    for (auto & shape : shapes) {
-        // Loop over faces(polygon)
-        size_t index_offset = 0;
-        for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); f++) {
-            const auto fv = shape.mesh.num_face_vertices[f];
-
-            // Loop over vertices in the face.
-            if (fv != 3)
-            {
-                fmt::print("Shape had a face with more than 3 vertices, skipping");
-                continue;
-            }
-            glm::vec3 vertices[3];
-
-            for (size_t v = 0; v < fv; v++) {
-                tinyobj::index_t idx = shape.mesh.indices[index_offset + v];
-                vertices[v].x = attrib.vertices[3*idx.vertex_index+0];
-                vertices[v].y = attrib.vertices[3*idx.vertex_index+1];
-                vertices[v].z = attrib.vertices[3*idx.vertex_index+2];
-            }
-            index_offset += fv;
-
-            rvpt.add_triangle(Triangle(vertices[0], vertices[1], vertices[2], material_id));
-        }
-    }
-}
+#include "model_loader.h"
+#include "batch.h"
+#include "cpu_tracer.h"
+#include "image_io.h"
+#include "profiler.h"
 
 void update_camera(Window& window, RVPT& rvpt)
 {
@@ -85,7 +35,142 @@ void update_camera(Window& window, RVPT& rvpt)
     rvpt.scene_camera.rotate(rotation);
 }
 
-int main()
+// paths relative to the assets folder
+SceneDescription demo_scene()
+{
+    SceneDescription scene;
+    scene.models.push_back({"models/rabbit.obj", 1});
+
+    scene.materials.push_back(
+        Material(glm::vec4(1, 1, 1, 0), glm::vec4(0.1, 0.4, 0.6, 0), Material::Type::LAMBERT));
+    scene.materials.push_back(
+        Material(glm::vec4(1.0, 1.0, 1.0, 0), glm::vec4(0), Material::Type::LAMBERT));
+    return scene;
+}
+
+void setup_demo_scene(RVPT& rvpt)
+{
+    auto scene = demo_scene();
+    for (auto& model : scene.models) load_model(rvpt, model.file, model.material_id);
+    for (auto& material : scene.materials) rvpt.add_material(material);
+}
+
+// Renders the scene of `rvpt` with the CPU path tracer (Kajiya integrator only), RGBA8
+std::vector<uint8_t> render_on_cpu(RVPT& rvpt, Window::Settings const& settings, uint32_t samples)
+{
+    CpuTracer tracer;
+    tracer.set_scene(rvpt.get_triangles(), rvpt.get_materials());
+
+    CpuTracer::Settings cpu_settings;
+    cpu_settings.width = static_cast<uint32_t>(settings.width);
+    cpu_settings.height = static_cast<uint32_t>(settings.height);
+    cpu_settings.max_bounces = rvpt.render_settings.max_bounces;
+    cpu_settings.aa = rvpt.render_settings.aa;
+    cpu_settings.camera_mode = rvpt.render_settings.camera_mode;
+    cpu_settings.light_sampling = rvpt.render_settings.light_sampling;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    tracer.render(rvpt.scene_camera.get_data(), cpu_settings, samples);
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    fmt::print("CPU path tracer: {:.2f}s on {} threads\n", elapsed.count(),
+               tracer.thread_count());
+
+    return tracer.read_image();
+}
+
+// Camera rays of the demo scene traced one at a time and as packets on the CPU
+int run_ray_benchmark(RVPT& rvpt, Window::Settings const& settings)
+{
+    CpuTracer tracer;
+    tracer.set_scene(rvpt.get_triangles(), rvpt.get_materials());
+
+    CpuTracer::Settings cpu_settings;
+    cpu_settings.width = static_cast<uint32_t>(settings.width);
+    cpu_settings.height = static_cast<uint32_t>(settings.height);
+    cpu_settings.camera_mode = rvpt.render_settings.camera_mode;
+
+    auto result = tracer.benchmark_camera_rays(rvpt.scene_camera.get_data(), cpu_settings, 16);
+    fmt::print("Camera rays on {} threads, packet kernel {}:\n", tracer.thread_count(),
+               packet_kernel_uses_avx2() ? "AVX2" : "portable");
+    fmt::print("  single rays {:8.2f} Mrays/s\n", result.scalar_mrays);
+    fmt::print("  packets     {:8.2f} Mrays/s ({:.2f}x)\n", result.packet_mrays,
+               result.packet_mrays / result.scalar_mrays);
+    if (result.mismatches > 0)
+        fmt::print("  {} rays hit a different triangle in the two paths\n", result.mismatches);
+    return 0;
+}
+
+// rvpt --headless [--cpu | --reference | --ray-benchmark] [--denoise] [--samples N] [--output file.ppm] [--width W] [--height H]
+// Renders the demo scene without a window, works with software implementations like lavapipe.
+// With --cpu, or when no Vulkan device can be initialized, the CPU path tracer is used instead.
+// --reference renders on the GPU and prints the error against the CPU path tracer.
+// --ray-benchmark compares the CPU packet traversal against single rays, without rendering.
+// --denoise filters the GPU image, --reference then shows the error of the denoised image.
+int run_headless(Window::Settings settings, int argc, char** argv)
+{
+    uint32_t samples = 64;
+    std::string output = "rvpt.ppm";
+    bool use_cpu = false;
+    bool reference = false;
+    bool ray_benchmark = false;
+    bool denoise = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--cpu")
+            use_cpu = true;
+        else if (arg == "--reference")
+            reference = true;
+        else if (arg == "--ray-benchmark")
+            ray_benchmark = true;
+        else if (arg == "--denoise")
+            denoise = true;
+        else if (i + 1 >= argc)
+            break;
+        else if (arg == "--samples")
+            samples = static_cast<uint32_t>(std::stoul(argv[++i]));
+        else if (arg == "--output")
+            output = argv[++i];
+        else if (arg == "--width")
+            settings.width = std::stoi(argv[++i]);
+        else if (arg == "--height")
+            settings.height = std::stoi(argv[++i]);
+    }
+
+    RVPT rvpt(settings);
+    setup_demo_scene(rvpt);
+    rvpt.render_settings.denoise = denoise ? 1 : 0;
+    if (ray_benchmark) return run_ray_benchmark(rvpt, settings);
+    if (!use_cpu && !rvpt.initialize())
+    {
+        fmt::print("failed to initialize RVPT, falling back to the CPU path tracer\n");
+        use_cpu = true;
+    }
+
+    std::vector<uint8_t> image;
+    if (use_cpu)
+        image = render_on_cpu(rvpt, settings, samples);
+    else
+    {
+        rvpt.render_samples(samples);
+        image = rvpt.read_image();
+    }
+
+    if (reference && !use_cpu)
+    {
+        // both converge to the same image, the error shrinks with the sample count
+        double rmse = rmse_rgba8(image, render_on_cpu(rvpt, settings, samples));
+        fmt::print("RMSE against the CPU reference: {:.5f}\n", rmse);
+    }
+
+    bool saved = write_ppm(output, image, static_cast<uint32_t>(settings.width),
+                           static_cast<uint32_t>(settings.height));
+    if (saved) fmt::print("Wrote {} samples per pixel to {}\n", samples, output);
+    if (!use_cpu) rvpt.shutdown();
+    return saved ? 0 : -1;
+}
+
+int main(int argc, char** argv)
 {
     ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
     // WARNING: THIS CODE IS BROKEN AND SHOULD ONLY BE RAN IF YOU KNOW EXACTLY WHAT YOU'RE GETTING YOURSELF INTO //
@@ -95,16 +180,31 @@ int main()
     Window::Settings settings;
     settings.width = 1024;
     settings.height = 512;
-    Window window(settings);
 
-    RVPT rvpt(window);
+    std::string gpu_times_file;
+    std::string trace_file;
+    std::string scene_file;
+    size_t geometry_budget_mb = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--headless") return run_headless(settings, argc, argv);
+        // rvpt --batch jobs.json, see batch.h for the format
+        if (arg == "--batch" && i + 1 < argc) return run_batch(argv[i + 1]);
+        // rvpt --gpu-times times.csv logs the GPU time of every pass of every frame
+        if (arg == "--gpu-times" && i + 1 < argc) gpu_times_file = argv[++i];
+        // rvpt --trace trace.json writes the CPU zones of the last frames for chrome://tracing
+        if (arg == "--trace" && i + 1 < argc) trace_file = argv[++i];
+        // rvpt --scene scene.rvscene replaces the demo scene, see rvpt_convert
+        if (arg == "--scene" && i + 1 < argc) scene_file = argv[++i];
+        // rvpt --geometry-budget 64 streams the triangles within 64 MB per frame in flight
+        if (arg == "--geometry-budget" && i + 1 < argc) geometry_budget_mb = std::stoul(argv[++i]);
+    }
 
-    load_model(rvpt, "models/rabbit.obj", 1);
+    Profiler::set_thread_name("main");
+    Window window(settings);
 
-    // Setup Demo Scene
-    rvpt.add_material(
-        Material(glm::vec4(1, 1, 1, 0), glm::vec4(0.1, 0.4, 0.6, 0), Material::Type::LAMBERT));
-    rvpt.add_material(Material(glm::vec4(1.0, 1.0, 1.0, 0), glm::vec4(0), Material::Type::LAMBERT));
+    RVPT rvpt(window);
 
     bool rvpt_init_ret = rvpt.initialize();
     if (!rvpt_init_ret)
@@ -112,6 +212,19 @@ int main()
         fmt::print("failed to initialize RVPT\n");
         return 0;
     }
+    rvpt.set_geometry_budget(geometry_budget_mb * 1024 * 1024);
+
+    // Setup Demo Scene, the window renders the empty scene until it is loaded
+    SceneDescription scene;
+    if (scene_file.empty())
+    {
+        scene = demo_scene();
+        for (auto& model : scene.models) rvpt.get_asset_path(model.file);
+    }
+    else
+        scene.scene_file = scene_file;
+    rvpt.load_scene_async(scene);
+    if (!gpu_times_file.empty()) rvpt.start_gpu_timing_log(gpu_times_file);
 
     window.setup_imgui();
     window.add_mouse_move_callback([&window, &rvpt](double x, double y) {
@@ -121,7 +234,7 @@ int main()
         }
     });
 
-    window.add_mouse_click_callback([&window](Window::Mouse button, Window::Action action) {
+    window.add_mouse_click_callback([&window, &rvpt](Window::Mouse button, Window::Action action) {
         if (button == Window::Mouse::LEFT && action == Window::Action::RELEASE &&
             window.is_mouse_locked_to_window())
         {
@@ -135,9 +248,19 @@ int main()
                 window.set_mouse_window_lock(true);
             }
         }
+        else if (button == Window::Mouse::RIGHT && action == Window::Action::RELEASE &&
+                 !window.is_mouse_locked_to_window() && !ImGui::GetIO().WantCaptureMouse)
+        {
+            ImVec2 mouse = ImGui::GetIO().MousePos;
+            auto picked = rvpt.pick(glm::vec2(mouse.x, mouse.y));
+            if (picked)
+                fmt::print("Picked triangle {} (material {}) at distance {:.3f}\n",
+                           picked->triangle, picked->material, picked->distance);
+        }
     });
     while (!window.should_close())
     {
+        Profiler::Zone zone("frame");
         window.poll_events();
         if (window.is_key_down(Window::KeyCode::KEY_ESCAPE)) window.set_close();
         if (window.is_key_down(Window::KeyCode::KEY_R)) rvpt.reload_shaders();
@@ -154,6 +277,7 @@ int main()
         rvpt.draw();
     }
     rvpt.shutdown();
+    if (!trace_file.empty()) Profiler::write_chrome_trace(trace_file);
 
     return 0;
 }
@@ -0,0 +1,55 @@
+#include "mapped_file.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(std::string const& filename)
+{
+#if defined(_WIN32)
+    HANDLE file_handle =
+        CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                    FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE) return;
+    file = file_handle;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) return;
+    mapping = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) return;
+    void* mapped = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!mapped) return;
+    view = static_cast<char const*>(mapped);
+    view_size = static_cast<size_t>(file_size.QuadPart);
+#else
+    file = open(filename.c_str(), O_RDONLY);
+    if (file < 0) return;
+    struct stat file_stat;
+    if (fstat(file, &file_stat) != 0 || file_stat.st_size == 0) return;
+    auto size = static_cast<size_t>(file_stat.st_size);
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (mapped == MAP_FAILED) return;
+    // the loaders read front to back
+    madvise(mapped, size, MADV_SEQUENTIAL);
+    view = static_cast<char const*>(mapped);
+    view_size = size;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#if defined(_WIN32)
+    if (view) UnmapViewOfFile(view);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+#else
+    if (view) munmap(const_cast<char*>(view), view_size);
+    if (file >= 0) close(file);
+#endif
+}
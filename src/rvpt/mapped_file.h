@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read only view of a whole file, mapped into memory so loaders can parse or copy from it without
+// reading it into a buffer first
+class MappedFile
+{
+public:
+    explicit MappedFile(std::string const& filename);
+    ~MappedFile();
+
+    MappedFile(MappedFile const& other) = delete;
+    MappedFile& operator=(MappedFile const& other) = delete;
+
+    // null when the file couldn't be opened or is empty
+    [[nodiscard]] char const* data() const noexcept { return view; }
+    [[nodiscard]] size_t size() const noexcept { return view_size; }
+
+private:
+    char const* view = nullptr;
+    size_t view_size = 0;
+#if defined(_WIN32)
+    void* file = nullptr;  // HANDLE
+    void* mapping = nullptr;
+#else
+    int file = -1;
+#endif
+};
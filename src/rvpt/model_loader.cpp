@@ -0,0 +1,15 @@
+#include "model_loader.h"
+
+#include <cstdlib>
+#include <utility>
+
+#include "obj_loader.h"
+
+void load_model(RVPT& rvpt, std::string inputfile, int material_id)
+{
+    rvpt.get_asset_path(inputfile);
+
+    std::vector<Triangle> triangles;
+    if (!load_obj(inputfile, material_id, triangles)) exit(-1);
+    rvpt.add_triangles(std::move(triangles));
+}
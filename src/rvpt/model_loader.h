@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string>
+
+#include "rvpt.h"
+
+// Adds the triangles of an .obj file to the scene, all using `material_id`
+void load_model(RVPT& rvpt, std::string inputfile, int material_id);
@@ -0,0 +1,289 @@
+#include "obj_loader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <fmt/core.h>
+
+#include "mapped_file.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+namespace
+{
+// Bytes parsed by one task, the chunks end at line ends
+constexpr size_t chunk_size = 1 << 20;
+
+// Positions and faces of one chunk. Face indices are 0 based; negative (relative) indices are
+// resolved against the vertices of the chunk so far and only miss the count of the chunks before,
+// which is added once all chunks are parsed.
+struct ObjChunk
+{
+    std::vector<glm::vec3> positions;
+    std::vector<int64_t> indices;
+    std::vector<uint32_t> face_sizes;
+    std::vector<size_t> relative_indices;  // entries of `indices` which need the vertex base
+    size_t triangle_count = 0;
+    size_t skipped_faces = 0;
+    size_t error_line = 0;  // line in the chunk which can't be parsed, 0 -> none
+};
+
+bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+char const* skip_spaces(char const* p, char const* end)
+{
+    while (p < end && is_space(*p)) p++;
+    return p;
+}
+
+// Decimal number with optional sign, fraction and exponent. Returns false when there's no number
+bool parse_float(char const*& p, char const* end, float& value)
+{
+    static constexpr double powers_of_ten[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                               1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                               1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    char const* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    // digits beyond the 19th don't fit the mantissa and only shift the exponent
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any_digit = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, any_digit = true)
+    {
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+            if (mantissa != 0) digits++;
+        }
+        else
+            exponent++;
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, any_digit = true)
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+                if (mantissa != 0) digits++;
+                exponent--;
+            }
+        }
+    }
+    if (!any_digit)
+    {
+        p = start;
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        char const* exponent_start = p++;
+        bool negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+')) negative_exponent = *p++ == '-';
+        if (p < end && *p >= '0' && *p <= '9')
+        {
+            int written = 0;
+            for (; p < end && *p >= '0' && *p <= '9'; p++)
+                written = std::min(written * 10 + (*p - '0'), 1000);
+            exponent += negative_exponent ? -written : written;
+        }
+        else
+            p = exponent_start;
+    }
+
+    double result = static_cast<double>(mantissa);
+    for (; exponent > 22; exponent -= 22) result *= 1e22;
+    for (; exponent < -22; exponent += 22) result /= 1e22;
+    if (exponent >= 0)
+        result *= powers_of_ten[static_cast<size_t>(exponent)];
+    else
+        result /= powers_of_ten[static_cast<size_t>(-exponent)];
+    value = static_cast<float>(negative ? -result : result);
+    return true;
+}
+
+bool parse_int(char const*& p, char const* end, int64_t& value)
+{
+    bool negative = false;
+    char const* start = p;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    if (p == end || *p < '0' || *p > '9')
+    {
+        p = start;
+        return false;
+    }
+    int64_t result = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) result = result * 10 + (*p - '0');
+    value = negative ? -result : result;
+    return true;
+}
+
+// "f v v v ...", every vertex "v", "v/vt", "v//vn" or "v/vt/vn", only the position is used
+void parse_face(char const* p, char const* end, ObjChunk& chunk, size_t line)
+{
+    size_t first_index = chunk.indices.size();
+    size_t local_vertices = chunk.positions.size();
+    for (p = skip_spaces(p, end); p < end; p = skip_spaces(p, end))
+    {
+        int64_t index;
+        if (!parse_int(p, end, index) || index == 0)
+        {
+            if (chunk.error_line == 0) chunk.error_line = line;
+            break;
+        }
+        if (index > 0)
+            chunk.indices.push_back(index - 1);
+        else
+        {
+            chunk.relative_indices.push_back(chunk.indices.size());
+            chunk.indices.push_back(static_cast<int64_t>(local_vertices) + index);
+        }
+        // texture coordinate and normal indices
+        while (p < end && !is_space(*p)) p++;
+    }
+
+    auto face_size = static_cast<uint32_t>(chunk.indices.size() - first_index);
+    if (face_size < 3)
+    {
+        chunk.indices.resize(first_index);
+        while (!chunk.relative_indices.empty() && chunk.relative_indices.back() >= first_index)
+            chunk.relative_indices.pop_back();
+        chunk.skipped_faces++;
+        return;
+    }
+    chunk.face_sizes.push_back(face_size);
+    chunk.triangle_count += face_size - 2;
+}
+
+void parse_chunk(char const* begin, char const* end, ObjChunk& chunk)
+{
+    size_t line = 0;
+    for (char const* p = begin; p < end; line++)
+    {
+        auto line_end =
+            static_cast<char const*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+        if (!line_end) line_end = end;
+
+        char const* q = skip_spaces(p, line_end);
+        if (line_end - q >= 2 && q[0] == 'v' && is_space(q[1]))
+        {
+            glm::vec3 position{};
+            q += 2;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                q = skip_spaces(q, line_end);
+                if (!parse_float(q, line_end, position[axis]) && chunk.error_line == 0)
+                    chunk.error_line = line + 1;
+            }
+            chunk.positions.push_back(position);
+        }
+        else if (line_end - q >= 2 && q[0] == 'f' && is_space(q[1]))
+            parse_face(q + 2, line_end, chunk, line + 1);
+
+        p = line_end + 1;
+    }
+}
+
+size_t count_lines(char const* begin, char const* end)
+{
+    return static_cast<size_t>(std::count(begin, end, '\n'));
+}
+}  // namespace
+
+bool load_obj(std::string const& filename, int material_id, std::vector<Triangle>& triangles)
+{
+    Profiler::Zone zone("load_obj");
+
+    MappedFile file(filename);
+    if (!file.data())
+    {
+        fmt::print("[{}: {}] Failed to open {}\n", "ERROR", "MODEL-LOADING", filename);
+        return false;
+    }
+
+    // chunk boundaries just after a line end
+    std::vector<char const*> boundaries = {file.data()};
+    char const* file_end = file.data() + file.size();
+    while (boundaries.back() != file_end)
+    {
+        auto remaining = static_cast<size_t>(file_end - boundaries.back());
+        char const* boundary = std::find(boundaries.back() + std::min(chunk_size, remaining),
+                                         file_end, '\n');
+        boundaries.push_back(boundary == file_end ? file_end : boundary + 1);
+    }
+    std::vector<ObjChunk> chunks(boundaries.size() - 1);
+
+    // small files aren't worth starting threads for
+    ThreadPool pool(chunks.size() > 1 ? 0 : 1);
+    pool.parallel_for(chunks.size(),
+                      [&](size_t i) { parse_chunk(boundaries[i], boundaries[i + 1], chunks[i]); });
+
+    size_t vertex_count = 0;
+    size_t triangle_count = 0;
+    size_t skipped_faces = 0;
+    std::vector<size_t> vertex_bases(chunks.size());
+    std::vector<size_t> triangle_bases(chunks.size());
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        vertex_bases[i] = vertex_count;
+        triangle_bases[i] = triangle_count;
+        vertex_count += chunks[i].positions.size();
+        triangle_count += chunks[i].triangle_count;
+        skipped_faces += chunks[i].skipped_faces;
+        if (chunks[i].error_line != 0)
+        {
+            size_t line = chunks[i].error_line;
+            for (size_t j = 0; j < i; j++) line += count_lines(boundaries[j], boundaries[j + 1]);
+            fmt::print("[{}: {}] {}:{} can't be parsed\n", "ERROR", "MODEL-LOADING", filename,
+                       line);
+            return false;
+        }
+    }
+    if (skipped_faces > 0)
+        fmt::print("[{}: {}] Skipped {} faces with less than 3 vertices\n", "WARNING",
+                   "MODEL-LOADING", skipped_faces);
+
+    std::vector<glm::vec3> positions;
+    positions.reserve(vertex_count);
+    for (auto& chunk : chunks)
+        positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+
+    // polygons are split into fans around their first vertex, every chunk writes its own range
+    size_t first_triangle = triangles.size();
+    triangles.resize(first_triangle + triangle_count);
+    std::vector<uint8_t> chunk_valid(chunks.size(), 1);
+    pool.parallel_for(chunks.size(), [&](size_t i) {
+        auto& chunk = chunks[i];
+        for (size_t index : chunk.relative_indices)
+            chunk.indices[index] += static_cast<int64_t>(vertex_bases[i]);
+
+        Triangle* output = triangles.data() + first_triangle + triangle_bases[i];
+        int64_t const* face = chunk.indices.data();
+        for (uint32_t face_size : chunk.face_sizes)
+        {
+            for (uint32_t v = 0; v < face_size; v++)
+                if (face[v] < 0 || face[v] >= static_cast<int64_t>(positions.size()))
+                    chunk_valid[i] = 0;
+            if (!chunk_valid[i]) return;
+
+            auto position = [&](uint32_t v) { return positions[static_cast<size_t>(face[v])]; };
+            for (uint32_t v = 2; v < face_size; v++)
+                *output++ = Triangle(position(0), position(v - 1), position(v), material_id);
+            face += face_size;
+        }
+    });
+
+    if (std::find(chunk_valid.begin(), chunk_valid.end(), 0) != chunk_valid.end())
+    {
+        fmt::print("[{}: {}] {} has faces with vertex indices out of range\n", "ERROR",
+                   "MODEL-LOADING", filename);
+        triangles.resize(first_triangle);
+        return false;
+    }
+    return true;
+}
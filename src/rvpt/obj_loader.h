@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "geometry.h"
+
+// Appends the triangles of an .obj file to `triangles`, all using `material_id`. Needs neither
+// RVPT nor a Vulkan device, so tools can load models too. Returns false when the file can't be
+// parsed.
+//
+// The file is memory mapped and split into chunks at line ends which are parsed in parallel,
+// then the triangles of all chunks are written into `triangles` in one go. Only vertex positions
+// and faces are read; polygons are split into triangle fans.
+bool load_obj(std::string const& filename, int material_id, std::vector<Triangle>& triangles);
@@ -0,0 +1,183 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+
+namespace Profiler
+{
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+struct Event
+{
+    char const* name;
+    int64_t begin_ns;  // since the profiler started
+    int64_t end_ns;    // -1 for counters
+    double value;      // counters only
+};
+
+struct ThreadBuffer
+{
+    // only contended while the statistics or the trace are gathered
+    std::mutex mutex;
+    uint32_t id = 0;
+    std::string name;
+    std::vector<Event> events;  // allocated by the first event
+    uint64_t written = 0;       // total events, the next one goes to written % RING_CAPACITY
+};
+
+struct Registry
+{
+    std::mutex mutex;
+    // never removed, the events of finished threads stay in the trace
+    std::vector<std::unique_ptr<ThreadBuffer>> threads;
+    Clock::time_point start = Clock::now();
+};
+
+Registry& registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+ThreadBuffer& thread_buffer()
+{
+    thread_local ThreadBuffer* buffer = [] {
+        auto& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        auto& new_buffer = reg.threads.emplace_back(std::make_unique<ThreadBuffer>());
+        new_buffer->id = static_cast<uint32_t>(reg.threads.size() - 1);
+        new_buffer->name = "thread " + std::to_string(new_buffer->id);
+        return new_buffer.get();
+    }();
+    return *buffer;
+}
+
+int64_t since_start(Clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time - registry().start).count();
+}
+
+void record(Event const& event)
+{
+    auto& buffer = thread_buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    if (buffer.events.empty()) buffer.events.resize(RING_CAPACITY);
+    buffer.events[buffer.written % RING_CAPACITY] = event;
+    buffer.written++;
+}
+
+// Calls `func` for every event still in the ring buffers, oldest first per thread
+template <typename Func>
+void for_each_event(Func&& func)
+{
+    auto& reg = registry();
+    std::lock_guard<std::mutex> registry_lock(reg.mutex);
+    for (auto& buffer : reg.threads)
+    {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        uint64_t first = buffer->written > RING_CAPACITY ? buffer->written - RING_CAPACITY : 0;
+        for (uint64_t i = first; i < buffer->written; i++)
+            func(*buffer, buffer->events[i % RING_CAPACITY]);
+    }
+}
+
+// nearest rank, `sorted` must not be empty
+double percentile(std::vector<double> const& sorted, double p)
+{
+    auto rank = static_cast<size_t>(std::ceil(p * static_cast<double>(sorted.size())));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+}  // namespace
+
+Zone::Zone(char const* name) noexcept : name(name), begin(Clock::now()) {}
+
+Zone::~Zone() { record(Event{name, since_start(begin), since_start(Clock::now()), 0.0}); }
+
+void counter(char const* name, double value)
+{
+    record(Event{name, since_start(Clock::now()), -1, value});
+}
+
+void set_thread_name(std::string const& name)
+{
+    auto& buffer = thread_buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.name = name;
+}
+
+std::vector<ZoneStatistics> zone_statistics()
+{
+    // zones are told apart by their name, the same literal may have several addresses
+    std::map<std::string, std::vector<double>> durations;
+    for_each_event([&](ThreadBuffer const&, Event const& event) {
+        if (event.end_ns < 0) return;
+        durations[event.name].push_back(static_cast<double>(event.end_ns - event.begin_ns) /
+                                        1000000.0);
+    });
+
+    std::vector<ZoneStatistics> statistics;
+    for (auto& [name, times] : durations)
+    {
+        std::sort(times.begin(), times.end());
+        statistics.push_back(ZoneStatistics{name, times.size(), percentile(times, 0.50),
+                                            percentile(times, 0.95), percentile(times, 0.99)});
+    }
+    return statistics;
+}
+
+bool write_chrome_trace(std::string const& filename)
+{
+    // complete events ("X") for zones and counter events ("C"), times in microseconds
+    nlohmann::json events = nlohmann::json::array();
+    std::map<uint32_t, std::string> thread_names;
+    for_each_event([&](ThreadBuffer const& buffer, Event const& event) {
+        thread_names[buffer.id] = buffer.name;
+        nlohmann::json json;
+        json["name"] = event.name;
+        json["pid"] = 0;
+        json["tid"] = buffer.id;
+        json["ts"] = static_cast<double>(event.begin_ns) / 1000.0;
+        if (event.end_ns >= 0)
+        {
+            json["ph"] = "X";
+            json["dur"] = static_cast<double>(event.end_ns - event.begin_ns) / 1000.0;
+        }
+        else
+        {
+            json["ph"] = "C";
+            json["args"] = {{"value", event.value}};
+        }
+        events.push_back(std::move(json));
+    });
+    for (auto& [id, name] : thread_names)
+    {
+        events.push_back({{"name", "thread_name"},
+                          {"ph", "M"},
+                          {"pid", 0},
+                          {"tid", id},
+                          {"args", {{"name", name}}}});
+    }
+
+    std::ofstream output(filename);
+    if (!output)
+    {
+        fmt::print(stderr, "Failed to open {} for writing\n", filename);
+        return false;
+    }
+    nlohmann::json trace;
+    trace["traceEvents"] = std::move(events);
+    trace["displayTimeUnit"] = "ms";
+    output << trace.dump();
+    return static_cast<bool>(output);
+}
+}  // namespace Profiler
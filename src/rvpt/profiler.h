@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Scoped CPU zones recorded into a ring buffer per thread, with percentiles per zone and export to
+// the Chrome trace format (chrome://tracing, Perfetto). Recording only takes an uncontended lock
+// of the calling thread's buffer, so zones can be placed in worker threads as well.
+//
+//     {
+//         Profiler::Zone zone("upload buffers");
+//         ...
+//     }
+
+namespace Profiler
+{
+// events kept per thread, older ones are overwritten
+constexpr size_t RING_CAPACITY = 16384;
+
+class Zone
+{
+public:
+    // `name` must outlive the profiler, usually a string literal
+    explicit Zone(char const* name) noexcept;
+    ~Zone();
+
+    Zone(Zone const& other) = delete;
+    Zone& operator=(Zone const& other) = delete;
+
+private:
+    char const* name;
+    std::chrono::steady_clock::time_point begin;
+};
+
+// Records a value over time, for example the GPU time of a pass when it is read back
+void counter(char const* name, double value);
+
+// Shown instead of "thread N" in the trace
+void set_thread_name(std::string const& name);
+
+struct ZoneStatistics
+{
+    std::string name;
+    size_t count;
+    double p50_ms;
+    double p95_ms;
+    double p99_ms;
+};
+// Percentiles of the zones still in the ring buffers, sorted by name
+std::vector<ZoneStatistics> zone_statistics();
+
+bool write_chrome_trace(std::string const& filename);
+}  // namespace Profiler
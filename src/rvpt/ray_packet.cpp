@@ -0,0 +1,390 @@
+#include "ray_packet.h"
+
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// This file may be compiled with AVX2 enabled while the rest of the program is not (see RVPT_AVX2
+// in CMakeLists.txt), so everything used on the hot path is defined here with internal linkage
+// instead of coming from inline functions which could be shared with other translation units.
+
+namespace
+{
+constexpr float INF = std::numeric_limits<float>::infinity();
+constexpr int STACK_SIZE = 64;
+
+#if defined(__AVX2__)
+
+struct float8
+{
+    __m256 v;
+};
+struct bool8
+{
+    __m256 v;
+};
+
+inline float8 splat(float x) { return {_mm256_set1_ps(x)}; }
+inline float8 load(float const* p) { return {_mm256_load_ps(p)}; }
+inline void store(float* p, float8 a) { _mm256_store_ps(p, a.v); }
+
+inline float8 operator+(float8 a, float8 b) { return {_mm256_add_ps(a.v, b.v)}; }
+inline float8 operator-(float8 a, float8 b) { return {_mm256_sub_ps(a.v, b.v)}; }
+inline float8 operator*(float8 a, float8 b) { return {_mm256_mul_ps(a.v, b.v)}; }
+inline float8 operator/(float8 a, float8 b) { return {_mm256_div_ps(a.v, b.v)}; }
+inline float8 min8(float8 a, float8 b) { return {_mm256_min_ps(a.v, b.v)}; }
+inline float8 max8(float8 a, float8 b) { return {_mm256_max_ps(a.v, b.v)}; }
+
+inline bool8 operator<(float8 a, float8 b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+inline bool8 operator>=(float8 a, float8 b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)}; }
+inline bool8 operator&(bool8 a, bool8 b) { return {_mm256_and_ps(a.v, b.v)}; }
+
+// a where the mask is set, b elsewhere
+inline float8 select(bool8 mask, float8 a, float8 b)
+{
+    return {_mm256_blendv_ps(b.v, a.v, mask.v)};
+}
+inline uint32_t movemask(bool8 mask)
+{
+    return static_cast<uint32_t>(_mm256_movemask_ps(mask.v));
+}
+inline bool8 lanes(uint32_t mask)
+{
+    __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i set = _mm256_and_si256(_mm256_set1_epi32(static_cast<int>(mask)), bits);
+    return {_mm256_castsi256_ps(_mm256_cmpeq_epi32(set, bits))};
+}
+
+#else
+
+struct float8
+{
+    float v[PACKET_WIDTH];
+};
+struct bool8
+{
+    bool v[PACKET_WIDTH];
+};
+
+template <typename Op>
+inline float8 map(float8 a, float8 b, Op op)
+{
+    float8 r;
+    for (size_t i = 0; i < PACKET_WIDTH; i++) r.v[i] = op(a.v[i], b.v[i]);
+    return r;
+}
+template <typename Op>
+inline bool8 compare(float8 a, float8 b, Op op)
+{
+    bool8 r;
+    for (size_t i = 0; i < PACKET_WIDTH; i++) r.v[i] = op(a.v[i], b.v[i]);
+    return r;
+}
+
+inline float8 splat(float x)
+{
+    float8 r;
+    for (auto& v : r.v) v = x;
+    return r;
+}
+inline float8 load(float const* p)
+{
+    float8 r;
+    for (size_t i = 0; i < PACKET_WIDTH; i++) r.v[i] = p[i];
+    return r;
+}
+inline void store(float* p, float8 a)
+{
+    for (size_t i = 0; i < PACKET_WIDTH; i++) p[i] = a.v[i];
+}
+
+inline float8 operator+(float8 a, float8 b)
+{
+    return map(a, b, [](float x, float y) { return x + y; });
+}
+inline float8 operator-(float8 a, float8 b)
+{
+    return map(a, b, [](float x, float y) { return x - y; });
+}
+inline float8 operator*(float8 a, float8 b)
+{
+    return map(a, b, [](float x, float y) { return x * y; });
+}
+inline float8 operator/(float8 a, float8 b)
+{
+    return map(a, b, [](float x, float y) { return x / y; });
+}
+// same NaN handling as minps/maxps: the second operand is returned
+inline float8 min8(float8 a, float8 b)
+{
+    return map(a, b, [](float x, float y) { return x < y ? x : y; });
+}
+inline float8 max8(float8 a, float8 b)
+{
+    return map(a, b, [](float x, float y) { return x > y ? x : y; });
+}
+
+inline bool8 operator<(float8 a, float8 b)
+{
+    return compare(a, b, [](float x, float y) { return x < y; });
+}
+inline bool8 operator>=(float8 a, float8 b)
+{
+    return compare(a, b, [](float x, float y) { return x >= y; });
+}
+inline bool8 operator&(bool8 a, bool8 b)
+{
+    bool8 r;
+    for (size_t i = 0; i < PACKET_WIDTH; i++) r.v[i] = a.v[i] && b.v[i];
+    return r;
+}
+
+inline float8 select(bool8 mask, float8 a, float8 b)
+{
+    float8 r;
+    for (size_t i = 0; i < PACKET_WIDTH; i++) r.v[i] = mask.v[i] ? a.v[i] : b.v[i];
+    return r;
+}
+inline uint32_t movemask(bool8 mask)
+{
+    uint32_t bits = 0;
+    for (size_t i = 0; i < PACKET_WIDTH; i++) bits |= static_cast<uint32_t>(mask.v[i]) << i;
+    return bits;
+}
+inline bool8 lanes(uint32_t mask)
+{
+    bool8 r;
+    for (size_t i = 0; i < PACKET_WIDTH; i++) r.v[i] = (mask >> i) & 1u;
+    return r;
+}
+
+#endif
+
+struct Vec8
+{
+    float8 x, y, z;
+};
+
+inline float8 dot(Vec8 const& a, Vec8 const& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec8 cross(Vec8 const& a, Vec8 const& b)
+{
+    return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+inline Vec8 splat(float x, float y, float z) { return {splat(x), splat(y), splat(z)}; }
+
+inline float min3(float a, float b, float c) { return a < b ? (a < c ? a : c) : (b < c ? b : c); }
+inline float max3(float a, float b, float c) { return a > b ? (a > c ? a : c) : (b > c ? b : c); }
+
+// Bounds of t = (plane - origin) * inv_dir over all origins in [o_min, o_max] and inverse
+// directions in [i_min, i_max]
+inline void interval_product(float plane, float o_min, float o_max, float i_min, float i_max,
+                             float& lower, float& upper)
+{
+    float l = plane - o_max;
+    float h = plane - o_min;
+    float a = l * i_min, b = l * i_max, c = h * i_min, d = h * i_max;
+    lower = a < b ? a : b;
+    lower = lower < c ? lower : c;
+    lower = lower < d ? lower : d;
+    upper = a > b ? a : b;
+    upper = upper > c ? upper : c;
+    upper = upper > d ? upper : d;
+}
+
+// Conservative bounds of a whole packet whose directions have the same sign per axis. Used to
+// reject a node for all rays at once, before testing the rays individually.
+struct PacketInterval
+{
+    bool valid = false;
+    float origin_min[3], origin_max[3];
+    float inv_dir_min[3], inv_dir_max[3];
+    bool negative[3];  // direction sign per axis, picks the near and far planes
+    float tmin;        // smallest tmin of the active rays
+};
+
+PacketInterval compute_interval(RayPacket const& packet, float const* inv_dir[3])
+{
+    PacketInterval interval;
+    float const* origin[3] = {packet.origin_x, packet.origin_y, packet.origin_z};
+
+    bool first = true;
+    for (size_t lane = 0; lane < PACKET_WIDTH; lane++)
+    {
+        if (!((packet.active_mask >> lane) & 1u)) continue;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float o = origin[axis][lane];
+            float i = inv_dir[axis][lane];
+            // axis parallel rays give infinite factors, leave them to the per ray test
+            if (!(i > -INF && i < INF)) return interval;
+            if (first)
+            {
+                interval.origin_min[axis] = interval.origin_max[axis] = o;
+                interval.inv_dir_min[axis] = interval.inv_dir_max[axis] = i;
+                interval.negative[axis] = i < 0;
+            }
+            else
+            {
+                if ((i < 0) != interval.negative[axis]) return interval;
+                float& o_min = interval.origin_min[axis];
+                float& o_max = interval.origin_max[axis];
+                float& i_min = interval.inv_dir_min[axis];
+                float& i_max = interval.inv_dir_max[axis];
+                o_min = o < o_min ? o : o_min;
+                o_max = o > o_max ? o : o_max;
+                i_min = i < i_min ? i : i_min;
+                i_max = i > i_max ? i : i_max;
+            }
+        }
+        float tmin = packet.tmin[lane];
+        interval.tmin = first || tmin < interval.tmin ? tmin : interval.tmin;
+        first = false;
+    }
+    interval.valid = !first;
+    return interval;
+}
+
+// True if no ray of the packet can hit the node before `tmax`
+bool interval_cull(PacketInterval const& interval, BvhNode const& node, float tmax)
+{
+    float near_lower[3], far_upper[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float lo = node.bounds[axis * 2];
+        float hi = node.bounds[axis * 2 + 1];
+        float near_plane = interval.negative[axis] ? hi : lo;
+        float far_plane = interval.negative[axis] ? lo : hi;
+        float unused;
+        interval_product(near_plane, interval.origin_min[axis], interval.origin_max[axis],
+                         interval.inv_dir_min[axis], interval.inv_dir_max[axis], near_lower[axis],
+                         unused);
+        interval_product(far_plane, interval.origin_min[axis], interval.origin_max[axis],
+                         interval.inv_dir_min[axis], interval.inv_dir_max[axis], unused,
+                         far_upper[axis]);
+    }
+    float t0 = max3(near_lower[0], near_lower[1], near_lower[2]);
+    float t1 = min3(far_upper[0], far_upper[1], far_upper[2]);
+    t0 = t0 > interval.tmin ? t0 : interval.tmin;
+    t1 = t1 < tmax ? t1 : tmax;
+    return t1 < t0;
+}
+
+float horizontal_max(float8 a)
+{
+    alignas(32) float values[PACKET_WIDTH];
+    store(values, a);
+    float result = -INF;
+    for (float v : values) result = v > result ? v : result;
+    return result;
+}
+}  // namespace
+
+bool packet_kernel_uses_avx2()
+{
+#if defined(__AVX2__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+void trace_packet(BvhNode const* nodes, Triangle const* triangles, RayPacket const& packet,
+                  PacketHit& hit)
+{
+    Vec8 origin{load(packet.origin_x), load(packet.origin_y), load(packet.origin_z)};
+    Vec8 direction{load(packet.direction_x), load(packet.direction_y), load(packet.direction_z)};
+    Vec8 inv_dir{splat(1.0f) / direction.x, splat(1.0f) / direction.y, splat(1.0f) / direction.z};
+
+    alignas(32) float inv_dir_lanes[3][PACKET_WIDTH];
+    store(inv_dir_lanes[0], inv_dir.x);
+    store(inv_dir_lanes[1], inv_dir.y);
+    store(inv_dir_lanes[2], inv_dir.z);
+    float const* inv_dir_axes[3] = {inv_dir_lanes[0], inv_dir_lanes[1], inv_dir_lanes[2]};
+    PacketInterval interval = compute_interval(packet, inv_dir_axes);
+
+    float8 tmin = load(packet.tmin);
+    // inactive lanes can't pass any test with an upper bound of -INF
+    float8 closest_t = select(lanes(packet.active_mask), load(packet.tmax), splat(-INF));
+    float packet_max_t = horizontal_max(closest_t);
+    float8 hit_u = splat(0.0f);
+    float8 hit_v = splat(0.0f);
+    for (auto& prim : hit.prim) prim = ~0u;
+    hit.hit_mask = 0;
+
+    uint32_t stack[STACK_SIZE];
+    int stack_ptr = 0;
+    stack[stack_ptr++] = ~0u;
+    uint32_t stack_top = 0;
+    while (stack_top != ~0u)
+    {
+        BvhNode const& node = nodes[stack_top];
+        if (interval.valid && interval_cull(interval, node, packet_max_t))
+        {
+            stack_top = stack[--stack_ptr];
+            continue;
+        }
+
+        // slab test for every ray, see intersect_aabb in intersection.glsl
+        Vec8 node_min = splat(node.bounds[0], node.bounds[2], node.bounds[4]);
+        Vec8 node_max = splat(node.bounds[1], node.bounds[3], node.bounds[5]);
+        float8 fx = (node_max.x - origin.x) * inv_dir.x, nx = (node_min.x - origin.x) * inv_dir.x;
+        float8 fy = (node_max.y - origin.y) * inv_dir.y, ny = (node_min.y - origin.y) * inv_dir.y;
+        float8 fz = (node_max.z - origin.z) * inv_dir.z, nz = (node_min.z - origin.z) * inv_dir.z;
+        float8 t1 = min8(min8(max8(fx, nx), max8(fy, ny)), min8(max8(fz, nz), closest_t));
+        float8 t0 = max8(max8(min8(fx, nx), min8(fy, ny)), max8(min8(fz, nz), tmin));
+        if (movemask(t1 >= t0) == 0)
+        {
+            stack_top = stack[--stack_ptr];
+            continue;
+        }
+
+        if (node.is_leaf())
+        {
+            for (uint32_t i = node.first_child_or_primitive, n = i + node.primitive_count; i < n;
+                 ++i)
+            {
+                Triangle const& triangle = triangles[i];
+                float v0x = triangle.vertex0.x, v0y = triangle.vertex0.y, v0z = triangle.vertex0.z;
+                Vec8 v0 = splat(v0x, v0y, v0z);
+                Vec8 e1 = splat(triangle.vertex1.x - v0x, triangle.vertex1.y - v0y,
+                                triangle.vertex1.z - v0z);
+                Vec8 e2 = splat(triangle.vertex2.x - v0x, triangle.vertex2.y - v0y,
+                                triangle.vertex2.z - v0z);
+
+                // Möller-Trumbore
+                Vec8 pvec = cross(direction, e2);
+                float8 inv_det = splat(1.0f) / dot(e1, pvec);
+                Vec8 tvec{origin.x - v0.x, origin.y - v0.y, origin.z - v0.z};
+                float8 u = dot(tvec, pvec) * inv_det;
+                Vec8 qvec = cross(tvec, e1);
+                float8 v = dot(direction, qvec) * inv_det;
+                float8 t = dot(e2, qvec) * inv_det;
+
+                bool8 accept = (splat(0.0f) < u) & (splat(0.0f) < v) & (u + v < splat(1.0f)) &
+                               (tmin < t) & (t < closest_t);
+                uint32_t accepted = movemask(accept);
+                if (accepted == 0) continue;
+
+                closest_t = select(accept, t, closest_t);
+                hit_u = select(accept, u, hit_u);
+                hit_v = select(accept, v, hit_v);
+                for (size_t lane = 0; lane < PACKET_WIDTH; lane++)
+                    if ((accepted >> lane) & 1u) hit.prim[lane] = i;
+                hit.hit_mask |= accepted;
+                packet_max_t = horizontal_max(closest_t);
+            }
+            stack_top = stack[--stack_ptr];
+        }
+        else
+        {
+            stack[stack_ptr++] = node.first_child_or_primitive + 1;
+            stack_top = node.first_child_or_primitive;
+        }
+    }
+
+    store(hit.t, select(lanes(hit.hit_mask), closest_t, splat(INF)));
+    store(hit.u, hit_u);
+    store(hit.v, hit_v);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "bvh.h"
+#include "geometry.h"
+
+// Packets of coherent rays (camera rays of neighbouring pixels) traced through the BVH together.
+// Every node is fetched once for the whole packet and tested against all rays with SIMD, and
+// whole subtrees are skipped with a single interval arithmetic test when the packet is coherent.
+
+constexpr size_t PACKET_WIDTH = 8;
+
+// Structure of arrays so every component loads straight into a SIMD register
+struct RayPacket
+{
+    alignas(32) float origin_x[PACKET_WIDTH];
+    alignas(32) float origin_y[PACKET_WIDTH];
+    alignas(32) float origin_z[PACKET_WIDTH];
+    alignas(32) float direction_x[PACKET_WIDTH];
+    alignas(32) float direction_y[PACKET_WIDTH];
+    alignas(32) float direction_z[PACKET_WIDTH];
+    alignas(32) float tmin[PACKET_WIDTH];
+    alignas(32) float tmax[PACKET_WIDTH];
+    uint32_t active_mask = (1u << PACKET_WIDTH) - 1;  // bit per lane, inactive lanes never hit
+
+    void set_ray(size_t lane, glm::vec3 origin, glm::vec3 direction, float min_t, float max_t)
+    {
+        origin_x[lane] = origin.x;
+        origin_y[lane] = origin.y;
+        origin_z[lane] = origin.z;
+        direction_x[lane] = direction.x;
+        direction_y[lane] = direction.y;
+        direction_z[lane] = direction.z;
+        tmin[lane] = min_t;
+        tmax[lane] = max_t;
+    }
+};
+
+struct PacketHit
+{
+    alignas(32) float t[PACKET_WIDTH];  // INF -> no hit
+    alignas(32) float u[PACKET_WIDTH];  // barycentric coordinates
+    alignas(32) float v[PACKET_WIDTH];
+    uint32_t prim[PACKET_WIDTH];  // index of the triangle in bvh order, ~0 -> no hit
+    uint32_t hit_mask = 0;
+};
+
+// Closest hits of the rays of `packet` in (tmin, tmax), Möller-Trumbore against the triangles.
+// `nodes` and `triangles` are the BVH nodes and the triangles permuted into BVH order.
+void trace_packet(BvhNode const* nodes, Triangle const* triangles, RayPacket const& packet,
+                  PacketHit& hit);
+
+// Whether trace_packet was compiled with AVX2 (RVPT_AVX2), otherwise it uses portable 8 lane loops
+// and runs on any CPU
+bool packet_kernel_uses_avx2();
@@ -0,0 +1,321 @@
+#include "ray_query.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "profiler.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace
+{
+constexpr float INF = std::numeric_limits<float>::infinity();
+
+// BVH traversal stack depth, same as the shaders
+constexpr int STACK_SIZE = 64;
+
+bool intersect_aabb(CpuRay const& ray, glm::vec3 inv_dir, float const* bounds, float mint,
+                    float maxt)
+{
+    glm::vec3 aabb_min(bounds[0], bounds[2], bounds[4]);
+    glm::vec3 aabb_max(bounds[1], bounds[3], bounds[5]);
+
+    glm::vec3 f = (aabb_max - ray.origin) * inv_dir;
+    glm::vec3 n = (aabb_min - ray.origin) * inv_dir;
+
+    glm::vec3 tmax = glm::max(f, n);
+    glm::vec3 tmin = glm::min(f, n);
+
+    float t1 = std::min(std::min(tmax.x, std::min(tmax.y, tmax.z)), maxt);
+    float t0 = std::max(std::max(tmin.x, std::max(tmin.y, tmin.z)), mint);
+    return t1 >= t0;
+}
+
+// Metric tensor formulation, see intersect_triangle_fast in intersection.glsl
+bool intersect_triangle_fast(CpuRay const& ray, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2,
+                             float mint, float maxt, CpuIsect& info)
+{
+    glm::vec3 e0 = v1 - v0;
+    glm::vec3 e1 = v2 - v0;
+    glm::vec3 n = glm::cross(e0, e1);
+
+    float t = glm::dot(v0 - ray.origin, n) / glm::dot(ray.direction, n);
+    if (!(mint < t && t < maxt)) return false;
+
+    glm::vec3 p0 = ray.origin + t * ray.direction - v0;
+    glm::vec2 b(glm::dot(p0, e0), glm::dot(p0, e1));
+
+    float e00 = glm::dot(e0, e0);
+    float e01 = glm::dot(e0, e1);
+    float e11 = glm::dot(e1, e1);
+    float inv_det = 1.0f / (e11 * e00 - e01 * e01);
+    glm::vec2 uv = inv_det * glm::vec2(e11 * b.x - e01 * b.y, -e01 * b.x + e00 * b.y);
+
+    if (!(0 < uv.x && 0 < uv.y && uv.x + uv.y < 1)) return false;
+
+    info.t = t;
+    info.pos = ray.origin + t * ray.direction;
+    info.normal = n;
+    info.uv = uv;
+    return true;
+}
+
+bool cpu_supports_avx2()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    // the OS has to save the ymm registers too
+    __cpuid(info, 1);
+    bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return os_avx && (info[1] & (1 << 5));
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+CpuRay packet_ray(RayPacket const& packet, size_t lane)
+{
+    return {glm::vec3(packet.origin_x[lane], packet.origin_y[lane], packet.origin_z[lane]),
+            glm::vec3(packet.direction_x[lane], packet.direction_y[lane],
+                      packet.direction_z[lane])};
+}
+
+// 3 bits direction octant + 3x8 bits Morton code of the origin inside the scene bounds, the same
+// ordering as ray_sort_key in wavefront.glsl with a finer grid
+uint32_t ray_sort_key(QueryRay const& ray, AABB const& bounds, glm::vec3 inv_extent)
+{
+    glm::vec3 p = glm::clamp((ray.origin - bounds.min) * inv_extent, glm::vec3(0), glm::vec3(1));
+    uint32_t cell[3];
+    for (int axis = 0; axis < 3; axis++)
+        cell[axis] = std::min(static_cast<uint32_t>(p[axis] * 256.0f), 255u);
+
+    uint32_t morton = 0;
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+        morton |= ((cell[0] >> i) & 1u) << (3 * i + 2);
+        morton |= ((cell[1] >> i) & 1u) << (3 * i + 1);
+        morton |= ((cell[2] >> i) & 1u) << (3 * i);
+    }
+
+    uint32_t octant = static_cast<uint32_t>(ray.direction.x < 0) |
+                      (static_cast<uint32_t>(ray.direction.y < 0) << 1) |
+                      (static_cast<uint32_t>(ray.direction.z < 0) << 2);
+    return (octant << 24) | morton;
+}
+}  // namespace
+
+RayQuery::RayQuery(ThreadPool& pool)
+    : pool(pool), use_packets(!packet_kernel_uses_avx2() || cpu_supports_avx2())
+{
+}
+
+void RayQuery::set_scene(Bvh const& bvh, std::vector<Triangle> const& sorted_triangles)
+{
+    nodes = &bvh.nodes;
+    triangles = &sorted_triangles;
+}
+
+bool RayQuery::intersect(CpuRay const& ray, float mint, float maxt, CpuIsect& info) const
+{
+    info.t = INF;
+    info.pos = glm::vec3(0);
+    info.normal = glm::vec3(0);
+    if (!nodes || nodes->empty()) return false;
+
+    glm::vec3 inv_dir = 1.0f / ray.direction;
+    float closest_t = maxt;
+
+    uint32_t stack[STACK_SIZE];
+    int stack_ptr = 0;
+    stack[stack_ptr++] = ~0u;
+    uint32_t stack_top = 0;
+    while (stack_top != ~0u)
+    {
+        BvhNode const& node = (*nodes)[stack_top];
+        if (!intersect_aabb(ray, inv_dir, node.bounds, mint, closest_t))
+        {
+            stack_top = stack[--stack_ptr];
+            continue;
+        }
+
+        if (node.is_leaf())
+        {
+            for (uint32_t i = node.first_child_or_primitive, n = i + node.primitive_count; i < n;
+                 ++i)
+            {
+                Triangle const& triangle = (*triangles)[i];
+                CpuIsect temp_isect;
+                if (intersect_triangle_fast(ray, glm::vec3(triangle.vertex0),
+                                            glm::vec3(triangle.vertex1),
+                                            glm::vec3(triangle.vertex2), mint, closest_t,
+                                            temp_isect))
+                {
+                    info = temp_isect;
+                    info.prim = i;
+                    closest_t = temp_isect.t;
+                }
+            }
+            stack_top = stack[--stack_ptr];
+        }
+        else
+        {
+            stack[stack_ptr++] = node.first_child_or_primitive + 1;
+            stack_top = node.first_child_or_primitive;
+        }
+    }
+    return closest_t < maxt;
+}
+
+bool RayQuery::intersect_any(CpuRay const& ray, float mint, float maxt) const
+{
+    if (!nodes || nodes->empty()) return false;
+
+    glm::vec3 inv_dir = 1.0f / ray.direction;
+
+    uint32_t stack[STACK_SIZE];
+    int stack_ptr = 0;
+    stack[stack_ptr++] = ~0u;
+    uint32_t stack_top = 0;
+    while (stack_top != ~0u)
+    {
+        BvhNode const& node = (*nodes)[stack_top];
+        if (!intersect_aabb(ray, inv_dir, node.bounds, mint, maxt))
+        {
+            stack_top = stack[--stack_ptr];
+            continue;
+        }
+
+        if (node.is_leaf())
+        {
+            for (uint32_t i = node.first_child_or_primitive, n = i + node.primitive_count; i < n;
+                 ++i)
+            {
+                Triangle const& triangle = (*triangles)[i];
+                CpuIsect temp_isect;
+                if (intersect_triangle_fast(ray, glm::vec3(triangle.vertex0),
+                                            glm::vec3(triangle.vertex1),
+                                            glm::vec3(triangle.vertex2), mint, maxt, temp_isect))
+                    return true;
+            }
+            stack_top = stack[--stack_ptr];
+        }
+        else
+        {
+            stack[stack_ptr++] = node.first_child_or_primitive + 1;
+            stack_top = node.first_child_or_primitive;
+        }
+    }
+    return false;
+}
+
+void RayQuery::trace_packet(RayPacket const& packet, PacketHit& hit) const
+{
+    if (use_packets && nodes && !nodes->empty())
+    {
+        ::trace_packet(nodes->data(), triangles->data(), packet, hit);
+        return;
+    }
+
+    hit.hit_mask = 0;
+    for (size_t lane = 0; lane < PACKET_WIDTH; lane++)
+    {
+        CpuIsect info;
+        if ((packet.active_mask >> lane) & 1u &&
+            intersect(packet_ray(packet, lane), packet.tmin[lane], packet.tmax[lane], info))
+        {
+            hit.t[lane] = info.t;
+            hit.u[lane] = info.uv.x;
+            hit.v[lane] = info.uv.y;
+            hit.prim[lane] = info.prim;
+            hit.hit_mask |= 1u << lane;
+        }
+        else
+        {
+            hit.t[lane] = INF;
+            hit.u[lane] = hit.v[lane] = 0.0f;
+            hit.prim[lane] = ~0u;
+        }
+    }
+}
+
+void RayQuery::sort_chunk(std::vector<QueryRay> const& rays, size_t begin, size_t end,
+                          std::vector<uint32_t>& order) const
+{
+    order.resize(end - begin);
+    for (size_t i = begin; i < end; i++) order[i - begin] = static_cast<uint32_t>(i);
+    if (!nodes || nodes->empty()) return;
+
+    AABB bounds = nodes->front().aabb();
+    glm::vec3 inv_extent = 1.0f / glm::max(bounds.diagonal(), glm::vec3(1e-6f));
+
+    std::vector<std::pair<uint32_t, uint32_t>> keys(end - begin);
+    for (size_t i = begin; i < end; i++)
+        keys[i - begin] = {ray_sort_key(rays[i], bounds, inv_extent), static_cast<uint32_t>(i)};
+    std::sort(keys.begin(), keys.end());
+    for (size_t i = 0; i < keys.size(); i++) order[i] = keys[i].second;
+}
+
+void RayQuery::trace_rays(std::vector<QueryRay> const& rays, std::vector<QueryHit>& hits) const
+{
+    hits.resize(rays.size());
+    size_t chunk_count = (rays.size() + chunk_size - 1) / chunk_size;
+    pool.parallel_for(chunk_count, [&](size_t chunk) {
+        Profiler::Zone zone("trace_rays chunk");
+        size_t begin = chunk * chunk_size;
+        size_t end = std::min(begin + chunk_size, rays.size());
+        std::vector<uint32_t> order;
+        sort_chunk(rays, begin, end, order);
+
+        for (size_t first = 0; first < order.size(); first += PACKET_WIDTH)
+        {
+            size_t lane_count = std::min(PACKET_WIDTH, order.size() - first);
+            RayPacket packet{};
+            packet.active_mask = (1u << lane_count) - 1;
+            for (size_t lane = 0; lane < lane_count; lane++)
+            {
+                QueryRay const& ray = rays[order[first + lane]];
+                packet.set_ray(lane, ray.origin, ray.direction, ray.tmin, ray.tmax);
+            }
+
+            PacketHit packet_hit;
+            trace_packet(packet, packet_hit);
+
+            for (size_t lane = 0; lane < lane_count; lane++)
+            {
+                bool hit = (packet_hit.hit_mask >> lane) & 1u;
+                hits[order[first + lane]] = {hit ? packet_hit.t[lane] : INF,
+                                             hit ? packet_hit.prim[lane] : ~0u,
+                                             glm::vec2(packet_hit.u[lane], packet_hit.v[lane])};
+            }
+        }
+    });
+}
+
+void RayQuery::occluded(std::vector<QueryRay> const& rays, std::vector<uint8_t>& results) const
+{
+    results.resize(rays.size());
+    size_t chunk_count = (rays.size() + chunk_size - 1) / chunk_size;
+    pool.parallel_for(chunk_count, [&](size_t chunk) {
+        Profiler::Zone zone("occluded chunk");
+        size_t begin = chunk * chunk_size;
+        size_t end = std::min(begin + chunk_size, rays.size());
+        std::vector<uint32_t> order;
+        sort_chunk(rays, begin, end, order);
+
+        // any hit ends the traversal early, which the packet kernel can't do per ray
+        for (uint32_t index : order)
+        {
+            QueryRay const& ray = rays[index];
+            results[index] =
+                intersect_any(CpuRay{ray.origin, ray.direction}, ray.tmin, ray.tmax) ? 1 : 0;
+        }
+    });
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "geometry.h"
+#include "ray_packet.h"
+#include "thread_pool.h"
+
+// CPU intersection queries against the triangle BVH: the scalar traversal mirroring
+// intersect_bvh/intersect_bvh_any in intersection.glsl, the SIMD packet traversal, and batched
+// queries spread over a thread pool. Needs no Vulkan device, usable from tools as well as RVPT.
+
+struct CpuRay
+{
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+struct CpuIsect
+{
+    float t;           // coordinate along the ray, INF -> none
+    glm::vec3 pos;     // position in global coordinates
+    glm::vec3 normal;  // unnormalized geometric normal
+    glm::vec2 uv;      // barycentric coordinates
+    uint32_t prim;     // index of the intersected triangle in bvh order
+};
+
+// A ray of a batch, with its own interval along the ray
+struct QueryRay
+{
+    glm::vec3 origin;
+    float tmin = 0.0f;
+    glm::vec3 direction;
+    float tmax = std::numeric_limits<float>::infinity();
+};
+
+struct QueryHit
+{
+    float t;        // INF -> no hit
+    uint32_t prim;  // index of the triangle in bvh order, ~0 -> no hit
+    glm::vec2 uv;   // barycentric coordinates
+};
+
+class RayQuery
+{
+public:
+    explicit RayQuery(ThreadPool& pool);
+
+    // The BVH and the triangles permuted into BVH order are referenced, not copied. Set them again
+    // whenever they change.
+    void set_scene(Bvh const& bvh, std::vector<Triangle> const& sorted_triangles);
+
+    [[nodiscard]] bool intersect(CpuRay const& ray, float mint, float maxt, CpuIsect& info) const;
+    [[nodiscard]] bool intersect_any(CpuRay const& ray, float mint, float maxt) const;
+    // Closest hits of 8 rays at once. Falls back to `intersect` per ray when the packet kernel was
+    // built for AVX2 but the CPU doesn't support it
+    void trace_packet(RayPacket const& packet, PacketHit& hit) const;
+
+    // Closest hit of every ray, `hits` is resized to the number of rays. The batch is split into
+    // chunks over the thread pool, the rays of a chunk are sorted by direction octant and origin
+    // so that neighbouring rays visit the same nodes, then traced as packets.
+    // Uses the thread pool, so it must not be called from one of its tasks.
+    void trace_rays(std::vector<QueryRay> const& rays, std::vector<QueryHit>& hits) const;
+    // 1 for every ray which hits anything in (tmin, tmax), 0 otherwise
+    void occluded(std::vector<QueryRay> const& rays, std::vector<uint8_t>& results) const;
+
+    [[nodiscard]] bool packets_enabled() const noexcept { return use_packets; }
+
+private:
+    static constexpr size_t chunk_size = 1024;
+
+    // indices of rays [begin, end) in traversal order
+    void sort_chunk(std::vector<QueryRay> const& rays, size_t begin, size_t end,
+                    std::vector<uint32_t>& order) const;
+
+    ThreadPool& pool;
+    std::vector<BvhNode> const* nodes = nullptr;
+    std::vector<Triangle> const* triangles = nullptr;
+    bool use_packets = true;
+};
@@ -1,15 +1,21 @@
 #include "rvpt.h"
 
-#include <cstdlib>
-
 #include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <fstream>
+#include <iterator>
 
 #include <nlohmann/json.hpp>
 #include <imgui.h>
 
 #include "imgui_helpers.h"
 #include "imgui_internal.h"
+#include "image_io.h"
+#include "cpu_tracer.h"
+#include "obj_loader.h"
+#include "profiler.h"
+#include "scene_file.h"
 
 struct DebugVertex
 {
@@ -25,12 +31,60 @@ bool RVPT::PreviousFrameState::operator==(RVPT::PreviousFrameState const& right)
            settings.top_right_render_mode == right.settings.top_right_render_mode &&
            settings.bottom_left_render_mode == right.settings.bottom_left_render_mode &&
            settings.bottom_right_render_mode == right.settings.bottom_right_render_mode &&
-           settings.camera_mode == right.settings.camera_mode && camera_data == right.camera_data;
+           settings.camera_mode == right.settings.camera_mode &&
+           settings.light_sampling == right.settings.light_sampling &&
+           settings.denoise == right.settings.denoise &&
+           camera_data == right.camera_data;
+}
+
+namespace
+{
+// pages copied into the page pool of a frame at most per frame, about 3 MB for closed meshes
+constexpr size_t MAX_PAGE_UPLOADS_PER_FRAME = 64;
+// bytes of a new scene copied into the buffers of a frame per frame, see update_scene_buffers
+constexpr size_t SCENE_UPLOAD_BYTES_PER_FRAME = 4 * 1024 * 1024;
+
+// Copies the elements of `data` from `copied` on into `buffer`, `offset` bytes in, as many as
+// fit in `budget` bytes. Returns the bytes copied
+template <typename T>
+size_t copy_part(VK::Buffer& buffer, std::vector<T> const& data, size_t& copied, size_t budget,
+                 VkDeviceSize offset = 0)
+{
+    size_t count = std::min(data.size() - copied, budget / sizeof(T));
+    if (count == 0) return 0;
+    buffer.copy_range_to(data.data() + copied, count, offset + sizeof(T) * copied);
+    copied += count;
+    return sizeof(T) * count;
+}
+
+// Indexes the triangles and builds their BVH, the GPU and the CPU copy of the scene in BVH order
+void build_scene_bvh(std::vector<Triangle> const& triangles, BinnedBvhBuilder& builder, Bvh& bvh,
+                     GeometryPages& pages, std::vector<Triangle>& sorted_triangles)
+{
+    if (triangles.empty())
+    {
+        // a single leaf holding a degenerate triangle no ray hits, so neither the buffers nor
+        // the traversal have to handle an empty scene
+        bvh = Bvh{};
+        bvh.nodes.push_back(BvhNode{0, 1, {}});
+        bvh.primitive_indices = {0};
+        sorted_triangles = {Triangle()};
+        pages = split_into_pages(index_triangles(sorted_triangles));
+        return;
+    }
+    // the shaders fetch the vertices through indices, shared vertices are stored once
+    auto mesh = index_triangles(triangles);
+    bvh = builder.build_bvh(mesh);
+    pages = split_into_pages(mesh.permute_triangles(bvh.primitive_indices));
+    sorted_triangles = bvh.permute_primitives(triangles);
 }
+}  // namespace
+
+RVPT::RVPT(Window& window) : RVPT(window.get_settings()) { this->window = &window; }
 
-RVPT::RVPT(Window& window)
-    : window_ref(window),
-      scene_camera(window.get_aspect_ratio()),
+RVPT::RVPT(Window::Settings settings)
+    : window_settings(settings),
+      scene_camera(static_cast<float>(settings.width) / static_cast<float>(settings.height)),
       random_generator(std::random_device{}()),
       distribution(0.0f, 1.0f)
 {
@@ -49,6 +103,7 @@ RVPT::RVPT(Window& window)
     }
 
     random_numbers.resize(20480);
+    ray_query.set_scene(top_level_bvh, sorted_triangles);
 }
 
 RVPT::~RVPT() {}
@@ -56,34 +111,58 @@ RVPT::~RVPT() {}
 bool RVPT::initialize()
 {
     bool init = context_init();
-    pipeline_builder = VK::PipelineBuilder(vk_device, source_folder);
+
+    auto pipelines_start = std::chrono::high_resolution_clock::now();
+    pipeline_builder = VK::PipelineBuilder(context.device.physical_device.physical_device,
+                                           vk_device, source_folder);
     memory_allocator =
         VK::MemoryAllocator(context.device.physical_device.physical_device, vk_device);
 
-    init &= swapchain_init();
-    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    if (!headless())
     {
-        sync_resources.emplace_back(vk_device, graphics_queue.value(), present_queue.value(),
-                                    vkb_swapchain.swapchain);
+        init &= swapchain_init();
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            sync_resources.emplace_back(vk_device, graphics_queue.value(), present_queue.value(),
+                                        vkb_swapchain.swapchain);
+            // one timestamp before the graphics passes and one after each of them
+            if (graphics_timestamp_period > 0.0f)
+                graphics_timestamps.emplace_back(vk_device,
+                                                 static_cast<uint32_t>(GPU_PASS_COUNT -
+                                                                       FIRST_GRAPHICS_PASS + 1),
+                                                 graphics_timestamp_period,
+                                                 "graphics_timestamps_" + std::to_string(i));
+        }
+        frames_inflight_fences.resize(vkb_swapchain.image_count, VK_NULL_HANDLE);
     }
-    frames_inflight_fences.resize(vkb_swapchain.image_count, VK_NULL_HANDLE);
-
-    fullscreen_tri_render_pass = VK::create_render_pass(
-        vk_device, vkb_swapchain.image_format,
-        VK::get_depth_image_format(context.device.physical_device.physical_device),
-        "fullscreen_image_copy_render_pass");
 
-    imgui_impl.emplace(vk_device, *graphics_queue, pipeline_builder, memory_allocator,
-                       fullscreen_tri_render_pass, vkb_swapchain.extent, MAX_FRAMES_IN_FLIGHT);
+    // headless only runs the compute passes, it has no render pass nor graphics pipelines
+    if (!headless())
+    {
+        fullscreen_tri_render_pass = VK::create_render_pass(
+            vk_device, vkb_swapchain.image_format,
+            VK::get_depth_image_format(context.device.physical_device.physical_device),
+            "fullscreen_image_copy_render_pass");
+
+        imgui_impl.emplace(vk_device, *graphics_queue, pipeline_builder, memory_allocator,
+                           fullscreen_tri_render_pass, vkb_swapchain.extent,
+                           MAX_FRAMES_IN_FLIGHT);
+    }
 
     rendering_resources = create_rendering_resources();
+    wavefront_resources = create_wavefront_resources();
 
-    create_framebuffers();
+    // the pipelines were created on worker threads while the other resources were set up
+    pipeline_builder.wait_for_pipelines();
+    std::chrono::duration<double, std::milli> pipelines_time =
+        std::chrono::high_resolution_clock::now() - pipelines_start;
+    pipelines_ready_ms = pipelines_time.count();
+    fmt::print("Pipelines ready after {:.1f} ms ({} pipeline cache)\n", pipelines_ready_ms,
+               pipeline_cache_warm() ? "warm" : "cold");
 
-    // Bvh Stuff
-    top_level_bvh = bvh_builder.build_bvh(triangles);
-    depth_bvh_bounds = top_level_bvh.collect_aabbs_by_depth();
-    sorted_triangles = top_level_bvh.permute_primitives(triangles);
+    if (!headless()) create_framebuffers();
+
+    build_bvh();
 
     for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
@@ -95,6 +174,12 @@ bool RVPT::initialize()
 
 bool RVPT::update()
 {
+    Profiler::Zone zone("update");
+    finish_shader_reload();
+    if (scene_load.valid() &&
+        scene_load.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        finish_scene_load();
+
     auto camera_data = scene_camera.get_data();
 
     render_settings.camera_mode = scene_camera.get_camera_mode();
@@ -104,29 +189,53 @@ bool RVPT::update()
         render_settings.current_frame = 0;
         previous_frame_state.settings = render_settings;
         previous_frame_state.camera_data = camera_data;
+        tiled_rendering.next_group = 0;
     }
-    else
+    // with tiled rendering the next sample starts once every tile got the current one
+    else if (!tiled_rendering_active() || tiled_rendering.next_group == 0)
     {
         render_settings.current_frame++;
     }
 
     for (auto& r : random_numbers) r = (distribution(random_generator));
 
-    per_frame_data[current_frame_index].raytrace_work_fence.wait();
-    per_frame_data[current_frame_index].raytrace_work_fence.reset();
+    {
+        Profiler::Zone wait_zone("wait raytrace fence");
+        per_frame_data[current_frame_index].raytrace_work_fence.wait();
+        per_frame_data[current_frame_index].raytrace_work_fence.reset();
+    }
+
+    bool timed = read_gpu_pass_times();
+    if (persistent_benchmark.running) update_persistent_benchmark(timed);
+    // a new scene takes a few frames to upload, the frame renders the old one meanwhile
+    if (per_frame_data[current_frame_index].scene_version != scene_version)
+        update_scene_buffers(per_frame_data[current_frame_index],
+                             static_cast<int>(current_frame_index));
+    stream_geometry_pages(per_frame_data[current_frame_index]);
+    if (per_frame_data[current_frame_index].traversal_stats_recorded)
+        per_frame_data[current_frame_index].traversal_buffer.copy_from(traversal_totals);
+    if (tiled_rendering_active()) update_tile_budget();
+
+    if (wavefront_enabled)
+    {
+        wavefront_resources->readback[current_frame_index].copy_from(wavefront_stats);
+    }
 
+    Profiler::Zone upload_zone("upload buffers");
     per_frame_data[current_frame_index].settings_uniform.copy_to(render_settings);
     per_frame_data[current_frame_index].random_buffer.copy_to(random_numbers);
     per_frame_data[current_frame_index].camera_uniform.copy_to(camera_data);
 
     float delta = static_cast<float>(time.since_last_frame());
 
-    per_frame_data[current_frame_index].bvh_buffer.copy_to(top_level_bvh.nodes);
-    per_frame_data[current_frame_index].triangle_buffer.copy_to(sorted_triangles);
-    per_frame_data[current_frame_index].material_buffer.copy_to(materials);
+    // the geometry is only uploaded when the scene changes, see update_scene_buffers; the
+    // materials may not fit the buffers of the old scene
+    if (per_frame_data[current_frame_index].scene_version == scene_version)
+        per_frame_data[current_frame_index].scene.material_buffer.copy_to(materials);
 
     if (debug_overlay_enabled)
     {
+        Profiler::Zone debug_zone("debug raster vertices");
         std::vector<DebugVertex> debug_triangles;
         debug_triangles.reserve(triangles.size());
         for (auto& tri : triangles)
@@ -151,10 +260,13 @@ bool RVPT::update()
 
     if (debug_bvh_enabled)
     {
+        Profiler::Zone debug_zone("debug bvh vertices");
         bvh_vertex_count = 0;
         std::vector<DebugVertex> bvh_debug_vertices;
 
-        for (int i = view_previous_depths ? 0 : max_bvh_view_depth - 1; i < max_bvh_view_depth; i++)
+        // the depth of the slider may belong to an earlier scene
+        int depth_count = std::min(max_bvh_view_depth, static_cast<int>(depth_bvh_bounds.size()));
+        for (int i = view_previous_depths ? 0 : depth_count - 1; i < depth_count; i++)
         {
             const std::vector<AABB>& bounding_boxes = depth_bvh_bounds[i];
 
@@ -240,14 +352,15 @@ bool RVPT::update()
 
 void RVPT::update_imgui()
 {
-    if (!show_imgui) return;
+    if (!show_imgui || headless()) return;
+    Profiler::Zone zone("update imgui");
 
     ImGuiIO& io = ImGui::GetIO();
 
     // Setup display size (every frame to accommodate for window resizing)
     int w, h;
     int display_w, display_h;
-    auto win_ptr = window_ref.get_window_pointer();
+    auto win_ptr = window->get_window_pointer();
     glfwGetWindowSize(win_ptr, &w, &h);
     glfwGetFramebufferSize(win_ptr, &display_w, &display_h);
     io.DisplaySize = ImVec2((float)w, (float)h);
@@ -260,21 +373,77 @@ void RVPT::update_imgui()
     // imgui back end can't show 2 windows
     static bool show_stats = true;
     ImGui::SetNextWindowPos({0, 0}, ImGuiCond_Once);
-    ImGui::SetNextWindowSize({200, 65}, ImGuiCond_Once);
+    ImGui::SetNextWindowSize({200, 160}, ImGuiCond_Once);
     if (ImGui::Begin("Stats", &show_stats))
     {
         ImGui::Text("Frame Time %.4f", time.average_frame_time());
         ImGui::Text("FPS %.2f", 1.0 / time.average_frame_time());
+        if (scene_loading()) ImGui::Text("Loading scene...");
+        auto const& page_cache = per_frame_data[current_frame_index].scene.page_cache;
+        ImGui::Text("Geometry pages %zu/%zu", page_cache.resident_count(),
+                    geometry_pages.page_count());
+        if (page_cache.missed_pages() > 0)
+            ImGui::Text("  %zu missing", page_cache.missed_pages());
+        if (timestamp_period > 0.0f || graphics_timestamp_period > 0.0f)
+        {
+            ImGui::Text("GPU ms");
+            for (size_t i = 0; i < GPU_PASS_COUNT; i++)
+                ImGui::Text("  %s %.3f", GpuPassNames[i], gpu_timing.average_ms[i]);
+            bool logging = gpu_timing.csv.is_open();
+            if (ImGui::Checkbox("Log CSV", &logging))
+            {
+                if (logging)
+                    start_gpu_timing_log("gpu_pass_times.csv");
+                else
+                    stop_gpu_timing_log();
+            }
+        }
+        else
+            ImGui::Text("No GPU timestamps");
+
+        // gathering the percentiles walks every ring buffer, so only refresh them now and then
+        static std::vector<Profiler::ZoneStatistics> zone_stats;
+        static double zone_stats_time = -1.0;
+        if (ImGui::CollapsingHeader("CPU Zones"))
+        {
+            if (time.time_since_start() - zone_stats_time > 0.5)
+            {
+                zone_stats = Profiler::zone_statistics();
+                zone_stats_time = time.time_since_start();
+            }
+            ImGui::Text("p50/p95/p99 ms");
+            for (auto& stats : zone_stats)
+                ImGui::Text("%s %.3f/%.3f/%.3f", stats.name.c_str(), stats.p50_ms, stats.p95_ms,
+                            stats.p99_ms);
+            if (ImGui::Button("Save Trace")) Profiler::write_chrome_trace("rvpt_trace.json");
+        }
     }
     ImGui::End();
     static bool show_render_settings = true;
-    ImGui::SetNextWindowPos({0, 65}, ImGuiCond_Once);
+    ImGui::SetNextWindowPos({0, 160}, ImGuiCond_Once);
     ImGui::SetNextWindowSize({200, 190}, ImGuiCond_Once);
     if (ImGui::Begin("Render Settings", &show_stats))
     {
         ImGui::PushItemWidth(80);
         ImGui::SliderInt("AA", &render_settings.aa, 1, 64);
         ImGui::SliderInt("Max Bounce", &render_settings.max_bounces, 1, 64);
+        static char const* light_sampling_names[] = {"Off", "Power", "Light BVH"};
+        ImGui::Combo("Light Sampling", &render_settings.light_sampling, light_sampling_names,
+                     IM_ARRAYSIZE(light_sampling_names));
+        if (!light_list.empty())
+        {
+            ImGui::SameLine();
+            ImGui::Text("%zu", light_list.lights.size());
+        }
+
+        bool denoise = render_settings.denoise != 0;
+        if (ImGui::Checkbox("Denoise", &denoise)) render_settings.denoise = denoise ? 1 : 0;
+        if (denoise)
+        {
+            ImGui::Indent();
+            ImGui::SliderInt("Steps", &denoise_iterations, 1, 8);
+            ImGui::Unindent();
+        }
 
         ImGui::Checkbox("Debug Raster", &debug_overlay_enabled);
 
@@ -293,6 +462,65 @@ void RVPT::update_imgui()
             ImGui::PopStyleVar();
         }
 
+        ImGui::Checkbox("Wavefront", &wavefront_enabled);
+        if (wavefront_enabled)
+        {
+            ImGui::Indent();
+            if (wavefront_supported())
+            {
+                ImGui::Text("MRays/s %.2f",
+                            wavefront_stats.rays_traced / time.average_frame_time() / 1000000.0);
+                // key changes per warp in queue order and in the order the stage ran
+                auto changes_per_warp = [&](size_t stat, size_t warps) {
+                    double warp_count = std::max(1.0, double(wavefront_stats.sort_warps[warps]));
+                    ImGui::SameLine();
+                    ImGui::Text("%.2f -> %.2f changes/warp",
+                                wavefront_stats.sort_stats[stat] / warp_count,
+                                wavefront_stats.sort_stats[stat + 1] / warp_count);
+                };
+                ImGui::Checkbox("Sort Rays", &wavefront_sort_rays);
+                if (wavefront_sort_rays) changes_per_warp(0, 0);
+                ImGui::Checkbox("Sort Hits", &wavefront_sort_hits);
+                if (wavefront_sort_hits) changes_per_warp(2, 1);
+            }
+            else
+                ImGui::Text("Whitted & Kajiya only");
+            ImGui::Unindent();
+        }
+
+        ImGui::Checkbox("Traversal Stats", &traversal_stats_enabled);
+        if (traversal_stats_active())
+        {
+            // per ray averages of the last frame read back
+            ImGui::Indent();
+            double rays = static_cast<double>(std::max<uint64_t>(traversal_totals.rays, 1));
+            ImGui::Text("Rays %.2fM", static_cast<double>(traversal_totals.rays) / 1000000.0);
+            ImGui::Text("Nodes/ray %.1f", traversal_totals.nodes_visited / rays);
+            ImGui::Text("Boxes/ray %.1f", traversal_totals.aabb_tests / rays);
+            ImGui::Text("Tris/ray %.1f", traversal_totals.triangle_tests / rays);
+            ImGui::Unindent();
+        }
+
+        ImGui::Checkbox("Specialized Pipelines", &specialized_pipelines_enabled);
+        ImGui::Checkbox("Persistent Threads", &persistent_threads_enabled);
+        if (persistent_threads_enabled)
+        {
+            ImGui::Indent();
+            ImGui::SliderInt("Groups", &persistent_group_count, 1, 4096);
+            ImGui::Unindent();
+        }
+        if (ImGui::Button("Benchmark Persistent") && !persistent_benchmark.running)
+            start_persistent_benchmark();
+
+        ImGui::Checkbox("Tiled", &tiled_rendering.enabled);
+        if (tiled_rendering.enabled)
+        {
+            ImGui::Indent();
+            ImGui::SliderFloat("Budget ms", &tiled_rendering.target_ms, 1.f, 100.f);
+            ImGui::Text("Tiles/frame %u", tiled_rendering.groups_per_frame);
+            ImGui::Unindent();
+        }
+
         if (ImGui::Button("BVH Debug")) toggle_bvh_debug();
         ImGui::SliderInt("Depth", &max_bvh_view_depth, 1, depth_bvh_bounds.size());
         ImGui::SameLine();
@@ -346,22 +574,41 @@ void RVPT::update_imgui()
 RVPT::draw_return RVPT::draw()
 {
     time.frame_start();
+    Profiler::Zone zone("draw");
+
+    {
+        Profiler::Zone compute_zone("record and submit compute");
+        record_compute_command_buffer();
 
-    record_compute_command_buffer();
+        VK::Queue& compute_submit = compute_queue.has_value() ? *compute_queue : *graphics_queue;
+        compute_submit.submit(per_frame_data[current_frame_index].raytrace_command_buffer,
+                              per_frame_data[current_frame_index].raytrace_work_fence);
+    }
 
-    VK::Queue& compute_submit = compute_queue.has_value() ? *compute_queue : *graphics_queue;
-    compute_submit.submit(per_frame_data[current_frame_index].raytrace_command_buffer,
-                          per_frame_data[current_frame_index].raytrace_work_fence);
+    if (headless())
+    {
+        current_frame_index = (current_frame_index + 1) % per_frame_data.size();
+        time.frame_stop();
+        return draw_return::success;
+    }
 
     auto& current_frame = sync_resources[current_sync_index];
 
-    current_frame.command_fence.wait();
+    {
+        Profiler::Zone wait_zone("wait command fence");
+        current_frame.command_fence.wait();
+    }
+    read_graphics_pass_times(current_sync_index);
     current_frame.command_buffer.reset();
 
     uint32_t swapchain_image_index;
-    VkResult result = vkAcquireNextImageKHR(vk_device, vkb_swapchain.swapchain, UINT64_MAX,
-                                            current_frame.image_avail_sem.get(), VK_NULL_HANDLE,
-                                            &swapchain_image_index);
+    VkResult result;
+    {
+        Profiler::Zone acquire_zone("acquire image");
+        result = vkAcquireNextImageKHR(vk_device, vkb_swapchain.swapchain, UINT64_MAX,
+                                       current_frame.image_avail_sem.get(), VK_NULL_HANDLE,
+                                       &swapchain_image_index);
+    }
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR)
     {
@@ -377,15 +624,18 @@ RVPT::draw_return RVPT::draw()
 
     if (frames_inflight_fences[swapchain_image_index] != VK_NULL_HANDLE)
     {
+        Profiler::Zone wait_zone("wait swapchain image");
         vkWaitForFences(vk_device, 1, &frames_inflight_fences[swapchain_image_index], VK_TRUE,
                         UINT64_MAX);
     }
     frames_inflight_fences[swapchain_image_index] = current_frame.command_fence.get();
 
     current_frame.command_fence.reset();
-    current_frame.submit();
-
-    result = current_frame.present(swapchain_image_index);
+    {
+        Profiler::Zone present_zone("submit and present");
+        current_frame.submit();
+        result = current_frame.present(swapchain_image_index);
+    }
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebuffer_resized)
     {
@@ -408,14 +658,16 @@ void RVPT::shutdown()
 {
     if (compute_queue) compute_queue->wait_idle();
     graphics_queue->wait_idle();
-    present_queue->wait_idle();
+    if (present_queue) present_queue->wait_idle();
 
     per_frame_data.clear();
+    graphics_timestamps.clear();
+    wavefront_resources.reset();
     rendering_resources.reset();
 
     imgui_impl.reset();
 
-    VK::destroy_render_pass(vk_device, fullscreen_tri_render_pass);
+    if (!headless()) VK::destroy_render_pass(vk_device, fullscreen_tri_render_pass);
 
     framebuffers.clear();
 
@@ -424,23 +676,109 @@ void RVPT::shutdown()
 
     memory_allocator.shutdown();
     pipeline_builder.shutdown();
-    vkb::destroy_swapchain(vkb_swapchain);
+    if (!headless()) vkb::destroy_swapchain(vkb_swapchain);
     vkb::destroy_device(context.device);
-    vkDestroySurfaceKHR(context.inst.instance, context.surf, nullptr);
+    if (!headless()) vkDestroySurfaceKHR(context.inst.instance, context.surf, nullptr);
     vkb::destroy_instance(context.inst);
 }
 
-void replace_all(std::string& str, const std::string& from, const std::string& to)
+void RVPT::render_samples(uint32_t sample_count)
 {
-    if (from.empty()) return;
-    size_t start_pos = 0;
-    while ((start_pos = str.find(from, start_pos)) != std::string::npos)
+    // every frame in flight uploads a new scene over several frames and restarts the
+    // accumulation once it swapped it in, so the samples only count from then on
+    auto scene_pending = [this] {
+        return scene_load.valid() ||
+               std::any_of(per_frame_data.begin(), per_frame_data.end(),
+                           [this](PerFrameData const& frame) {
+                               return frame.scene_version != scene_version ||
+                                      frame.scene_upload.has_value();
+                           });
+    };
+    while (scene_pending())
     {
-        str.replace(start_pos, from.length(), to);
-        start_pos += to.length();  // In case 'to' contains 'from', like replacing 'x' with 'yx'
+        update();
+        draw();
     }
+
+    // start a new accumulation even if nothing changed since the last call
+    previous_frame_state.camera_data.clear();
+
+    // every frame traces `aa` samples per pixel. Uploading geometry pages restarts the
+    // accumulation too, so this counts the frames of the current one instead of the frames drawn
+    uint32_t samples_per_frame = static_cast<uint32_t>(std::max(render_settings.aa, 1));
+    uint32_t frame_count = std::max((sample_count + samples_per_frame - 1) / samples_per_frame, 1u);
+    do
+    {
+        update();
+        draw();
+    } while (render_settings.current_frame + 1 < frame_count ||
+             (tiled_rendering_active() && tiled_rendering.next_group != 0));
+}
+
+std::vector<uint8_t> RVPT::read_image()
+{
+    // the denoiser writes the output image of the last frame, it always covers the whole image
+    size_t last_frame = (current_frame_index + per_frame_data.size() - 1) % per_frame_data.size();
+    auto& image = render_settings.denoise != 0 ? per_frame_data[last_frame].output_image
+                                               : rendering_resources->temporal_storage_image;
+    VkDeviceSize image_size = static_cast<VkDeviceSize>(image.width) * image.height * 4;
+
+    VK::Queue& queue = compute_queue.has_value() ? *compute_queue : *graphics_queue;
+    VK::Buffer readback(vk_device, memory_allocator, "image_readback_buffer",
+                        VK_BUFFER_USAGE_TRANSFER_DST_BIT, image_size, VK::MemoryUsage::gpu_to_cpu);
+    VK::CommandBuffer command_buffer(vk_device, queue, "image_readback_command_buffer");
+    VK::Fence fence(vk_device, "image_readback_fence");
+
+    // the temporal image has the full accumulation even when the output image only got some tiles
+    command_buffer.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    VK::compute_memory_barrier(command_buffer.get());
+
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {image.width, image.height, 1};
+    vkCmdCopyImageToBuffer(command_buffer.get(), image.image.handle, VK_IMAGE_LAYOUT_GENERAL,
+                           readback.get(), 1, &region);
+
+    VkMemoryBarrier host_barrier{};
+    host_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    host_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer.get(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, VK::FLAGS_NONE, 1, &host_barrier, 0, nullptr,
+                         0, nullptr);
+    command_buffer.end();
+
+    queue.submit(command_buffer, fence);
+    fence.wait();
+
+    std::vector<uint8_t> pixels(image_size);
+    readback.copy_from(pixels);
+    return pixels;
 }
 
+bool RVPT::render_offscreen(uint32_t sample_count, std::string const& output_file)
+{
+    render_samples(sample_count);
+    auto& image = rendering_resources->temporal_storage_image;
+    return write_ppm(output_file, read_image(), image.width, image.height);
+}
+
+void RVPT::wait_idle()
+{
+    if (compute_queue) compute_queue->wait_idle();
+    graphics_queue->wait_idle();
+    if (present_queue) present_queue->wait_idle();
+}
+
+void RVPT::set_random_seed(uint32_t seed)
+{
+    random_generator.seed(seed);
+    distribution.reset();
+}
+
+void RVPT::set_wavefront(bool enabled) { wavefront_enabled = enabled; }
+void RVPT::set_traversal_stats(bool enabled) { traversal_stats_enabled = enabled; }
+
 void RVPT::reload_shaders()
 {
     if (source_folder == "")
@@ -448,23 +786,32 @@ void RVPT::reload_shaders()
         fmt::print("source_folder not set, unable to reload shaders\n");
         return;
     }
-    fmt::print("Compiling Shaders:\n");
-#ifdef WIN32
-    auto double_backslash = source_folder;
-    replace_all(double_backslash, "/", "\\\\");
-    std::string str = fmt::format(
-        "cd {0}\\\\assets\\\\shaders && {0}\\\\scripts\\\\compile_shaders.bat", double_backslash);
-    std::system(str.c_str());
-#elif __unix__
-    std::string str =
-        fmt::format("cd {0}/assets/shaders && bash {0}/scripts/compile_shaders.sh", source_folder);
-    std::system(str.c_str());
-#endif
+    if (!shader_compiler) shader_compiler.emplace(source_folder + "/assets/shaders");
+
+    // the result is picked up by finish_shader_reload once the compilation is done
+    if (shader_compiler->compile_changed_shaders()) fmt::print("Compiling Shaders:\n");
+}
+
+void RVPT::finish_shader_reload()
+{
+    if (!shader_compiler) return;
+    auto result = shader_compiler->get_result();
+    if (!result) return;
+
+    // shaders which failed keep their old .spv and pipelines
+    for (auto& error : result->errors) fmt::print(stderr, "{}\n", error);
+    for (auto& compiled : result->compiled) fmt::print("Compiled {}\n", compiled);
+    if (result->compiled.empty())
+    {
+        if (result->errors.empty()) fmt::print("Shaders are up to date\n");
+        return;
+    }
+
     if (compute_queue) compute_queue->wait_idle();
     graphics_queue->wait_idle();
-    present_queue->wait_idle();
+    if (present_queue) present_queue->wait_idle();
 
-    pipeline_builder.recompile_pipelines();
+    pipeline_builder.recompile_pipelines(result->compiled);
 }
 
 void RVPT::toggle_debug() { debug_overlay_enabled = !debug_overlay_enabled; }
@@ -473,6 +820,210 @@ void RVPT::toggle_bvh_debug() { debug_bvh_enabled = !debug_bvh_enabled; }
 void RVPT::toggle_view_last_bvh_depths() { view_previous_depths = !view_previous_depths; }
 void RVPT::set_raytrace_mode(int mode) { render_settings.top_left_render_mode = mode; }
 
+namespace
+{
+// each benchmark configuration is rendered with the megakernel, then with persistent threads
+constexpr int benchmark_bounces[] = {1, 4, 16};
+constexpr size_t benchmark_config_count = 2 * std::size(benchmark_bounces);
+// frames skipped after switching the configuration, covers the frames still in flight
+constexpr int benchmark_warmup_frames = 10;
+// frames whose path tracing pass is timed per configuration
+constexpr int benchmark_measured_frames = 64;
+}  // namespace
+
+void RVPT::start_persistent_benchmark()
+{
+    if (timestamp_period == 0.0f)
+    {
+        fmt::print(stderr, "The persistent threads benchmark needs compute timestamp queries\n");
+        return;
+    }
+    persistent_benchmark.running = true;
+    persistent_benchmark.config = 0;
+    persistent_benchmark.frame = 0;
+    persistent_benchmark.timed_frames = 0;
+    persistent_benchmark.pass_ms_sum = 0.0;
+    persistent_benchmark.saved_settings = render_settings;
+    persistent_benchmark.saved_persistent_threads = persistent_threads_enabled;
+    persistent_benchmark.pass_ms.clear();
+
+    render_settings.max_bounces = benchmark_bounces[0];
+    persistent_threads_enabled = false;
+}
+
+void RVPT::update_persistent_benchmark(bool timed)
+{
+    // `timed` is set when the frame just waited on had its compute timestamps read
+    if (++persistent_benchmark.frame <= benchmark_warmup_frames) return;
+    if (timed)
+    {
+        persistent_benchmark.pass_ms_sum +=
+            gpu_timing.last_ms[static_cast<size_t>(GpuPass::path_tracing)];
+        persistent_benchmark.timed_frames++;
+    }
+    if (persistent_benchmark.timed_frames < benchmark_measured_frames) return;
+
+    persistent_benchmark.pass_ms.push_back(persistent_benchmark.pass_ms_sum /
+                                           persistent_benchmark.timed_frames);
+    persistent_benchmark.frame = 0;
+    persistent_benchmark.timed_frames = 0;
+    persistent_benchmark.pass_ms_sum = 0.0;
+
+    if (++persistent_benchmark.config < benchmark_config_count)
+    {
+        render_settings.max_bounces = benchmark_bounces[persistent_benchmark.config / 2];
+        persistent_threads_enabled = persistent_benchmark.config % 2 == 1;
+        return;
+    }
+
+    fmt::print("Persistent threads benchmark ({} groups, {}, {} spp, GPU time of the path tracing "
+               "pass over {} frames):\n",
+               persistent_group_count, RenderModes[render_settings.top_left_render_mode],
+               render_settings.aa, benchmark_measured_frames);
+    for (size_t i = 0; i < std::size(benchmark_bounces); i++)
+    {
+        double megakernel = persistent_benchmark.pass_ms[2 * i];
+        double persistent = persistent_benchmark.pass_ms[2 * i + 1];
+        fmt::print("  max bounces {:>2}: megakernel {:8.3f} ms, persistent {:8.3f} ms ({:+.1f}%)\n",
+                   benchmark_bounces[i], megakernel, persistent,
+                   (megakernel / persistent - 1.0) * 100.0);
+    }
+
+    render_settings = persistent_benchmark.saved_settings;
+    persistent_threads_enabled = persistent_benchmark.saved_persistent_threads;
+    persistent_benchmark.running = false;
+}
+
+bool RVPT::tiled_rendering_active() const
+{
+    // only the regular megakernel dispatch can be split into tiles
+    return tiled_rendering.enabled && !persistent_threads_enabled &&
+           !(wavefront_enabled && wavefront_supported());
+}
+
+void RVPT::update_tile_budget()
+{
+    uint32_t groups = tiled_rendering.groups_in_flight[current_frame_index];
+    if (groups == 0) return;
+
+    // GPU time of the compute work of the frame, the CPU frame time is a rough fallback
+    double frame_ms = time.average_frame_time() * 1000.0;
+    std::vector<uint64_t> timestamps;
+    if (timestamp_period > 0.0f &&
+        per_frame_data[current_frame_index].compute_timestamps.get_timestamps(timestamps))
+    {
+        frame_ms = per_frame_data[current_frame_index].compute_timestamps.to_milliseconds(
+            timestamps[0], timestamps[1]);
+    }
+
+    double ms_per_group = frame_ms / groups;
+    if (tiled_rendering.ms_per_group == 0.0)
+        tiled_rendering.ms_per_group = ms_per_group;
+    else
+        tiled_rendering.ms_per_group = 0.8 * tiled_rendering.ms_per_group + 0.2 * ms_per_group;
+
+    auto& output_image = per_frame_data[current_frame_index].output_image;
+    uint32_t group_total = ((output_image.width + 15) / 16) * ((output_image.height + 15) / 16);
+    double budget_groups = tiled_rendering.target_ms / std::max(tiled_rendering.ms_per_group, 1e-6);
+    tiled_rendering.groups_per_frame = static_cast<uint32_t>(
+        std::clamp(budget_groups, 1.0, static_cast<double>(group_total)));
+}
+
+bool RVPT::read_gpu_pass_times()
+{
+    // the fence of the frame which wrote the compute timestamps was just waited on, the graphics
+    // passes keep the times read_graphics_pass_times got after their own fence
+    std::vector<uint64_t> timestamps;
+    if (timestamp_period == 0.0f ||
+        !per_frame_data[current_frame_index].compute_timestamps.get_timestamps(timestamps))
+        return false;
+
+    auto& compute_timestamps = per_frame_data[current_frame_index].compute_timestamps;
+    gpu_timing.last_ms[static_cast<size_t>(GpuPass::path_tracing)] =
+        compute_timestamps.to_milliseconds(timestamps[0], timestamps[1]);
+    gpu_timing.last_ms[static_cast<size_t>(GpuPass::denoise)] =
+        compute_timestamps.to_milliseconds(timestamps[1], timestamps[2]);
+
+    // shows the GPU times next to the CPU zones in the trace
+    for (size_t i = 0; i < GPU_PASS_COUNT; i++)
+        Profiler::counter(GpuPassNames[i], gpu_timing.last_ms[i]);
+
+    for (size_t i = 0; i < GPU_PASS_COUNT; i++)
+    {
+        if (gpu_timing.frame == 0)
+            gpu_timing.average_ms[i] = gpu_timing.last_ms[i];
+        else
+            gpu_timing.average_ms[i] = 0.9 * gpu_timing.average_ms[i] + 0.1 * gpu_timing.last_ms[i];
+    }
+
+    if (gpu_timing.csv.is_open())
+    {
+        gpu_timing.csv << gpu_timing.frame << ',' << time.average_frame_time() * 1000.0;
+        for (double ms : gpu_timing.last_ms) gpu_timing.csv << ',' << ms;
+        gpu_timing.csv << '\n';
+    }
+    gpu_timing.frame++;
+    return true;
+}
+
+void RVPT::read_graphics_pass_times(uint32_t sync_index)
+{
+    // only called once the command fence of the sync resource was waited on, before its command
+    // buffer is recorded again and resets the queries
+    std::vector<uint64_t> timestamps;
+    if (graphics_timestamps.empty() || !graphics_timestamps[sync_index].get_timestamps(timestamps))
+        return;
+
+    // timestamp 0 is written before the graphics passes, the others after each of them
+    for (size_t pass = FIRST_GRAPHICS_PASS; pass < GPU_PASS_COUNT; pass++)
+    {
+        size_t query = pass - FIRST_GRAPHICS_PASS + 1;
+        gpu_timing.last_ms[pass] = graphics_timestamps[sync_index].to_milliseconds(
+            timestamps[query - 1], timestamps[query]);
+    }
+}
+
+bool RVPT::start_gpu_timing_log(std::string const& csv_file)
+{
+    gpu_timing.csv = std::ofstream(csv_file);
+    if (!gpu_timing.csv)
+    {
+        fmt::print(stderr, "Failed to open {} for writing\n", csv_file);
+        return false;
+    }
+    gpu_timing.csv << "frame,cpu_frame_ms";
+    for (auto name : GpuPassNames)
+    {
+        std::string column = name;
+        std::transform(column.begin(), column.end(), column.begin(),
+                       [](char c) { return c == ' ' ? '_' : static_cast<char>(std::tolower(c)); });
+        gpu_timing.csv << ',' << column << "_ms";
+    }
+    gpu_timing.csv << '\n';
+    return true;
+}
+
+void RVPT::stop_gpu_timing_log() { gpu_timing.csv.close(); }
+
+bool RVPT::traversal_stats_active() const
+{
+    return traversal_stats_enabled ||
+           render_settings.top_left_render_mode == TRAVERSAL_HEATMAP_MODE ||
+           render_settings.top_right_render_mode == TRAVERSAL_HEATMAP_MODE ||
+           render_settings.bottom_left_render_mode == TRAVERSAL_HEATMAP_MODE ||
+           render_settings.bottom_right_render_mode == TRAVERSAL_HEATMAP_MODE;
+}
+
+bool RVPT::wavefront_supported() const
+{
+    // wf_shade only implements the Whitted (7) and Kajiya (9) integrators
+    auto supported = [](int mode) { return mode == 7 || mode == 9; };
+    return supported(render_settings.top_left_render_mode) &&
+           supported(render_settings.top_right_render_mode) &&
+           supported(render_settings.bottom_left_render_mode) &&
+           supported(render_settings.bottom_right_render_mode);
+}
+
 // Private functions //
 bool RVPT::context_init()
 {
@@ -484,7 +1035,8 @@ bool RVPT::context_init()
 
     vkb::InstanceBuilder inst_builder;
     auto inst_ret =
-        inst_builder.set_app_name(window_ref.get_settings().title)
+        inst_builder.set_app_name(window_settings.title)
+            .set_headless(headless())
             .request_validation_layers(use_validation)
             .set_debug_callback([](VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
                                    VkDebugUtilsMessageTypeFlagsEXT messageType,
@@ -505,20 +1057,23 @@ bool RVPT::context_init()
 
     context.inst = inst_ret.value();
 
-    VkResult surf_res = glfwCreateWindowSurface(
-        context.inst.instance, window_ref.get_window_pointer(), nullptr, &context.surf);
-    if (surf_res != VK_SUCCESS)
+    if (!headless())
     {
-        fmt::print(stderr, "Failed to create a surface: Error Code{}\n", surf_res);
-        return false;
+        VkResult surf_res = glfwCreateWindowSurface(
+            context.inst.instance, window->get_window_pointer(), nullptr, &context.surf);
+        if (surf_res != VK_SUCCESS)
+        {
+            fmt::print(stderr, "Failed to create a surface: Error Code{}\n", surf_res);
+            return false;
+        }
     }
     VkPhysicalDeviceFeatures required_features{};
     required_features.samplerAnisotropy = true;
     required_features.fillModeNonSolid = true;
 
     vkb::PhysicalDeviceSelector selector(context.inst);
-    auto phys_ret = selector.set_surface(context.surf)
-                        .set_required_features(required_features)
+    if (!headless()) selector.set_surface(context.surf);
+    auto phys_ret = selector.set_required_features(required_features)
                         .set_minimum_version(1, 1)
                         .select();
 
@@ -548,14 +1103,17 @@ bool RVPT::context_init()
     }
     graphics_queue.emplace(vk_device, graphics_queue_index_ret.value(), "graphics_queue");
 
-    auto present_queue_index_ret = context.device.get_queue_index(vkb::QueueType::present);
-    if (!present_queue_index_ret)
+    if (!headless())
     {
-        fmt::print(stderr, "Failed to get the present queue: \n",
-                   present_queue_index_ret.error().message());
-        return false;
+        auto present_queue_index_ret = context.device.get_queue_index(vkb::QueueType::present);
+        if (!present_queue_index_ret)
+        {
+            fmt::print(stderr, "Failed to get the present queue: \n",
+                       present_queue_index_ret.error().message());
+            return false;
+        }
+        present_queue.emplace(vk_device, present_queue_index_ret.value(), "present_queue");
     }
-    present_queue.emplace(vk_device, present_queue_index_ret.value(), "present_queue");
 
     auto compute_queue_index_ret =
         context.device.get_dedicated_queue_index(vkb::QueueType::compute);
@@ -566,6 +1124,23 @@ bool RVPT::context_init()
 
     VK::setup_debug_util_helper(vk_device);
 
+    // timestamps are only usable if the queue doing the compute work supports them
+    VkPhysicalDeviceProperties physical_device_properties;
+    vkGetPhysicalDeviceProperties(context.device.physical_device.physical_device,
+                                  &physical_device_properties);
+    uint32_t queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(context.device.physical_device.physical_device,
+                                             &queue_family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(context.device.physical_device.physical_device,
+                                             &queue_family_count, queue_families.data());
+    int compute_family =
+        compute_queue.has_value() ? compute_queue->get_family() : graphics_queue->get_family();
+    if (queue_families[compute_family].timestampValidBits > 0)
+        timestamp_period = physical_device_properties.limits.timestampPeriod;
+    if (queue_families[graphics_queue->get_family()].timestampValidBits > 0)
+        graphics_timestamp_period = physical_device_properties.limits.timestampPeriod;
+
     return true;
 }
 
@@ -652,6 +1227,19 @@ RVPT::RenderingResources RVPT::create_rendering_resources()
         {5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
         {6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
         {7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {9, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {10, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {11, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {12, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {13, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {14, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {15, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {16, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {17, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {18, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {19, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {20, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
     };
 
     auto raytrace_descriptor_pool = VK::DescriptorPool(
@@ -668,10 +1256,17 @@ RVPT::RenderingResources RVPT::create_rendering_resources()
     fullscreen_details.render_pass = fullscreen_tri_render_pass;
     fullscreen_details.extent = vkb_swapchain.extent;
 
-    auto fullscreen_triangle_pipeline = pipeline_builder.create_pipeline(fullscreen_details);
+    VK::GraphicsPipelineHandle fullscreen_triangle_pipeline{};
+    if (!headless())
+        fullscreen_triangle_pipeline = pipeline_builder.create_pipeline(fullscreen_details);
 
-    auto raytrace_pipeline_layout = pipeline_builder.create_layout(
-        {raytrace_descriptor_pool.layout()}, {}, "raytrace_pipeline_layout");
+    // first workgroup, workgroups per row and first workgroup of the image of the tile range
+    // rendered by compute_pass.comp
+    std::vector<VkPushConstantRange> raytrace_push_constants = {
+        {VK_SHADER_STAGE_COMPUTE_BIT, 0, 4 * sizeof(uint32_t)}};
+    auto raytrace_pipeline_layout =
+        pipeline_builder.create_layout({raytrace_descriptor_pool.layout()},
+                                       raytrace_push_constants, "raytrace_pipeline_layout");
 
     VK::ComputePipelineDetails raytrace_details;
     raytrace_details.name = "raytrace_compute_pipeline";
@@ -680,6 +1275,17 @@ RVPT::RenderingResources RVPT::create_rendering_resources()
 
     auto raytrace_pipeline = pipeline_builder.create_pipeline(raytrace_details);
 
+    raytrace_details.name = "persistent_compute_pipeline";
+    raytrace_details.compute_shader = "persistent_pass.comp.spv";
+
+    auto persistent_pipeline = pipeline_builder.create_pipeline(raytrace_details);
+
+    // one step of the denoiser per dispatch, the push constants are the step and the step count
+    raytrace_details.name = "denoise_compute_pipeline";
+    raytrace_details.compute_shader = "denoise_pass.comp.spv";
+
+    auto denoise_pipeline = pipeline_builder.create_pipeline(raytrace_details);
+
     std::vector<VkDescriptorSetLayoutBinding> debug_layout_bindings = {
         {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr}};
 
@@ -712,9 +1318,14 @@ RVPT::RenderingResources RVPT::create_rendering_resources()
     debug_details.primitive_topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
     debug_details.enable_depth = true;
 
-    auto opaque = pipeline_builder.create_pipeline(debug_details);
-    debug_details.polygon_mode = VK_POLYGON_MODE_LINE;
-    auto wireframe = pipeline_builder.create_pipeline(debug_details);
+    VK::GraphicsPipelineHandle opaque{};
+    VK::GraphicsPipelineHandle wireframe{};
+    if (!headless())
+    {
+        opaque = pipeline_builder.create_pipeline(debug_details);
+        debug_details.polygon_mode = VK_POLYGON_MODE_LINE;
+        wireframe = pipeline_builder.create_pipeline(debug_details);
+    }
 
     /*
      * Start BVH Debug Setup
@@ -750,7 +1361,8 @@ RVPT::RenderingResources RVPT::create_rendering_resources()
     bvh_debug_details.cull_mode = VK_CULL_MODE_NONE;
     bvh_debug_details.enable_depth = true;
 
-    auto bvh_pipline = pipeline_builder.create_pipeline(bvh_debug_details);
+    VK::GraphicsPipelineHandle bvh_pipline{};
+    if (!headless()) bvh_pipline = pipeline_builder.create_pipeline(bvh_debug_details);
 
     /*
      * End BVH Debug Setup
@@ -758,24 +1370,46 @@ RVPT::RenderingResources RVPT::create_rendering_resources()
 
     auto temporal_storage_image = VK::Image(
         vk_device, memory_allocator, *graphics_queue, "temporal_storage_image",
-        VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, window_ref.get_settings().width,
-        window_ref.get_settings().height, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+        VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, window_settings.width,
+        window_settings.height,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
         VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_ASPECT_COLOR_BIT,
-        static_cast<VkDeviceSize>(window_ref.get_settings().width *
-                                  window_ref.get_settings().height * 4),
+        static_cast<VkDeviceSize>(window_settings.width *
+                                  window_settings.height * 4),
         VK::MemoryUsage::gpu);
 
+    // the features and the moments the path tracer writes for the denoiser and the two images
+    // its steps ping pong between (feature_albedo_image and the others in bindings.glsl)
+    auto create_denoise_image = [&](char const* name, VkFormat format, uint32_t texel_size) {
+        return VK::Image(vk_device, memory_allocator, *graphics_queue, name, format,
+                         VK_IMAGE_TILING_OPTIMAL, window_settings.width, window_settings.height,
+                         VK_IMAGE_USAGE_STORAGE_BIT, VK_IMAGE_LAYOUT_GENERAL,
+                         VK_IMAGE_ASPECT_COLOR_BIT,
+                         static_cast<VkDeviceSize>(window_settings.width *
+                                                   window_settings.height * texel_size),
+                         VK::MemoryUsage::gpu);
+    };
+    auto feature_albedo_image =
+        create_denoise_image("feature_albedo_image", VK_FORMAT_R8G8B8A8_UNORM, 4);
+    auto feature_normal_depth_image = create_denoise_image("feature_normal_depth_image",
+                                                           VK_FORMAT_R16G16B16A16_SFLOAT, 8);
+    auto moments_image = create_denoise_image("moments_image", VK_FORMAT_R16G16B16A16_SFLOAT, 8);
+    auto denoise_image_0 =
+        create_denoise_image("denoise_image_0", VK_FORMAT_R16G16B16A16_SFLOAT, 8);
+    auto denoise_image_1 =
+        create_denoise_image("denoise_image_1", VK_FORMAT_R16G16B16A16_SFLOAT, 8);
+
     VkFormat depth_format =
         VK::get_depth_image_format(context.device.physical_device.physical_device);
 
     auto depth_image =
         VK::Image(vk_device, memory_allocator, *graphics_queue, "depth_image", depth_format,
-                  VK_IMAGE_TILING_OPTIMAL, window_ref.get_settings().width,
-                  window_ref.get_settings().height, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                  VK_IMAGE_TILING_OPTIMAL, window_settings.width,
+                  window_settings.height, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
                   VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
                   VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT,
-                  static_cast<VkDeviceSize>(window_ref.get_settings().width *
-                                            window_ref.get_settings().height * 4),
+                  static_cast<VkDeviceSize>(window_settings.width *
+                                            window_settings.height * 4),
                   VK::MemoryUsage::gpu);
 
     return RVPT::RenderingResources{std::move(image_pool),
@@ -786,15 +1420,141 @@ RVPT::RenderingResources RVPT::create_rendering_resources()
                                     fullscreen_triangle_pipeline,
                                     raytrace_pipeline_layout,
                                     raytrace_pipeline,
+                                    persistent_pipeline,
+                                    denoise_pipeline,
                                     debug_pipeline_layout,
                                     opaque,
                                     wireframe,
                                     debug_bvh_pipeline_layout,
                                     bvh_pipline,
                                     std::move(temporal_storage_image),
+                                    std::move(feature_albedo_image),
+                                    std::move(feature_normal_depth_image),
+                                    std::move(moments_image),
+                                    std::move(denoise_image_0),
+                                    std::move(denoise_image_1),
                                     std::move(depth_image)};
 }
 
+RVPT::WavefrontResources RVPT::create_wavefront_resources()
+{
+    std::vector<VkDescriptorSetLayoutBinding> wavefront_layout_bindings = {
+        {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+    };
+
+    auto descriptor_pool = VK::DescriptorPool(vk_device, wavefront_layout_bindings, 1,
+                                              "wavefront_descriptor_pool");
+    auto descriptor_set = descriptor_pool.allocate("wavefront_descriptor_set");
+
+    std::vector<VkPushConstantRange> push_constants = {
+        {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(WavefrontPushConstants)}};
+    auto pipeline_layout = pipeline_builder.create_layout(
+        {rendering_resources->raytrace_descriptor_pool.layout(), descriptor_pool.layout()},
+        push_constants, "wavefront_pipeline_layout");
+
+    auto create_stage = [&](std::string const& name) {
+        VK::ComputePipelineDetails details;
+        details.name = name + "_pipeline";
+        details.pipeline_layout = pipeline_layout;
+        details.compute_shader = name + ".comp.spv";
+        return pipeline_builder.create_pipeline(details);
+    };
+
+    auto generate_pipeline = create_stage("wf_generate");
+    auto dispatch_pipeline = create_stage("wf_dispatch");
+    auto extend_pipeline = create_stage("wf_extend");
+    auto shade_pipeline = create_stage("wf_shade");
+    auto shadow_pipeline = create_stage("wf_shadow");
+    auto accumulate_pipeline = create_stage("wf_accumulate");
+    auto sort_keys_pipeline = create_stage("wf_sort_keys");
+    auto sort_scan_pipeline = create_stage("wf_sort_scan");
+    auto sort_scatter_pipeline = create_stage("wf_sort_scatter");
+
+    // one path per pixel is in flight at any time
+    VkDeviceSize pixel_count = static_cast<VkDeviceSize>(window_settings.width) *
+                               static_cast<VkDeviceSize>(window_settings.height);
+
+    auto counters = VK::Buffer(vk_device, memory_allocator, "wavefront_counters",
+                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                   VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                   VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                   VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                               sizeof(WavefrontCounters), VK::MemoryUsage::gpu);
+    // the ray queue is double buffered, shading reads one half and appends to the other
+    auto rays = VK::Buffer(vk_device, memory_allocator, "wavefront_rays",
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                           2 * pixel_count * sizeof(WavefrontRay), VK::MemoryUsage::gpu);
+    auto hits = VK::Buffer(vk_device, memory_allocator, "wavefront_hits",
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, pixel_count * sizeof(WavefrontHit),
+                           VK::MemoryUsage::gpu);
+    auto shadow_rays = VK::Buffer(vk_device, memory_allocator, "wavefront_shadow_rays",
+                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                  pixel_count * sizeof(WavefrontShadowRay), VK::MemoryUsage::gpu);
+    auto radiance = VK::Buffer(vk_device, memory_allocator, "wavefront_radiance",
+                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, pixel_count * sizeof(glm::vec4),
+                               VK::MemoryUsage::gpu);
+    // histogram and bin offsets of the counting sort
+    auto sort_bins = VK::Buffer(vk_device, memory_allocator, "wavefront_sort_bins",
+                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                2 * WAVEFRONT_SORT_BINS * sizeof(uint32_t), VK::MemoryUsage::gpu);
+    auto sort_keys = VK::Buffer(vk_device, memory_allocator, "wavefront_sort_keys",
+                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, pixel_count * sizeof(uint32_t),
+                                VK::MemoryUsage::gpu);
+    auto sort_index = VK::Buffer(vk_device, memory_allocator, "wavefront_sort_index",
+                                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, pixel_count * sizeof(uint32_t),
+                                 VK::MemoryUsage::gpu);
+
+    std::vector<VK::Buffer> readback;
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        readback.emplace_back(vk_device, memory_allocator,
+                              "wavefront_counters_readback_" + std::to_string(i),
+                              VK_BUFFER_USAGE_TRANSFER_DST_BIT, sizeof(WavefrontCounters),
+                              VK::MemoryUsage::cpu);
+        readback.back().copy_to(WavefrontCounters{});
+    }
+
+    std::vector<VK::DescriptorUseVector> wavefront_descriptors;
+    wavefront_descriptors.push_back(std::vector{counters.descriptor_info()});
+    wavefront_descriptors.push_back(std::vector{rays.descriptor_info()});
+    wavefront_descriptors.push_back(std::vector{hits.descriptor_info()});
+    wavefront_descriptors.push_back(std::vector{shadow_rays.descriptor_info()});
+    wavefront_descriptors.push_back(std::vector{radiance.descriptor_info()});
+    wavefront_descriptors.push_back(std::vector{sort_bins.descriptor_info()});
+    wavefront_descriptors.push_back(std::vector{sort_keys.descriptor_info()});
+    wavefront_descriptors.push_back(std::vector{sort_index.descriptor_info()});
+    descriptor_pool.update_descriptor_sets(descriptor_set, wavefront_descriptors);
+
+    return RVPT::WavefrontResources{std::move(descriptor_pool),
+                                    descriptor_set,
+                                    pipeline_layout,
+                                    generate_pipeline,
+                                    dispatch_pipeline,
+                                    extend_pipeline,
+                                    shade_pipeline,
+                                    shadow_pipeline,
+                                    accumulate_pipeline,
+                                    sort_keys_pipeline,
+                                    sort_scan_pipeline,
+                                    sort_scatter_pipeline,
+                                    std::move(counters),
+                                    std::move(rays),
+                                    std::move(hits),
+                                    std::move(shadow_rays),
+                                    std::move(radiance),
+                                    std::move(sort_bins),
+                                    std::move(sort_keys),
+                                    std::move(sort_index),
+                                    std::move(readback)};
+}
+
 void RVPT::add_per_frame_data(int index)
 {
     auto settings_uniform = VK::Buffer(
@@ -803,11 +1563,13 @@ void RVPT::add_per_frame_data(int index)
     auto output_image = VK::Image(vk_device, memory_allocator, *graphics_queue,
                                   "raytrace_output_image_" + std::to_string(index),
                                   VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
-                                  window_ref.get_settings().width, window_ref.get_settings().height,
-                                  VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+                                  window_settings.width, window_settings.height,
+                                  VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
+                                      VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                                      VK_IMAGE_USAGE_TRANSFER_DST_BIT,
                                   VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_ASPECT_COLOR_BIT,
-                                  static_cast<VkDeviceSize>(window_ref.get_settings().width *
-                                                            window_ref.get_settings().height * 4),
+                                  static_cast<VkDeviceSize>(window_settings.width *
+                                                            window_settings.height * 4),
                                   VK::MemoryUsage::gpu);
     auto random_buffer =
         VK::Buffer(vk_device, memory_allocator, "random_data_uniform_" + std::to_string(index),
@@ -821,22 +1583,41 @@ void RVPT::add_per_frame_data(int index)
                    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                    sizeof(decltype(temp_camera_data)::value_type) * temp_camera_data.size(),
                    VK::MemoryUsage::cpu_to_gpu);
-    auto bvh_buffer =
-        VK::Buffer(vk_device, memory_allocator, "bvh_buffer_" + std::to_string(index),
-                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(BvhNode) * top_level_bvh.nodes.size(),
-                   VK::MemoryUsage::cpu_to_gpu);
-    auto triangle_buffer =
-        VK::Buffer(vk_device, memory_allocator, "triangles_buffer_" + std::to_string(index),
-                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(Triangle) * triangles.size(),
-                   VK::MemoryUsage::cpu_to_gpu);
-    auto material_buffer =
-        VK::Buffer(vk_device, memory_allocator, "materials_buffer_" + std::to_string(index),
-                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(Material) * materials.size(),
-                   VK::MemoryUsage::cpu_to_gpu);
+    // an empty scene, replaced by update_scene_buffers once the first scene is uploaded
+    auto bvh_buffer = create_scene_buffer("bvh_buffer_", index, sizeof(BvhNode));
+    auto vertex_buffer = create_scene_buffer("vertex_buffer_", index, sizeof(glm::vec4));
+    auto index_buffer = create_scene_buffer("index_buffer_", index, 3 * sizeof(uint32_t));
+    auto triangle_material_buffer =
+        create_scene_buffer("triangle_material_buffer_", index, sizeof(uint32_t));
+    auto page_table_buffer = create_scene_buffer("page_table_buffer_", index, 2 * sizeof(uint32_t));
+    auto page_feedback_buffer = create_page_feedback_buffer(index, 1);
+    auto material_buffer = create_scene_buffer("materials_buffer_", index, sizeof(Material));
+    auto light_buffer = create_scene_buffer("light_buffer_", index,
+                                            sizeof(LightBufferHeader) + sizeof(LightTriangle));
+    light_buffer.copy_to(LightBufferHeader{});
+    auto light_node_buffer = create_scene_buffer("light_node_buffer_", index, sizeof(LightNode));
+    // a leaf holding a degenerate triangle, as build_scene_bvh makes of an empty scene
+    bvh_buffer.copy_to(BvhNode{0, 1, {}});
+    vertex_buffer.copy_to(glm::vec4(0));
+    index_buffer.copy_to(std::array<uint32_t, 3>{});
+    triangle_material_buffer.copy_to(uint32_t{0});
+    // one triangle, its page in slot 0
+    page_table_buffer.copy_to(std::array<uint32_t, 2>{1, 0});
+    auto work_counter_buffer =
+        VK::Buffer(vk_device, memory_allocator, "work_counter_buffer_" + std::to_string(index),
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   sizeof(uint32_t), VK::MemoryUsage::gpu);
+    auto traversal_buffer =
+        VK::Buffer(vk_device, memory_allocator, "traversal_buffer_" + std::to_string(index),
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   sizeof(TraversalTotals), VK::MemoryUsage::gpu_to_cpu);
     auto raytrace_command_buffer =
         VK::CommandBuffer(vk_device, compute_queue.has_value() ? *compute_queue : *graphics_queue,
                           "raytrace_command_buffer_" + std::to_string(index));
     auto raytrace_work_fence = VK::Fence(vk_device, "raytrace_work_fence_" + std::to_string(index));
+    // before the path tracer, after it and after the denoiser
+    auto compute_timestamps = VK::TimestampQueryPool(
+        vk_device, 3, timestamp_period, "compute_timestamps_" + std::to_string(index));
 
     // descriptor sets
     auto image_descriptor_set = rendering_resources->image_pool.allocate(
@@ -851,20 +1632,6 @@ void RVPT::add_per_frame_data(int index)
     image_descriptors.push_back(std::vector{output_image.descriptor_info()});
     rendering_resources->image_pool.update_descriptor_sets(image_descriptor_set, image_descriptors);
 
-    std::vector<VK::DescriptorUseVector> raytracing_descriptors;
-    raytracing_descriptors.push_back(std::vector{settings_uniform.descriptor_info()});
-    raytracing_descriptors.push_back(std::vector{output_image.descriptor_info()});
-    raytracing_descriptors.push_back(
-        std::vector{rendering_resources->temporal_storage_image.descriptor_info()});
-    raytracing_descriptors.push_back(std::vector{random_buffer.descriptor_info()});
-    raytracing_descriptors.push_back(std::vector{camera_uniform.descriptor_info()});
-    raytracing_descriptors.push_back(std::vector{bvh_buffer.descriptor_info()});
-    raytracing_descriptors.push_back(std::vector{triangle_buffer.descriptor_info()});
-    raytracing_descriptors.push_back(std::vector{material_buffer.descriptor_info()});
-
-    rendering_resources->raytrace_descriptor_pool.update_descriptor_sets(raytracing_descriptor_set,
-                                                                         raytracing_descriptors);
-
     // Debug vis
     auto debug_camera_uniform = VK::Buffer(
         vk_device, memory_allocator, "debug_camera_uniform_" + std::to_string(index),
@@ -900,16 +1667,206 @@ void RVPT::add_per_frame_data(int index)
 
     per_frame_data.push_back(RVPT::PerFrameData{
         std::move(settings_uniform), std::move(output_image), std::move(random_buffer),
-        std::move(camera_uniform), std::move(bvh_buffer),
-        std::move(triangle_buffer), std::move(material_buffer), std::move(raytrace_command_buffer),
-        std::move(raytrace_work_fence), image_descriptor_set, raytracing_descriptor_set,
+        std::move(camera_uniform),
+        SceneBuffers{std::move(bvh_buffer), std::move(vertex_buffer), std::move(index_buffer),
+                     std::move(triangle_material_buffer), std::move(page_table_buffer),
+                     std::move(page_feedback_buffer), std::move(material_buffer),
+                     std::move(light_buffer), std::move(light_node_buffer), PageCache{}},
+        std::move(work_counter_buffer),
+        std::move(traversal_buffer), std::move(raytrace_command_buffer),
+        std::move(raytrace_work_fence), std::move(compute_timestamps), image_descriptor_set,
+        raytracing_descriptor_set,
         std::move(debug_camera_uniform), std::move(debug_vertex_buffer), debug_descriptor_set,
         std::move(debug_bvh_camera_uniform), std::move(debug_bvh_vertex_buffer),
         debug_bvh_descriptor_set});
+    write_raytracing_descriptors(per_frame_data.back());
+}
+
+void RVPT::write_raytracing_descriptors(PerFrameData& frame)
+{
+    std::vector<VK::DescriptorUseVector> raytracing_descriptors;
+    raytracing_descriptors.push_back(std::vector{frame.settings_uniform.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.output_image.descriptor_info()});
+    raytracing_descriptors.push_back(
+        std::vector{rendering_resources->temporal_storage_image.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.random_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.camera_uniform.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.scene.bvh_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.scene.vertex_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.scene.material_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.work_counter_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.traversal_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.scene.index_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(
+        std::vector{frame.scene.triangle_material_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.scene.page_table_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(
+        std::vector{frame.scene.page_feedback_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.scene.light_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.scene.light_node_buffer.descriptor_info()});
+    auto& resources = *rendering_resources;
+    raytracing_descriptors.push_back(std::vector{resources.feature_albedo_image.descriptor_info()});
+    raytracing_descriptors.push_back(
+        std::vector{resources.feature_normal_depth_image.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{resources.moments_image.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{resources.denoise_image_0.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{resources.denoise_image_1.descriptor_info()});
+
+    rendering_resources->raytrace_descriptor_pool.update_descriptor_sets(
+        frame.raytracing_descriptor_sets, raytracing_descriptors);
+}
+
+VK::Buffer RVPT::create_scene_buffer(std::string const& name, int index, size_t size)
+{
+    return VK::Buffer(vk_device, memory_allocator, name + std::to_string(index),
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, size, VK::MemoryUsage::cpu_to_gpu);
+}
+
+VK::Buffer RVPT::create_page_feedback_buffer(int index, size_t page_count)
+{
+    return VK::Buffer(vk_device, memory_allocator, "page_feedback_buffer_" + std::to_string(index),
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                      sizeof(uint32_t) * page_count, VK::MemoryUsage::gpu_to_cpu);
+}
+
+RVPT::SceneUpload RVPT::begin_scene_upload(int index)
+{
+    Profiler::Zone zone("create scene buffers");
+    // the page pool holds every page unless the geometry budget is smaller than the scene
+    size_t page_count = geometry_pages.page_count();
+    size_t slot_count = page_count;
+    if (geometry_budget != 0)
+        slot_count = std::clamp<size_t>(geometry_budget / geometry_pages.slot_bytes(), 1,
+                                         page_count);
+    PageCache page_cache(page_count, slot_count);
+    // without a budget every page is loaded before the scene is shown, otherwise they are
+    // streamed in as the frames request them
+    std::vector<uint32_t> requests(page_count, slot_count == page_count ? 1 : 0);
+    auto pages = page_cache.update(requests, slot_count);
+
+    SceneBuffers buffers{
+        create_scene_buffer("bvh_buffer_", index, sizeof(BvhNode) * top_level_bvh.nodes.size()),
+        create_scene_buffer("vertex_buffer_", index,
+                            sizeof(glm::vec4) * geometry_pages.slot_vertices * slot_count),
+        create_scene_buffer("index_buffer_", index,
+                            3 * sizeof(uint32_t) * GEOMETRY_PAGE_TRIANGLES * slot_count),
+        create_scene_buffer("triangle_material_buffer_", index,
+                            sizeof(uint32_t) * GEOMETRY_PAGE_TRIANGLES * slot_count),
+        create_scene_buffer("page_table_buffer_", index, sizeof(uint32_t) * (page_count + 1)),
+        create_page_feedback_buffer(index, page_count),
+        // a scene without materials still needs a buffer to bind
+        create_scene_buffer("materials_buffer_", index,
+                            sizeof(Material) * std::max<size_t>(materials.size(), 1)),
+        // the header and at least one light
+        create_scene_buffer("light_buffer_", index,
+                            sizeof(LightBufferHeader) +
+                                sizeof(LightTriangle) *
+                                    std::max<size_t>(light_list.lights.size(), 1)),
+        create_scene_buffer("light_node_buffer_", index,
+                            sizeof(LightNode) * std::max<size_t>(light_list.nodes.size(), 1)),
+        std::move(page_cache)};
+    buffers.light_buffer.copy_to(LightBufferHeader{
+        static_cast<uint32_t>(light_list.lights.size()), light_list.total_power, {}});
+    return SceneUpload{scene_version, std::move(buffers), std::move(pages)};
+}
+
+void RVPT::update_scene_buffers(PerFrameData& frame, int index)
+{
+    Profiler::Zone zone("update scene buffers");
+    // a scene which changed again before its upload was complete starts over
+    if (!frame.scene_upload || frame.scene_upload->scene_version != scene_version)
+        frame.scene_upload = begin_scene_upload(index);
+    auto& upload = *frame.scene_upload;
+
+    // copying the whole scene at once would stall the frame for as long as the copy takes
+    size_t budget = SCENE_UPLOAD_BYTES_PER_FRAME;
+    budget -= copy_part(upload.buffers.bvh_buffer, top_level_bvh.nodes, upload.bvh_nodes_copied,
+                        budget);
+    budget -= copy_part(upload.buffers.light_buffer, light_list.lights, upload.lights_copied,
+                        budget, sizeof(LightBufferHeader));
+    budget -= copy_part(upload.buffers.light_node_buffer, light_list.nodes,
+                        upload.light_nodes_copied, budget);
+    size_t page_count = std::min(budget / geometry_pages.slot_bytes(), upload.pages.size());
+    if (page_count > 0)
+    {
+        std::vector<PageCache::Upload> pages(upload.pages.end() - page_count, upload.pages.end());
+        upload.pages.resize(upload.pages.size() - page_count);
+        upload_pages(upload.buffers, pages);
+    }
+    if (upload.bvh_nodes_copied < top_level_bvh.nodes.size() ||
+        upload.lights_copied < light_list.lights.size() ||
+        upload.light_nodes_copied < light_list.nodes.size() || !upload.pages.empty())
+        return;
+
+    // writes the page table, also when every page is streamed in later
+    upload_pages(upload.buffers, {});
+    // the frame isn't in flight, its buffers of the old scene can go
+    frame.scene = std::move(upload.buffers);
+    frame.scene_upload.reset();
+    frame.page_feedback_recorded = false;
+    frame.scene_version = scene_version;
+    write_raytracing_descriptors(frame);
+
+    // the accumulation so far holds the old scene
+    render_settings.current_frame = 0;
+    tiled_rendering.next_group = 0;
+}
+
+void RVPT::upload_pages(SceneBuffers& scene, std::vector<PageCache::Upload> const& uploads)
+{
+    auto const& pages = geometry_pages;
+    std::vector<uint32_t> indices;
+    for (auto const& upload : uploads)
+    {
+        auto const& page = pages.pages[upload.page];
+        size_t first_triangle = size_t{upload.page} * GEOMETRY_PAGE_TRIANGLES;
+        size_t triangle_count = pages.page_triangles(upload.page);
+        size_t first_slot_triangle = size_t{upload.slot} * GEOMETRY_PAGE_TRIANGLES;
+        auto first_slot_vertex = upload.slot * pages.slot_vertices;
+
+        scene.vertex_buffer.copy_range_to(pages.vertices.data() + page.first_vertex,
+                                          page.vertex_count,
+                                          sizeof(glm::vec4) * first_slot_vertex);
+        // the indices in the pool point straight at the vertices of the slot
+        indices.assign(pages.indices.begin() + 3 * first_triangle,
+                       pages.indices.begin() + 3 * (first_triangle + triangle_count));
+        for (auto& vertex_index : indices) vertex_index += first_slot_vertex;
+        scene.index_buffer.copy_range_to(indices.data(), indices.size(),
+                                         3 * sizeof(uint32_t) * first_slot_triangle);
+        scene.triangle_material_buffer.copy_range_to(pages.materials.data() + first_triangle,
+                                                     triangle_count,
+                                                     sizeof(uint32_t) * first_slot_triangle);
+    }
+
+    std::vector<uint32_t> page_table;
+    page_table.reserve(pages.page_count() + 1);
+    page_table.push_back(static_cast<uint32_t>(pages.triangle_count));
+    page_table.insert(page_table.end(), scene.page_cache.page_slots().begin(),
+                      scene.page_cache.page_slots().end());
+    scene.page_table_buffer.copy_to(page_table);
+}
+
+void RVPT::stream_geometry_pages(PerFrameData& frame)
+{
+    // the pages of an old scene which is still shown while the new one uploads aren't around
+    if (!frame.page_feedback_recorded || frame.scene_version != scene_version) return;
+    Profiler::Zone zone("stream geometry pages");
+
+    std::vector<uint32_t> requests(geometry_pages.page_count());
+    frame.scene.page_feedback_buffer.copy_from(requests);
+    auto uploads = frame.scene.page_cache.update(requests, MAX_PAGE_UPLOADS_PER_FRAME);
+    if (uploads.empty()) return;
+    upload_pages(frame.scene, uploads);
+
+    // the pixels which were deferred on these pages kept their old value, so the accumulation
+    // restarts with the pages in place
+    render_settings.current_frame = 0;
+    tiled_rendering.next_group = 0;
 }
 
 void RVPT::record_command_buffer(VK::SyncResources& current_frame, uint32_t swapchain_image_index)
 {
+    Profiler::Zone zone("record graphics commands");
     current_frame.command_buffer.begin();
     VkCommandBuffer cmd_buf = current_frame.command_buffer.get();
 
@@ -921,13 +1878,31 @@ void RVPT::record_command_buffer(VK::SyncResources& current_frame, uint32_t swap
     imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
     imageMemoryBarrier.image = per_frame_data[current_frame_index].output_image.image.handle;
     imageMemoryBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-    imageMemoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    imageMemoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
     imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+    vkCmdPipelineBarrier(cmd_buf,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
                          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK::FLAGS_NONE, 0, nullptr, 0,
                          nullptr, 1, &imageMemoryBarrier);
 
+    // queries can only be reset outside of the render pass, the passes inside are timed between
+    // the end of the previous commands and the end of their own
+    VK::TimestampQueryPool* timestamps =
+        graphics_timestamps.empty() ? nullptr : &graphics_timestamps[current_sync_index];
+    auto write_timestamp = [&](GpuPass pass) {
+        if (timestamps)
+            timestamps->write(cmd_buf,
+                              static_cast<uint32_t>(static_cast<size_t>(pass) -
+                                                    FIRST_GRAPHICS_PASS + 1),
+                              VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    };
+    if (timestamps)
+    {
+        timestamps->reset(cmd_buf);
+        timestamps->write(cmd_buf, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    }
+
     VkRenderPassBeginInfo rp_begin_info{};
     rp_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     rp_begin_info.renderPass = fullscreen_tri_render_pass;
@@ -962,6 +1937,7 @@ void RVPT::record_command_buffer(VK::SyncResources& current_frame, uint32_t swap
                             &per_frame_data[current_frame_index].image_descriptor_set.set, 0,
                             nullptr);
     vkCmdDraw(cmd_buf, 3, 1, 0, 0);
+    write_timestamp(GpuPass::fullscreen_copy);
 
     if (debug_overlay_enabled)
     {
@@ -978,6 +1954,7 @@ void RVPT::record_command_buffer(VK::SyncResources& current_frame, uint32_t swap
 
         vkCmdDraw(cmd_buf, (uint32_t)triangles.size() * 3, 1, 0, 0);
     }
+    write_timestamp(GpuPass::debug_raster);
 
     if (debug_bvh_enabled)
     {
@@ -992,11 +1969,13 @@ void RVPT::record_command_buffer(VK::SyncResources& current_frame, uint32_t swap
 
         vkCmdDraw(cmd_buf, (uint32_t)bvh_vertex_count, 1, 0, 0);
     }
+    write_timestamp(GpuPass::debug_bvh);
 
     if (show_imgui)
     {
         imgui_impl->draw(cmd_buf, current_frame_index);
     }
+    write_timestamp(GpuPass::imgui);
 
     vkCmdEndRenderPass(cmd_buf);
     current_frame.command_buffer.end();
@@ -1022,25 +2001,524 @@ void RVPT::record_compute_command_buffer()
     in_temporal_image_barrier.dstQueueFamilyIndex = queue_family;
     in_temporal_image_barrier.srcQueueFamilyIndex = queue_family;
 
-    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+    // the tiled mode copies the temporal image at the end of the previous frame
+    vkCmdPipelineBarrier(cmd_buf,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
                          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK::FLAGS_NONE, 0, nullptr, 0,
                          nullptr, 1, &in_temporal_image_barrier);
 
-    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
-                      pipeline_builder.get_pipeline(rendering_resources->raytrace_pipeline));
-    vkCmdBindDescriptorSets(
-        cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, rendering_resources->raytrace_pipeline_layout, 0,
-        1, &per_frame_data[current_frame_index].raytracing_descriptor_sets.set, 0, 0);
+    auto& timestamps = per_frame_data[current_frame_index].compute_timestamps;
+    if (timestamp_period > 0.0f)
+    {
+        timestamps.reset(cmd_buf);
+        timestamps.write(cmd_buf, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    }
+
+    tiled_rendering.groups_in_flight[current_frame_index] = 0;
+    bool wavefront = wavefront_enabled && wavefront_supported();
+
+    // the wavefront stages don't count their traversal work
+    auto& frame = per_frame_data[current_frame_index];
+    frame.traversal_stats_recorded = traversal_stats_active() && !wavefront;
+    if (frame.traversal_stats_recorded)
+        vkCmdFillBuffer(cmd_buf, frame.traversal_buffer.get(), 0, VK_WHOLE_SIZE, 0);
+    // while streaming the shaders flag the geometry pages they touch, read by
+    // stream_geometry_pages
+    frame.page_feedback_recorded = frame.scene.page_cache.streaming();
+    if (frame.page_feedback_recorded)
+        vkCmdFillBuffer(cmd_buf, frame.scene.page_feedback_buffer.get(), 0, VK_WHOLE_SIZE, 0);
+    VK::compute_memory_barrier(cmd_buf);
+
+    if (wavefront)
+        record_wavefront_commands(cmd_buf);
+    else
+        record_megakernel_commands(cmd_buf);
 
-    vkCmdDispatch(cmd_buf, per_frame_data[current_frame_index].output_image.width / 16,
-                  per_frame_data[current_frame_index].output_image.height / 16, 1);
+    if (timestamp_period > 0.0f)
+        timestamps.write(cmd_buf, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    if (render_settings.denoise != 0) record_denoise_commands(cmd_buf);
+
+    // the traversal counters and the page feedback are read on the host after the fence
+    VkMemoryBarrier host_barrier{};
+    host_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    host_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         VK::FLAGS_NONE, 1, &host_barrier, 0, nullptr, 0, nullptr);
+
+    if (timestamp_period > 0.0f)
+        timestamps.write(cmd_buf, 2, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
 
     command_buffer.end();
 }
 
+void RVPT::record_denoise_commands(VkCommandBuffer cmd_buf)
+{
+    auto& frame = per_frame_data[current_frame_index];
+
+    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      pipeline_builder.get_pipeline(rendering_resources->denoise_pipeline));
+    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            rendering_resources->raytrace_pipeline_layout, 0, 1,
+                            &frame.raytracing_descriptor_sets.set, 0, 0);
+
+    // the variance estimate, then the wavelet steps with their holes doubling every time; the
+    // last step writes the output image over what the path tracer put there
+    uint32_t groups_x = (frame.output_image.width + 15) / 16;
+    uint32_t groups_y = (frame.output_image.height + 15) / 16;
+    uint32_t step_count = 1 + static_cast<uint32_t>(std::max(denoise_iterations, 1));
+    for (uint32_t step = 0; step < step_count; step++)
+    {
+        VK::compute_memory_barrier(cmd_buf);
+        std::array<uint32_t, 4> denoise_step = {step, step_count, 0, 0};
+        vkCmdPushConstants(cmd_buf, rendering_resources->raytrace_pipeline_layout,
+                           VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(denoise_step),
+                           denoise_step.data());
+        vkCmdDispatch(cmd_buf, groups_x, groups_y, 1);
+    }
+}
+
+VkPipeline RVPT::get_megakernel_pipeline(VK::ComputePipelineHandle const& handle, int integrator)
+{
+    bool traversal_stats = traversal_stats_active();
+    bool paging = per_frame_data[current_frame_index].scene.page_cache.streaming();
+    if (!specialized_pipelines_enabled && !traversal_stats && !paging)
+        return pipeline_builder.get_pipeline(handle);
+
+    // constant_id 0: integrator, 1: camera mode, -1 selects at runtime, 2: traversal counters,
+    // 3: geometry paging
+    std::vector<int32_t> constants = {-1, -1, traversal_stats ? 1 : 0, paging ? 1 : 0};
+    if (specialized_pipelines_enabled)
+    {
+        constants[0] = integrator;
+        constants[1] = render_settings.camera_mode;
+    }
+    auto specialized = pipeline_builder.get_specialized_pipeline(handle, constants);
+    return pipeline_builder.get_pipeline(specialized);
+}
+
+void RVPT::record_megakernel_commands(VkCommandBuffer cmd_buf)
+{
+    auto& frame = per_frame_data[current_frame_index];
+
+    std::array<int, 4> region_modes = {
+        render_settings.top_left_render_mode, render_settings.top_right_render_mode,
+        render_settings.bottom_left_render_mode, render_settings.bottom_right_render_mode};
+    bool single_mode = std::all_of(region_modes.begin(), region_modes.end(),
+                                   [&](int mode) { return mode == region_modes[0]; });
+
+    if (persistent_threads_enabled)
+    {
+        vkCmdFillBuffer(cmd_buf, frame.work_counter_buffer.get(), 0, VK_WHOLE_SIZE, 0);
+        VK::compute_memory_barrier(cmd_buf);
+
+        // the work counter is shared by the whole image, so split screen can only specialize
+        // the camera
+        vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          get_megakernel_pipeline(rendering_resources->persistent_pipeline,
+                                                  single_mode ? region_modes[0] : -1));
+        vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                rendering_resources->raytrace_pipeline_layout, 0, 1,
+                                &frame.raytracing_descriptor_sets.set, 0, 0);
+
+        // no point in more groups than 8x8 tiles, they would exit right away
+        uint32_t tile_count =
+            ((frame.output_image.width + 7) / 8) * ((frame.output_image.height + 7) / 8);
+        vkCmdDispatch(cmd_buf,
+                      std::min(static_cast<uint32_t>(persistent_group_count), tile_count), 1, 1);
+        return;
+    }
+
+    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            rendering_resources->raytrace_pipeline_layout, 0, 1,
+                            &frame.raytracing_descriptor_sets.set, 0, 0);
+
+    // round up, the shader discards the invocations outside of the image
+    uint32_t groups_x = (frame.output_image.width + 15) / 16;
+    uint32_t groups_y = (frame.output_image.height + 15) / 16;
+    uint32_t group_total = groups_x * groups_y;
+
+    // workgroup rectangles [min, max) covering the split screen regions of every integrator,
+    // workgroups on a split belong to both sides and the shader picks the pixels of its
+    // integrator. Regions sharing an integrator are merged so no pixel is rendered twice.
+    struct Region
+    {
+        int integrator;
+        glm::uvec2 group_min;
+        glm::uvec2 group_max;
+    };
+    std::vector<Region> regions;
+    if (!specialized_pipelines_enabled || single_mode)
+    {
+        regions.push_back({single_mode ? region_modes[0] : -1, {0, 0}, {groups_x, groups_y}});
+    }
+    else
+    {
+        glm::uvec2 split = glm::uvec2(glm::clamp(render_settings.split_ratio, 0.f, 1.f) *
+                                      glm::vec2(frame.output_image.width,
+                                                frame.output_image.height)) /
+                           16u;
+        glm::uvec2 first_end = glm::min(split + 1u, glm::uvec2(groups_x, groups_y));
+        glm::uvec2 second_begin = glm::min(split, glm::uvec2(groups_x, groups_y));
+
+        std::array<Region, 4> split_regions = {
+            Region{region_modes[0], {0, 0}, first_end},
+            Region{region_modes[1], {second_begin.x, 0}, {groups_x, first_end.y}},
+            Region{region_modes[2], {0, second_begin.y}, {first_end.x, groups_y}},
+            Region{region_modes[3], second_begin, {groups_x, groups_y}}};
+        for (auto& split_region : split_regions)
+        {
+            if (glm::any(glm::equal(split_region.group_min, split_region.group_max))) continue;
+
+            auto merged = std::find_if(regions.begin(), regions.end(), [&](Region const& r) {
+                return r.integrator == split_region.integrator;
+            });
+            if (merged == regions.end())
+            {
+                regions.push_back(split_region);
+                continue;
+            }
+            merged->group_min = glm::min(merged->group_min, split_region.group_min);
+            merged->group_max = glm::max(merged->group_max, split_region.group_max);
+        }
+    }
+
+    uint32_t first_group = 0;
+    uint32_t group_count = group_total;
+    if (tiled_rendering_active())
+    {
+        first_group = std::min(tiled_rendering.next_group, group_total - 1);
+        group_count = std::min(tiled_rendering.groups_per_frame, group_total - first_group);
+        tiled_rendering.next_group = (first_group + group_count) % group_total;
+    }
+    tiled_rendering.groups_in_flight[current_frame_index] = group_count;
+
+    for (auto& region : regions)
+    {
+        glm::uvec2 region_groups = region.group_max - region.group_min;
+
+        // the tile range is over the whole image, every region renders its part of it
+        std::array<uint32_t, 4> tile_range = {first_group, groups_x, 0, 0};
+        uint32_t region_group_count = group_count;
+        if (!tiled_rendering_active())
+        {
+            tile_range = {0, region_groups.x, region.group_min.x, region.group_min.y};
+            region_group_count = region_groups.x * region_groups.y;
+        }
+
+        vkCmdBindPipeline(
+            cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+            get_megakernel_pipeline(rendering_resources->raytrace_pipeline, region.integrator));
+        vkCmdPushConstants(cmd_buf, rendering_resources->raytrace_pipeline_layout,
+                           VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(tile_range), tile_range.data());
+        vkCmdDispatch(cmd_buf, region_group_count, 1, 1);
+    }
+
+    if (tiled_rendering_active())
+    {
+        // the output image of this frame only has the tiles rendered into it, the temporal
+        // image has all of them
+        VK::compute_memory_barrier(cmd_buf);
+
+        VkImageCopy region{};
+        region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.extent = {frame.output_image.width, frame.output_image.height, 1};
+        vkCmdCopyImage(cmd_buf, rendering_resources->temporal_storage_image.image.handle,
+                       VK_IMAGE_LAYOUT_GENERAL, frame.output_image.image.handle,
+                       VK_IMAGE_LAYOUT_GENERAL, 1, &region);
+    }
+}
+
+void RVPT::record_wavefront_commands(VkCommandBuffer cmd_buf)
+{
+    auto& wavefront = *wavefront_resources;
+    auto& output_image = per_frame_data[current_frame_index].output_image;
+
+    std::array<VkDescriptorSet, 2> descriptor_sets = {
+        per_frame_data[current_frame_index].raytracing_descriptor_sets.set,
+        wavefront.descriptor_set.set};
+    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, wavefront.pipeline_layout, 0,
+                            static_cast<uint32_t>(descriptor_sets.size()), descriptor_sets.data(),
+                            0, nullptr);
+
+    uint32_t sort_flags = (wavefront_sort_rays ? WAVEFRONT_SORT_RAYS : 0) |
+                          (wavefront_sort_hits ? WAVEFRONT_SORT_HITS : 0);
+
+    // the stages only request geometry pages when they are streamed (constant_id 3)
+    bool paging = per_frame_data[current_frame_index].scene.page_cache.streaming();
+    auto bind_stage = [&](VK::ComputePipelineHandle const& handle, uint32_t queue,
+                          uint32_t sample_index, uint32_t sort_key = WAVEFRONT_KEY_RAY) {
+        auto pipeline = paging ? pipeline_builder.get_specialized_pipeline(handle, {-1, -1, 0, 1})
+                               : handle;
+        vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipeline_builder.get_pipeline(pipeline));
+        WavefrontPushConstants push_constants{queue, sample_index, sort_flags, sort_key};
+        vkCmdPushConstants(cmd_buf, wavefront.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                           sizeof(WavefrontPushConstants), &push_constants);
+    };
+    // freezes the queue sizes into the indirect arguments
+    auto dispatch_args = [&](uint32_t queue, uint32_t sample_index) {
+        bind_stage(wavefront.dispatch_pipeline, queue, sample_index);
+        vkCmdDispatch(cmd_buf, 1, 1, 1);
+        VK::compute_memory_barrier(cmd_buf);
+    };
+    // counting sort of the ray queue, the permutation ends up in sort_index
+    auto sort_queue = [&](uint32_t queue, uint32_t sample_index, uint32_t sort_key) {
+        bind_stage(wavefront.sort_keys_pipeline, queue, sample_index, sort_key);
+        vkCmdDispatchIndirect(cmd_buf, wavefront.counters.get(), WAVEFRONT_RAY_DISPATCH_OFFSET);
+        VK::compute_memory_barrier(cmd_buf);
+        bind_stage(wavefront.sort_scan_pipeline, queue, sample_index, sort_key);
+        vkCmdDispatch(cmd_buf, 1, 1, 1);
+        VK::compute_memory_barrier(cmd_buf);
+        bind_stage(wavefront.sort_scatter_pipeline, queue, sample_index, sort_key);
+        vkCmdDispatchIndirect(cmd_buf, wavefront.counters.get(), WAVEFRONT_RAY_DISPATCH_OFFSET);
+        VK::compute_memory_barrier(cmd_buf);
+    };
+
+    // the previous frame may still be using the queues
+    VK::compute_memory_barrier(cmd_buf);
+    vkCmdFillBuffer(cmd_buf, wavefront.counters.get(), 0, VK_WHOLE_SIZE, 0);
+    vkCmdFillBuffer(cmd_buf, wavefront.sort_bins.get(), 0, VK_WHOLE_SIZE, 0);
+    VK::compute_memory_barrier(cmd_buf);
+
+    uint32_t group_count_x = (output_image.width + 15) / 16;
+    uint32_t group_count_y = (output_image.height + 15) / 16;
+
+    for (uint32_t sample = 0; sample < static_cast<uint32_t>(render_settings.aa); sample++)
+    {
+        uint32_t queue = 0;
+        bind_stage(wavefront.generate_pipeline, queue, sample);
+        vkCmdDispatch(cmd_buf, group_count_x, group_count_y, 1);
+        VK::compute_memory_barrier(cmd_buf);
+
+        for (int bounce = 0; bounce < render_settings.max_bounces; bounce++)
+        {
+            dispatch_args(queue, sample);
+
+            // shadow rays queued by the previous bounce, independent of the extend stage
+            bind_stage(wavefront.shadow_pipeline, queue, sample);
+            vkCmdDispatchIndirect(cmd_buf, wavefront.counters.get(),
+                                  WAVEFRONT_SHADOW_DISPATCH_OFFSET);
+            if (wavefront_sort_rays) sort_queue(queue, sample, WAVEFRONT_KEY_RAY);
+            bind_stage(wavefront.extend_pipeline, queue, sample);
+            vkCmdDispatchIndirect(cmd_buf, wavefront.counters.get(),
+                                  WAVEFRONT_RAY_DISPATCH_OFFSET);
+            VK::compute_memory_barrier(cmd_buf);
+
+            if (wavefront_sort_hits) sort_queue(queue, sample, WAVEFRONT_KEY_HIT);
+            bind_stage(wavefront.shade_pipeline, queue, sample);
+            vkCmdDispatchIndirect(cmd_buf, wavefront.counters.get(),
+                                  WAVEFRONT_RAY_DISPATCH_OFFSET);
+            VK::compute_memory_barrier(cmd_buf);
+
+            queue = 1 - queue;
+        }
+
+        // shadow rays of the last bounce
+        dispatch_args(queue, sample);
+        bind_stage(wavefront.shadow_pipeline, queue, sample);
+        vkCmdDispatchIndirect(cmd_buf, wavefront.counters.get(), WAVEFRONT_SHADOW_DISPATCH_OFFSET);
+        VK::compute_memory_barrier(cmd_buf);
+    }
+
+    bind_stage(wavefront.accumulate_pipeline, 0, 0);
+    vkCmdDispatch(cmd_buf, group_count_x, group_count_y, 1);
+    VK::compute_memory_barrier(cmd_buf);
+
+    VkBufferCopy counters_copy{0, 0, sizeof(WavefrontCounters)};
+    vkCmdCopyBuffer(cmd_buf, wavefront.counters.get(),
+                    wavefront.readback[current_frame_index].get(), 1, &counters_copy);
+
+    VkMemoryBarrier host_barrier{};
+    host_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    host_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         VK::FLAGS_NONE, 1, &host_barrier, 0, nullptr, 0, nullptr);
+}
+
 void RVPT::add_material(Material material) { materials.emplace_back(material); }
 
-void RVPT::add_triangle(Triangle triangle) { triangles.emplace_back(triangle); }
+void RVPT::clear_scene()
+{
+    triangles.clear();
+    materials.clear();
+    scene_bvh_prebuilt = false;
+}
+
+bool RVPT::load_scene_file(std::string const& filename)
+{
+    SceneDescription description;
+    description.scene_file = filename;
+    auto scene = read_scene(description, query_pool);
+    if (!scene) return false;
+
+    triangles = std::move(scene->triangles);
+    materials = std::move(scene->materials);
+    scene_bvh_prebuilt = !scene->bvh.nodes.empty();
+    if (scene_bvh_prebuilt)
+    {
+        top_level_bvh = std::move(scene->bvh);
+        geometry_pages = std::move(scene->geometry_pages);
+        sorted_triangles = std::move(scene->sorted_triangles);
+    }
+    return true;
+}
+
+bool RVPT::load_scene_async(SceneDescription scene)
+{
+    if (scene_load.valid()) return false;
+
+    scene_load_start = std::chrono::high_resolution_clock::now();
+    scene_load = std::async(std::launch::async, [description = std::move(scene)] {
+        Profiler::set_thread_name("scene loading");
+        // not query_pool, the frame loop keeps using it for picking
+        ThreadPool pool;
+        auto loaded = read_scene(description, pool);
+        if (!loaded) return loaded;
+
+        if (loaded->bvh.nodes.empty())
+        {
+            Profiler::Zone zone("build bvh");
+            BinnedBvhBuilder builder;
+            build_scene_bvh(loaded->triangles, builder, loaded->bvh, loaded->geometry_pages,
+                            loaded->sorted_triangles);
+        }
+        loaded->depth_bvh_bounds = loaded->bvh.collect_aabbs_by_depth();
+        loaded->light_list = build_light_list(loaded->sorted_triangles, loaded->materials);
+        return loaded;
+    });
+    return true;
+}
+
+std::optional<RVPT::LoadedScene> RVPT::read_scene(SceneDescription const& description,
+                                                   ThreadPool& pool)
+{
+    Profiler::Zone zone("read scene");
+    LoadedScene scene;
+    if (description.scene_file.empty())
+    {
+        for (auto& model : description.models)
+            if (!load_obj(model.file, model.material_id, scene.triangles)) return std::nullopt;
+        scene.materials = description.materials;
+        return scene;
+    }
+
+    SceneData data;
+    if (!read_scene_file(description.scene_file, data)) return std::nullopt;
+
+    // the CPU side queries need the triangles, in BVH order like the file
+    std::vector<Triangle> loaded(data.mesh.triangle_count());
+    pool.parallel_for(loaded.size(), [&](size_t i) { loaded[i] = data.mesh.triangle(i); });
+    scene.materials = std::move(data.materials);
+    if (data.bvh.nodes.empty())
+    {
+        scene.triangles = std::move(loaded);
+        return scene;
+    }
+
+    // the primitive indices are a permutation, read_scene_file checked it
+    scene.triangles.resize(loaded.size());
+    pool.parallel_for(loaded.size(), [&](size_t i) {
+        scene.triangles[data.bvh.primitive_indices[i]] = loaded[i];
+    });
+    scene.sorted_triangles = std::move(loaded);
+    // files written before the page sections existed are split here
+    scene.geometry_pages =
+        data.pages.pages.empty() ? split_into_pages(data.mesh) : std::move(data.pages);
+    scene.bvh = std::move(data.bvh);
+    return scene;
+}
+
+void RVPT::finish_scene_load()
+{
+    auto scene = scene_load.get();
+    if (!scene)
+    {
+        fmt::print(stderr, "[{}: {}] Failed to load the scene, keeping the current one\n",
+                   "ERROR", "SCENE-LOADING");
+        return;
+    }
+
+    triangles = std::move(scene->triangles);
+    materials = std::move(scene->materials);
+    top_level_bvh = std::move(scene->bvh);
+    geometry_pages = std::move(scene->geometry_pages);
+    sorted_triangles = std::move(scene->sorted_triangles);
+    light_list = std::move(scene->light_list);
+    depth_bvh_bounds = std::move(scene->depth_bvh_bounds);
+    scene_bvh_prebuilt = true;
+    // the frames pick up the new scene one by one, in update
+    scene_version++;
+    previous_frame_state.camera_data.clear();
+
+    std::chrono::duration<double, std::milli> load_time =
+        std::chrono::high_resolution_clock::now() - scene_load_start;
+    fmt::print("Scene with {} triangles ready after {:.1f} ms\n", triangles.size(),
+               load_time.count());
+}
+
+void RVPT::upload_scene()
+{
+    build_bvh();
+    // the accumulation belongs to the old scene
+    previous_frame_state.camera_data.clear();
+}
+
+void RVPT::set_geometry_budget(size_t bytes)
+{
+    geometry_budget = bytes;
+    // the frames size their page pools for the new budget
+    scene_version++;
+}
+
+void RVPT::build_bvh()
+{
+    Profiler::Zone zone("build bvh");
+    if (!scene_bvh_prebuilt)
+        build_scene_bvh(triangles, bvh_builder, top_level_bvh, geometry_pages, sorted_triangles);
+    depth_bvh_bounds = top_level_bvh.collect_aabbs_by_depth();
+    light_list = build_light_list(sorted_triangles, materials);
+    // the frames recreate their scene buffers in update, once they are no longer in flight
+    scene_version++;
+}
+
+void RVPT::add_triangle(Triangle triangle)
+{
+    triangles.emplace_back(triangle);
+    scene_bvh_prebuilt = false;
+}
+
+void RVPT::add_triangles(std::vector<Triangle> new_triangles)
+{
+    scene_bvh_prebuilt = false;
+    if (triangles.empty())
+        triangles = std::move(new_triangles);
+    else
+        triangles.insert(triangles.end(), new_triangles.begin(), new_triangles.end());
+}
+
+std::optional<RVPT::PickResult> RVPT::pick(glm::vec2 pixel)
+{
+    auto camera_data = scene_camera.get_data();
+    glm::mat4 matrix(camera_data[0], camera_data[1], camera_data[2], camera_data[3]);
+    // the image is flipped vertically, see trace_pixel
+    float x = (pixel.x + 0.5f) / static_cast<float>(window_settings.width);
+    float y = 1.0f - (pixel.y + 0.5f) / static_cast<float>(window_settings.height);
+    CpuRay ray = camera_ray(matrix, camera_data[4], render_settings.camera_mode, x, y);
+
+    CpuIsect info;
+    if (!ray_query.intersect(ray, 0.0f, std::numeric_limits<float>::infinity(), info))
+        return std::nullopt;
+
+    PickResult result;
+    result.triangle = top_level_bvh.primitive_indices[info.prim];
+    result.material = static_cast<int>(sorted_triangles[info.prim].material_id.x);
+    result.distance = info.t * glm::length(ray.direction);
+    result.position = info.pos;
+    return result;
+}
 
 void RVPT::get_asset_path(std::string& asset_path)
 {
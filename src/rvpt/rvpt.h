@@ -1,5 +1,9 @@
 #pragma once
 
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <future>
 #include <string>
 #include <vector>
 #include <optional>
@@ -21,13 +25,50 @@
 #include "material.h"
 #include "bvh.h"
 #include "bvh_builder.h"
+#include "indexed_mesh.h"
+#include "geometry_pages.h"
+#include "light_sampling.h"
+#include "wavefront.h"
+#include "shader_compiler.h"
+#include "thread_pool.h"
+#include "ray_query.h"
+#include "scene_file.h"
 
 const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
 
 static const char* RenderModes[] = {"binary",       "color",          "depth",
                                     "normals",      "Utah model",     "ambient occlusion",
                                     "Arthur Appel", "Turner Whitted", "Robert Cook",
-                                    "James Kajiya", "John Hart"};
+                                    "James Kajiya", "John Hart",      "traversal heatmap"};
+// the render mode which needs the traversal counters
+constexpr int TRAVERSAL_HEATMAP_MODE = 11;
+
+// BVH traversal totals of a frame, the TraversalTotals buffer of bindings.glsl. The shader keeps
+// every total as a (low, high) pair of 32 bit words, which is a uint64_t on little endian hosts.
+struct TraversalTotals
+{
+    uint64_t rays;
+    uint64_t nodes_visited;
+    uint64_t aabb_tests;
+    uint64_t triangle_tests;
+};
+
+// Passes timed on the GPU with timestamp queries
+enum class GpuPass
+{
+    path_tracing,
+    denoise,
+    fullscreen_copy,
+    debug_raster,
+    debug_bvh,
+    imgui,
+    count
+};
+constexpr size_t GPU_PASS_COUNT = static_cast<size_t>(GpuPass::count);
+// the passes from here on are in the graphics command buffer, the others in the compute one
+constexpr size_t FIRST_GRAPHICS_PASS = static_cast<size_t>(GpuPass::fullscreen_copy);
+static const char* GpuPassNames[] = {"Path Tracing", "Denoise",   "Fullscreen Copy",
+                                     "Debug Raster", "Debug BVH", "ImGui"};
 
 const std::vector<glm::vec3> colors = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {0, 0, 0},   {1, .5, 0},
                       {1, 0, 1}, {1, 1, 0}, {1, 1, 1}, {.5, .25, 0}};
@@ -36,6 +77,9 @@ class RVPT
 {
 public:
     explicit RVPT(Window& window);
+    // Headless: no window, surface or swapchain, frames are only rendered into the offscreen
+    // images and read back with save_image
+    explicit RVPT(Window::Settings settings);
     ~RVPT();
 
     RVPT(RVPT const& other) = delete;
@@ -59,15 +103,94 @@ public:
 
     void shutdown();
 
+    // Starts a new accumulation and renders `sample_count` samples per pixel into it
+    void render_samples(uint32_t sample_count);
+    // Reads back the accumulated image, RGBA8, denoised when render_settings.denoise is set
+    std::vector<uint8_t> read_image();
+    // render_samples, then writes the image to `output_file` as a binary PPM
+    bool render_offscreen(uint32_t sample_count, std::string const& output_file);
+    // Waits until the GPU finished every frame submitted so far
+    void wait_idle();
+
+    // Seeds the random numbers uploaded every frame, which otherwise come from std::random_device,
+    // so that the same frames render the same images
+    void set_random_seed(uint32_t seed);
+    void set_wavefront(bool enabled);
+    // Counts the BVH traversal work of the megakernel, always on while the heatmap mode is shown
+    void set_traversal_stats(bool enabled);
+    // Totals of the frame read back last, MAX_FRAMES_IN_FLIGHT frames ago
+    [[nodiscard]] TraversalTotals const& get_traversal_totals() const { return traversal_totals; }
+    // Counters of the wavefront frame read back last, MAX_FRAMES_IN_FLIGHT frames ago
+    [[nodiscard]] WavefrontCounters const& get_wavefront_stats() const { return wavefront_stats; }
+
     void reload_shaders();
     void toggle_debug();
     void toggle_wireframe_debug();
     void toggle_bvh_debug();
     void toggle_view_last_bvh_depths();
     void set_raytrace_mode(int mode);
+    void start_persistent_benchmark();
 
     void add_material(Material material);
     void add_triangle(Triangle triangle);
+    void add_triangles(std::vector<Triangle> new_triangles);
+    // After initialize, the scene can be replaced by clearing it, adding the new triangles and
+    // materials and uploading it, which rebuilds the BVH and the scene buffers
+    void clear_scene();
+    void upload_scene();
+    // Replaces the scene with the one of a scene file (see scene_file.h), before initialize or
+    // followed by upload_scene. Its BVH is used as it is. Returns false when the file can't be
+    // loaded, the scene is unchanged then.
+    bool load_scene_file(std::string const& filename);
+    // Loads the models or the scene file of `scene` (paths as given) on a background thread
+    // while the current scene, empty right after initialize, keeps rendering. The models are
+    // parsed and the BVH built off the frame loop; the first update after that swaps the scene
+    // in, and every frame gets new scene buffers once it is no longer in flight, so there is no
+    // wait for the GPU. Returns false while another load is running.
+    bool load_scene_async(SceneDescription scene);
+    [[nodiscard]] bool scene_loading() const { return scene_load.valid(); }
+    // Caps the memory of the triangle geometry on the GPU, per frame in flight, 0 (the default)
+    // keeps the whole scene resident. With a budget below the size of the scene only the pages
+    // of GEOMETRY_PAGE_TRIANGLES triangles the frames touch are kept, the least recently used
+    // ones are replaced and rays which need a page that isn't resident yet are redone once it is.
+    // The budget has to hold the pages of a frame, or the image never converges.
+    void set_geometry_budget(size_t bytes);
+
+    [[nodiscard]] std::vector<Triangle> const& get_triangles() const { return triangles; }
+    [[nodiscard]] std::vector<Material> const& get_materials() const { return materials; }
+
+    // Milliseconds initialize took until every pipeline was created, and whether the pipeline
+    // cache file from an earlier run was loaded for them
+    [[nodiscard]] double get_pipelines_ready_ms() const { return pipelines_ready_ms; }
+    [[nodiscard]] bool pipeline_cache_warm() const { return pipeline_builder.loaded_cache(); }
+
+    // Milliseconds each pass took on the GPU, smoothed over the last frames. The timestamps are
+    // read MAX_FRAMES_IN_FLIGHT frames after they were written, 0 when not supported
+    [[nodiscard]] std::array<double, GPU_PASS_COUNT> const& get_gpu_pass_times() const
+    {
+        return gpu_timing.average_ms;
+    }
+    // Unsmoothed times of the frame read back last
+    [[nodiscard]] std::array<double, GPU_PASS_COUNT> const& get_latest_gpu_pass_times() const
+    {
+        return gpu_timing.last_ms;
+    }
+    // Appends a row with the GPU time of every pass to `csv_file` for every frame, until stopped
+    bool start_gpu_timing_log(std::string const& csv_file);
+    void stop_gpu_timing_log();
+
+    // CPU ray queries against the current scene, the triangle indices are in BVH order
+    [[nodiscard]] RayQuery const& get_ray_query() const { return ray_query; }
+
+    struct PickResult
+    {
+        uint32_t triangle;  // index in the order the triangles were added
+        int material;
+        float distance;
+        glm::vec3 position;
+    };
+    // The triangle seen through a pixel of the rendered image, if any
+    std::optional<PickResult> pick(glm::vec2 pixel);
 
     void get_asset_path(std::string& asset_path);
 
@@ -85,6 +208,12 @@ public:
         int bottom_left_render_mode = 9;
         int bottom_right_render_mode = 9;
         glm::vec2 split_ratio = glm::vec2(0.5, 0.5);
+        // next event estimation with multiple importance sampling in the Kajiya integrator of
+        // the megakernel, the wavefront stages only sample the bsdf. A LightSampling.
+        int light_sampling = LIGHT_SAMPLING_BVH;
+        // filters the accumulated image with denoise_pass.comp before it is shown, the path
+        // tracer writes the albedo, normal and depth it is guided by
+        int denoise = 0;
 
     } render_settings;
 
@@ -100,7 +229,68 @@ private:
 
     bool debug_bvh_enabled = false;
 
-    Window& window_ref;
+    // split the path tracer into wavefront stages instead of running the megakernel
+    bool wavefront_enabled = false;
+    bool wavefront_sort_rays = false;
+    bool wavefront_sort_hits = false;
+    WavefrontCounters wavefront_stats{};
+
+    // megakernel pipelines specialized with the traversal counters
+    bool traversal_stats_enabled = false;
+    TraversalTotals traversal_totals{};
+
+    // launch a fixed number of workgroups which fetch pixels from a global counter
+    bool persistent_threads_enabled = false;
+    int persistent_group_count = 512;
+
+    // à-trous steps of the denoiser, the holes double every step
+    int denoise_iterations = 5;
+
+    // renders the same view with and without persistent threads for several bounce counts
+    struct PersistentBenchmark
+    {
+        bool running = false;
+        size_t config = 0;
+        int frame = 0;  // of the current configuration, warmup included
+        int timed_frames = 0;
+        double pass_ms_sum = 0.0;
+        RenderSettings saved_settings;
+        bool saved_persistent_threads = false;
+        std::vector<double> pass_ms;  // mean GPU time of each configuration
+    } persistent_benchmark;
+
+    // dispatch every split screen region with a pipeline specialized for its integrator and the
+    // camera mode instead of one pipeline selecting them at runtime
+    bool specialized_pipelines_enabled = true;
+
+    // spread the megakernel over several frames to stay within a GPU time budget per frame
+    struct TiledRendering
+    {
+        bool enabled = false;
+        float target_ms = 16.0f;
+        uint32_t next_group = 0;  // first 16x16 workgroup of the next dispatch
+        uint32_t groups_per_frame = 64;
+        double ms_per_group = 0.0;  // smoothed GPU cost of a workgroup
+        std::array<uint32_t, MAX_FRAMES_IN_FLIGHT> groups_in_flight{};
+    } tiled_rendering;
+
+    // 0 when the compute queue doesn't support timestamps
+    float timestamp_period = 0.0f;
+    // 0 when the graphics queue doesn't support timestamps
+    float graphics_timestamp_period = 0.0f;
+
+    // per pass GPU times, read back from the timestamp queries of the frames which finished
+    struct GpuTiming
+    {
+        std::array<double, GPU_PASS_COUNT> last_ms{};
+        std::array<double, GPU_PASS_COUNT> average_ms{};
+        uint64_t frame = 0;
+        std::ofstream csv;
+    } gpu_timing;
+
+    // nullptr when headless
+    Window* window = nullptr;
+    Window::Settings window_settings;
     std::string source_folder = "";
 
     // Random number generators
@@ -113,6 +303,13 @@ private:
     // BVH AABB's
     BinnedBvhBuilder bvh_builder;
     Bvh top_level_bvh;
+    // the BVH came with the scene file or the scene load, build_bvh keeps it until the triangles
+    // change
+    bool scene_bvh_prebuilt = false;
+    // incremented by every build_bvh, the frames compare it to the scene in their buffers
+    uint64_t scene_version = 0;
+    // bytes of the page pool of each frame, 0 for no limit
+    size_t geometry_budget = 0;
 
     // Debug BVH view
     std::vector<std::vector<AABB>> depth_bvh_bounds;
@@ -121,9 +318,32 @@ private:
     bool view_previous_depths = true;
 
     std::vector<Triangle> triangles;
+    // the GPU copy of the scene, indexed, in BVH order and split into pages
+    GeometryPages geometry_pages;
+    // the emissive triangles of sorted_triangles
+    LightList light_list;
+    // for the CPU side queries
     std::vector<Triangle> sorted_triangles;
     std::vector<Material> materials;
 
+    // CPU side queries over top_level_bvh and sorted_triangles
+    ThreadPool query_pool;
+    RayQuery ray_query{query_pool};
+
+    // Scene read and built by load_scene_async, moved into the members above by update()
+    struct LoadedScene
+    {
+        std::vector<Triangle> triangles;
+        std::vector<Material> materials;
+        Bvh bvh;  // empty when it still has to be built
+        GeometryPages geometry_pages;
+        std::vector<Triangle> sorted_triangles;
+        LightList light_list;
+        std::vector<std::vector<AABB>> depth_bvh_bounds;
+    };
+    std::future<std::optional<LoadedScene>> scene_load;
+    std::chrono::high_resolution_clock::time_point scene_load_start;
+
     struct PreviousFrameState
     {
         RenderSettings settings;
@@ -148,6 +368,8 @@ private:
     std::optional<VK::Queue> compute_queue;
 
     VK::PipelineBuilder pipeline_builder;
+    double pipelines_ready_ms = 0.0;
+    std::optional<ShaderCompiler> shader_compiler;
     VK::MemoryAllocator memory_allocator;
 
     vkb::Swapchain vkb_swapchain;
@@ -157,8 +379,10 @@ private:
     uint32_t current_sync_index = 0;
     std::vector<VK::SyncResources> sync_resources;
     std::vector<VkFence> frames_inflight_fences;
+    // timestamps between the passes of the graphics command buffer of each sync resource
+    std::vector<VK::TimestampQueryPool> graphics_timestamps;
 
-    VkRenderPass fullscreen_tri_render_pass;
+    VkRenderPass fullscreen_tri_render_pass = VK_NULL_HANDLE;
 
     std::optional<ImguiImpl> imgui_impl;
 
@@ -175,6 +399,8 @@ private:
         VK::GraphicsPipelineHandle fullscreen_triangle_pipeline;
         VkPipelineLayout raytrace_pipeline_layout;
         VK::ComputePipelineHandle raytrace_pipeline;
+        VK::ComputePipelineHandle persistent_pipeline;
+        VK::ComputePipelineHandle denoise_pipeline;
 
         VkPipelineLayout debug_pipeline_layout;
         VK::GraphicsPipelineHandle debug_opaque_pipeline;
@@ -184,23 +410,88 @@ private:
         VK::GraphicsPipelineHandle debug_bvh_pipeline;
 
         VK::Image temporal_storage_image;
+        VK::Image feature_albedo_image;
+        VK::Image feature_normal_depth_image;
+        VK::Image moments_image;
+        VK::Image denoise_image_0;
+        VK::Image denoise_image_1;
         VK::Image depth_buffer;
     };
 
     std::optional<RenderingResources> rendering_resources;
 
+    struct WavefrontResources
+    {
+        VK::DescriptorPool descriptor_pool;
+        VK::DescriptorSet descriptor_set;
+
+        VkPipelineLayout pipeline_layout;
+        VK::ComputePipelineHandle generate_pipeline;
+        VK::ComputePipelineHandle dispatch_pipeline;
+        VK::ComputePipelineHandle extend_pipeline;
+        VK::ComputePipelineHandle shade_pipeline;
+        VK::ComputePipelineHandle shadow_pipeline;
+        VK::ComputePipelineHandle accumulate_pipeline;
+        VK::ComputePipelineHandle sort_keys_pipeline;
+        VK::ComputePipelineHandle sort_scan_pipeline;
+        VK::ComputePipelineHandle sort_scatter_pipeline;
+
+        VK::Buffer counters;
+        VK::Buffer rays;
+        VK::Buffer hits;
+        VK::Buffer shadow_rays;
+        VK::Buffer radiance;
+        VK::Buffer sort_bins;
+        VK::Buffer sort_keys;
+        VK::Buffer sort_index;
+
+        // copy of the counters for each frame in flight, for statistics
+        std::vector<VK::Buffer> readback;
+    };
+
+    std::optional<WavefrontResources> wavefront_resources;
+
     uint32_t current_frame_index = 0;
+    struct SceneBuffers
+    {
+        VK::Buffer bvh_buffer;
+        VK::Buffer vertex_buffer;
+        VK::Buffer index_buffer;
+        VK::Buffer triangle_material_buffer;
+        VK::Buffer page_table_buffer;
+        VK::Buffer page_feedback_buffer;
+        VK::Buffer material_buffer;
+        VK::Buffer light_buffer;
+        VK::Buffer light_node_buffer;
+        // the geometry pages in the page pool (vertex_buffer, index_buffer and
+        // triangle_material_buffer)
+        PageCache page_cache;
+    };
+    // A newer scene copied into buffers of its own a part per frame, the frame keeps rendering
+    // its current scene until the copy is complete, see update_scene_buffers
+    struct SceneUpload
+    {
+        uint64_t scene_version = 0;
+        SceneBuffers buffers;
+        // the pages which still have to be copied into the page pool
+        std::vector<PageCache::Upload> pages;
+        // elements copied so far
+        size_t bvh_nodes_copied = 0;
+        size_t lights_copied = 0;
+        size_t light_nodes_copied = 0;
+    };
     struct PerFrameData
     {
         VK::Buffer settings_uniform;
         VK::Image output_image;
         VK::Buffer random_buffer;
         VK::Buffer camera_uniform;
-        VK::Buffer bvh_buffer;
-        VK::Buffer triangle_buffer;
-        VK::Buffer material_buffer;
+        SceneBuffers scene;
+        VK::Buffer work_counter_buffer;
+        VK::Buffer traversal_buffer;
         VK::CommandBuffer raytrace_command_buffer;
         VK::Fence raytrace_work_fence;
+        VK::TimestampQueryPool compute_timestamps;
         VK::DescriptorSet image_descriptor_set;
         VK::DescriptorSet raytracing_descriptor_sets;
 
@@ -211,6 +502,15 @@ private:
         VK::Buffer debug_bvh_camera_uniform;
         VK::Buffer debug_bvh_vertex_buffer;
         VK::DescriptorSet debug_bvh_descriptor_set;
+
+        // the traversal counters were reset and written by the last submission
+        bool traversal_stats_recorded = false;
+        // scene_version of the scene in `scene`
+        uint64_t scene_version = 0;
+        // the upload of a newer scene, nullopt when the frame is up to date
+        std::optional<SceneUpload> scene_upload;
+        // page_feedback_buffer was reset and written by the last submission
+        bool page_feedback_recorded = false;
     };
     std::vector<PerFrameData> per_frame_data;
 
@@ -222,8 +522,41 @@ private:
     void create_framebuffers();
 
     [[nodiscard]] RenderingResources create_rendering_resources();
+    [[nodiscard]] WavefrontResources create_wavefront_resources();
     void add_per_frame_data(int index);
+    void write_raytracing_descriptors(PerFrameData& frame);
+    [[nodiscard]] VK::Buffer create_scene_buffer(std::string const& name, int index,
+                                                 size_t size);
+    [[nodiscard]] VK::Buffer create_page_feedback_buffer(int index, size_t page_count);
+    // Creates the buffers of the current scene for a frame and lists what has to be copied
+    [[nodiscard]] SceneUpload begin_scene_upload(int index);
+    // Copies the next part of the current scene for a frame which isn't in flight, swaps the
+    // new buffers in once the whole scene is there
+    void update_scene_buffers(PerFrameData& frame, int index);
+    // Copies the pages into their slots of the page pool and writes its page table
+    void upload_pages(SceneBuffers& scene, std::vector<PageCache::Upload> const& uploads);
+    // Loads the pages the last submission of the frame requested but didn't have
+    void stream_geometry_pages(PerFrameData& frame);
+    void build_bvh();
+    // Reads the models or the scene file of `description`, nullopt when one can't be read
+    [[nodiscard]] static std::optional<LoadedScene> read_scene(
+        SceneDescription const& description, ThreadPool& pool);
+    void finish_scene_load();
+    // Returns false when the compute timestamps of the frame weren't available
+    bool read_gpu_pass_times();
+    void read_graphics_pass_times(uint32_t sync_index);
 
     void record_command_buffer(VK::SyncResources& current_frame, uint32_t swapchain_image_index);
     void record_compute_command_buffer();
+    void record_wavefront_commands(VkCommandBuffer cmd_buf);
+    void record_megakernel_commands(VkCommandBuffer cmd_buf);
+    void record_denoise_commands(VkCommandBuffer cmd_buf);
+    VkPipeline get_megakernel_pipeline(VK::ComputePipelineHandle const& handle, int integrator);
+    void update_tile_budget();
+    bool tiled_rendering_active() const;
+    bool traversal_stats_active() const;
+    bool wavefront_supported() const;
+    void update_persistent_benchmark(bool timed);
+    void finish_shader_reload();
+    bool headless() const { return window == nullptr; }
 };
@@ -0,0 +1,130 @@
+// rvpt_convert input.obj|scene.json output.rvscene [--assets folder] [--no-bvh]
+//
+// Converts a scene into the binary scene format of scene_file.h: the triangles are indexed, the
+// BVH is built and the triangles are split into geometry pages, all written in the layout the GPU
+// buffers use, so loading the scene is a copy of the file instead of parsing the models, building
+// the BVH and splitting it into pages again.
+//
+// An .obj file becomes a scene with a single white lambert material. A JSON file describes the
+// scene like a "scenes" entry of a batch job file (see batch.h), its model paths are relative to
+// the assets folder, "assets" by default. With --no-bvh the BVH is left out and built on load.
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+
+#include "bvh_builder.h"
+#include "geometry_pages.h"
+#include "indexed_mesh.h"
+#include "obj_loader.h"
+#include "scene_file.h"
+
+namespace
+{
+bool ends_with(std::string const& str, std::string const& suffix)
+{
+    return str.size() >= suffix.size() &&
+           str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool read_description(std::string const& filename, std::string const& assets,
+                      SceneDescription& scene)
+{
+    if (!ends_with(filename, ".json"))
+    {
+        scene.models.push_back({filename, 0});
+        scene.materials.push_back(
+            Material(glm::vec4(1, 1, 1, 0), glm::vec4(0), Material::Type::LAMBERT));
+        return true;
+    }
+
+    std::ifstream input(filename);
+    if (!input)
+    {
+        fmt::print(stderr, "Failed to open {}\n", filename);
+        return false;
+    }
+    try
+    {
+        nlohmann::json json;
+        input >> json;
+        scene = read_scene_description(json);
+    }
+    catch (nlohmann::json::exception const& e)
+    {
+        fmt::print(stderr, "Failed to parse {}: {}\n", filename, e.what());
+        return false;
+    }
+    if (!scene.scene_file.empty())
+    {
+        fmt::print(stderr, "{} refers to a scene file, there is nothing to convert\n", filename);
+        return false;
+    }
+    for (auto& model : scene.models) model.file = assets + "/" + model.file;
+    return true;
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> files;
+    std::string assets = "assets";
+    bool with_bvh = true;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--assets" && i + 1 < argc)
+            assets = argv[++i];
+        else if (arg == "--no-bvh")
+            with_bvh = false;
+        else
+            files.push_back(arg);
+    }
+    if (files.size() != 2)
+    {
+        fmt::print(stderr,
+                   "Usage: rvpt_convert input.obj|scene.json output.rvscene [--assets folder] "
+                   "[--no-bvh]\n");
+        return -1;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    SceneDescription description;
+    if (!read_description(files[0], assets, description)) return -1;
+
+    std::vector<Triangle> triangles;
+    for (auto& model : description.models)
+    {
+        if (model.material_id < 0 ||
+            static_cast<size_t>(model.material_id) >= description.materials.size())
+        {
+            fmt::print(stderr, "{} uses material {}, the scene has {} materials\n", model.file,
+                       model.material_id, description.materials.size());
+            return -1;
+        }
+        if (!load_obj(model.file, model.material_id, triangles)) return -1;
+    }
+
+    SceneData scene;
+    scene.materials = std::move(description.materials);
+    scene.mesh = index_triangles(triangles);
+    if (with_bvh)
+    {
+        BinnedBvhBuilder builder;
+        scene.bvh = builder.build_bvh(scene.mesh);
+        scene.mesh = scene.mesh.permute_triangles(scene.bvh.primitive_indices);
+        scene.pages = split_into_pages(scene.mesh);
+    }
+    if (!write_scene_file(files[1], scene)) return -1;
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    fmt::print("Wrote {} with {} triangles, {} vertices, {} materials and {} BVH nodes in "
+               "{:.2f} s\n",
+               files[1], scene.mesh.triangle_count(), scene.mesh.vertices.size(),
+               scene.materials.size(), scene.bvh.nodes.size(), elapsed.count());
+    return 0;
+}
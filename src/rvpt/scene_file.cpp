@@ -0,0 +1,307 @@
+#include "scene_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <utility>
+
+#include <fmt/core.h>
+
+#include "mapped_file.h"
+#include "profiler.h"
+
+namespace
+{
+// entries of the BVH traversal stacks (intersection.glsl, ray_query.cpp)
+constexpr uint32_t MAX_BVH_DEPTH = 64;
+
+template <typename T>
+SceneFileSection make_section(SceneSectionType type, std::vector<T> const& data)
+{
+    return SceneFileSection{type, static_cast<uint32_t>(sizeof(T)), 0, data.size()};
+}
+
+uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+class SceneReader
+{
+public:
+    SceneReader(std::string const& filename, MappedFile const& file)
+        : filename(filename), file(file)
+    {
+    }
+
+    bool read_header()
+    {
+        if (file.size() < sizeof(SceneFileHeader)) return error("is too small");
+        SceneFileHeader header;
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic)) != 0)
+            return error("is not a scene file");
+        if (header.version != SCENE_FILE_VERSION)
+            return error(fmt::format("has version {}, expected {}", header.version,
+                                     SCENE_FILE_VERSION));
+        if (header.file_size != file.size()) return error("is truncated");
+
+        uint64_t table_end = sizeof(SceneFileHeader) +
+                             static_cast<uint64_t>(header.section_count) * sizeof(SceneFileSection);
+        if (table_end > file.size()) return error("is truncated");
+        sections.resize(header.section_count);
+        std::memcpy(sections.data(), file.data() + sizeof(SceneFileHeader),
+                    sections.size() * sizeof(SceneFileSection));
+        return true;
+    }
+
+    // Copies the section into `data`, returns false when it is missing and `required` or invalid.
+    // `fill` only exists for types without a default constructor, it is overwritten by the copy.
+    template <typename T>
+    bool read(SceneSectionType type, std::vector<T>& data, bool required, T const& fill = T())
+    {
+        for (auto const& section : sections)
+        {
+            if (section.type != type) continue;
+            if (section.element_size != sizeof(T))
+                return error(fmt::format("section {} has elements of {} bytes, expected {}",
+                                         static_cast<uint32_t>(type), section.element_size,
+                                         sizeof(T)));
+            if (section.offset % SCENE_SECTION_ALIGNMENT != 0 || section.offset > file.size() ||
+                section.count > (file.size() - section.offset) / sizeof(T))
+                return error(fmt::format("section {} is out of bounds",
+                                         static_cast<uint32_t>(type)));
+            data.assign(static_cast<size_t>(section.count), fill);
+            std::memcpy(data.data(), file.data() + section.offset, data.size() * sizeof(T));
+            return true;
+        }
+        if (required)
+            return error(fmt::format("has no section {}", static_cast<uint32_t>(type)));
+        return true;
+    }
+
+    bool error(std::string const& message)
+    {
+        fmt::print(stderr, "[{}: {}] {} {}\n", "ERROR", "SCENE-LOADING", filename, message);
+        return false;
+    }
+
+private:
+    std::string const& filename;
+    MappedFile const& file;
+    std::vector<SceneFileSection> sections;
+};
+
+bool valid_bvh(Bvh const& bvh, size_t triangle_count)
+{
+    // the primitive indices have to be a permutation of the triangles
+    if (bvh.primitive_indices.size() != triangle_count) return false;
+    std::vector<bool> seen(triangle_count);
+    for (uint32_t index : bvh.primitive_indices)
+    {
+        if (index >= triangle_count || seen[index]) return false;
+        seen[index] = true;
+    }
+    for (auto const& node : bvh.nodes)
+    {
+        uint64_t first = node.first_child_or_primitive;
+        if (node.is_leaf() ? first + node.primitive_count > triangle_count
+                           : first == 0 || first + 2 > bvh.nodes.size())
+            return false;
+    }
+    if (bvh.nodes.empty()) return false;
+
+    // the nodes have to form a tree the traversal stacks of the shaders and of the CPU can hold:
+    // every node reached exactly once from the root, no path longer than MAX_BVH_DEPTH nodes
+    std::vector<bool> reached(bvh.nodes.size());
+    std::vector<std::pair<uint32_t, uint32_t>> to_visit = {{0, 1}};
+    size_t reached_count = 0;
+    while (!to_visit.empty())
+    {
+        auto [index, depth] = to_visit.back();
+        to_visit.pop_back();
+        if (reached[index] || depth > MAX_BVH_DEPTH) return false;
+        reached[index] = true;
+        reached_count++;
+
+        auto const& node = bvh.nodes[index];
+        if (node.is_leaf()) continue;
+        to_visit.push_back({node.first_child_or_primitive, depth + 1});
+        to_visit.push_back({node.first_child_or_primitive + 1, depth + 1});
+    }
+    return reached_count == bvh.nodes.size();
+}
+
+// `pages` has its `pages`, `vertices` and `indices` read, fills in the rest from the mesh
+bool complete_pages(GeometryPages& pages, IndexedMesh const& mesh)
+{
+    pages.triangle_count = mesh.triangle_count();
+    size_t page_count =
+        (pages.triangle_count + GEOMETRY_PAGE_TRIANGLES - 1) / GEOMETRY_PAGE_TRIANGLES;
+    if (pages.pages.size() != page_count || pages.indices.size() != mesh.indices.size())
+        return false;
+
+    pages.slot_vertices = 0;
+    for (size_t page = 0; page < page_count; page++)
+    {
+        auto const& [first_vertex, vertex_count] = pages.pages[page];
+        if (uint64_t{first_vertex} + vertex_count > pages.vertices.size()) return false;
+        size_t first_index = page * GEOMETRY_PAGE_TRIANGLES * 3;
+        size_t end_index = first_index + pages.page_triangles(page) * size_t{3};
+        for (size_t i = first_index; i < end_index; i++)
+            if (pages.indices[i] >= vertex_count) return false;
+        pages.slot_vertices = std::max(pages.slot_vertices, vertex_count);
+    }
+    pages.materials = mesh.materials;
+    return true;
+}
+}  // namespace
+
+bool write_scene_file(std::string const& filename, SceneData const& scene)
+{
+    Profiler::Zone zone("write_scene_file");
+
+    std::vector<SceneFileSection> sections = {
+        make_section(SceneSectionType::materials, scene.materials),
+        make_section(SceneSectionType::vertices, scene.mesh.vertices),
+        make_section(SceneSectionType::indices, scene.mesh.indices),
+        make_section(SceneSectionType::triangle_materials, scene.mesh.materials)};
+    std::vector<void const*> section_data = {scene.materials.data(), scene.mesh.vertices.data(),
+                                             scene.mesh.indices.data(),
+                                             scene.mesh.materials.data()};
+    if (!scene.bvh.nodes.empty())
+    {
+        sections.push_back(make_section(SceneSectionType::bvh_nodes, scene.bvh.nodes));
+        sections.push_back(
+            make_section(SceneSectionType::bvh_primitive_indices, scene.bvh.primitive_indices));
+        section_data.push_back(scene.bvh.nodes.data());
+        section_data.push_back(scene.bvh.primitive_indices.data());
+    }
+    if (!scene.bvh.nodes.empty() && !scene.pages.pages.empty())
+    {
+        sections.push_back(make_section(SceneSectionType::geometry_pages, scene.pages.pages));
+        sections.push_back(make_section(SceneSectionType::page_vertices, scene.pages.vertices));
+        sections.push_back(make_section(SceneSectionType::page_indices, scene.pages.indices));
+        section_data.push_back(scene.pages.pages.data());
+        section_data.push_back(scene.pages.vertices.data());
+        section_data.push_back(scene.pages.indices.data());
+    }
+
+    uint64_t offset = sizeof(SceneFileHeader) + sections.size() * sizeof(SceneFileSection);
+    for (auto& section : sections)
+    {
+        section.offset = align_up(offset, SCENE_SECTION_ALIGNMENT);
+        offset = section.offset + section.count * section.element_size;
+    }
+
+    SceneFileHeader header{};
+    std::memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_FILE_VERSION;
+    header.section_count = static_cast<uint32_t>(sections.size());
+    header.file_size = offset;
+
+    std::ofstream output(filename, std::ios::binary);
+    if (!output)
+    {
+        fmt::print(stderr, "Failed to open {} for writing\n", filename);
+        return false;
+    }
+    output.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    output.write(reinterpret_cast<char const*>(sections.data()),
+                 static_cast<std::streamsize>(sections.size() * sizeof(SceneFileSection)));
+    uint64_t written = sizeof(SceneFileHeader) + sections.size() * sizeof(SceneFileSection);
+    for (size_t i = 0; i < sections.size(); i++)
+    {
+        // zero padding up to the aligned start of the section
+        static char const padding[SCENE_SECTION_ALIGNMENT] = {};
+        output.write(padding, static_cast<std::streamsize>(sections[i].offset - written));
+        uint64_t size = sections[i].count * sections[i].element_size;
+        output.write(static_cast<char const*>(section_data[i]),
+                     static_cast<std::streamsize>(size));
+        written = sections[i].offset + size;
+    }
+    return static_cast<bool>(output);
+}
+
+bool read_scene_file(std::string const& filename, SceneData& scene)
+{
+    Profiler::Zone zone("read_scene_file");
+
+    MappedFile file(filename);
+    if (!file.data())
+    {
+        fmt::print(stderr, "[{}: {}] Failed to open {}\n", "ERROR", "SCENE-LOADING", filename);
+        return false;
+    }
+
+    SceneReader reader(filename, file);
+    if (!reader.read_header()) return false;
+
+    SceneData loaded;
+    Material fill(glm::vec4(0), glm::vec4(0), Material::Type::LAMBERT);
+    bool read = reader.read(SceneSectionType::materials, loaded.materials, true, fill) &&
+                reader.read(SceneSectionType::vertices, loaded.mesh.vertices, true) &&
+                reader.read(SceneSectionType::indices, loaded.mesh.indices, true) &&
+                reader.read(SceneSectionType::triangle_materials, loaded.mesh.materials, true) &&
+                reader.read(SceneSectionType::bvh_nodes, loaded.bvh.nodes, false) &&
+                reader.read(SceneSectionType::bvh_primitive_indices,
+                            loaded.bvh.primitive_indices, false) &&
+                reader.read(SceneSectionType::geometry_pages, loaded.pages.pages, false) &&
+                reader.read(SceneSectionType::page_vertices, loaded.pages.vertices, false) &&
+                reader.read(SceneSectionType::page_indices, loaded.pages.indices, false);
+    if (!read) return false;
+
+    auto& mesh = loaded.mesh;
+    if (mesh.indices.size() != mesh.materials.size() * 3)
+        return reader.error("has an index count which doesn't match its triangles");
+    for (uint32_t index : mesh.indices)
+        if (index >= mesh.vertices.size()) return reader.error("has indices out of range");
+    for (uint32_t material : mesh.materials)
+        if (material >= loaded.materials.size())
+            return reader.error("has materials out of range");
+    if ((!loaded.bvh.nodes.empty() || !loaded.bvh.primitive_indices.empty()) &&
+        !valid_bvh(loaded.bvh, mesh.triangle_count()))
+        return reader.error("has an invalid BVH");
+    // pages without a BVH would be in source order, not the order of the BVH leaves
+    if (!loaded.pages.pages.empty() &&
+        (loaded.bvh.nodes.empty() || !complete_pages(loaded.pages, mesh)))
+        return reader.error("has invalid geometry pages");
+
+    scene = std::move(loaded);
+    return true;
+}
+
+glm::vec3 read_vec3(nlohmann::json const& json, std::string const& key, glm::vec3 fallback)
+{
+    if (!json.contains(key)) return fallback;
+    auto const& v = json[key];
+    return glm::vec3(v.at(0).get<float>(), v.at(1).get<float>(), v.at(2).get<float>());
+}
+
+Material read_material(nlohmann::json const& json)
+{
+    const std::map<std::string, Material::Type> types = {
+        {"lambert", Material::Type::LAMBERT},
+        {"mirror", Material::Type::MIRROR},
+        {"dielectric", Material::Type::DIELECTRIC}};
+    auto type = types.find(json.value("type", "lambert"));
+    // the index of refraction of dielectrics lives in the w of the albedo
+    return Material(glm::vec4(read_vec3(json, "albedo", glm::vec3(1)), json.value("ior", 1.5f)),
+                    glm::vec4(read_vec3(json, "emission", glm::vec3(0)), 0),
+                    type != types.end() ? type->second : Material::Type::LAMBERT);
+}
+
+SceneDescription read_scene_description(nlohmann::json const& json)
+{
+    SceneDescription scene;
+    if (json.contains("file"))
+    {
+        scene.scene_file = json["file"].get<std::string>();
+        return scene;
+    }
+    for (auto& model : json.at("models"))
+        scene.models.push_back({model.at("file").get<std::string>(), model.value("material", 0)});
+    for (auto& material : json.at("materials")) scene.materials.push_back(read_material(material));
+    return scene;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <nlohmann/json.hpp>
+
+#include "bvh.h"
+#include "geometry_pages.h"
+#include "indexed_mesh.h"
+#include "material.h"
+
+// Binary scene container (.rvscene), everything RVPT uploads to the GPU in its final layout:
+//
+//     SceneFileHeader
+//     SceneFileSection[section_count]
+//     section data, each starting at a multiple of SCENE_SECTION_ALIGNMENT
+//
+// A section is a plain array of one of the types the scene buffers hold (Material, vertex,
+// index, BvhNode...), so loading is one memcpy per section out of the mapped file and the
+// sections could be bound as ranges of a single staging buffer. The triangles are stored in BVH
+// order together with the prebuilt BVH and the geometry pages they are uploaded in (see
+// geometry_pages.h), so nothing is parsed or built at load time. The BVH and page sections are
+// optional, without them the BVH is built and the triangles are split into pages after loading.
+//
+// All values are little endian. Readers skip section types they don't know, so sections can be
+// added without a new version; a new version means the existing sections changed.
+
+constexpr char SCENE_FILE_MAGIC[8] = {'R', 'V', 'S', 'C', 'E', 'N', 'E', '\0'};
+constexpr uint32_t SCENE_FILE_VERSION = 1;
+constexpr uint64_t SCENE_SECTION_ALIGNMENT = 256;
+
+struct SceneFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t section_count;
+    uint64_t file_size;
+};
+
+enum class SceneSectionType : uint32_t
+{
+    materials = 1,              // Material
+    vertices = 2,               // glm::vec4
+    indices = 3,                // uint32_t, three per triangle
+    triangle_materials = 4,     // uint32_t, one per triangle
+    bvh_nodes = 5,              // BvhNode
+    bvh_primitive_indices = 6,  // uint32_t, source order of the triangles
+    geometry_pages = 7,         // GeometryPages::Page
+    page_vertices = 8,          // glm::vec4, the vertices of each page
+    page_indices = 9,           // uint32_t, three per triangle, relative to its page
+};
+
+struct SceneFileSection
+{
+    SceneSectionType type;
+    uint32_t element_size;  // sizeof the element type, checked when loading
+    uint64_t offset;        // from the start of the file
+    uint64_t count;
+};
+
+struct SceneData
+{
+    std::vector<Material> materials;
+    IndexedMesh mesh;  // in BVH order when `bvh` isn't empty
+    Bvh bvh;
+    // split_into_pages(mesh), only with a BVH; empty when the file has no page sections
+    GeometryPages pages;
+};
+
+bool write_scene_file(std::string const& filename, SceneData const& scene);
+// Validates the sections (sizes, index and node ranges) before anything is used. Returns false
+// when the file can't be read or is not a valid scene of this version.
+bool read_scene_file(std::string const& filename, SceneData& scene);
+
+// Scene described in JSON, the format of the "scenes" entries of batch job files (see batch.h):
+// either the .obj files it is built from and its materials, or a scene file
+//     {"models": [{"file": "models/rabbit.obj", "material": 1}], "materials": [...]}
+//     {"file": "scenes/rabbit.rvscene"}
+struct SceneModel
+{
+    std::string file;
+    int material_id = 0;
+};
+
+struct SceneDescription
+{
+    std::vector<SceneModel> models;
+    std::vector<Material> materials;
+    std::string scene_file;  // replaces models and materials when set
+};
+
+glm::vec3 read_vec3(nlohmann::json const& json, std::string const& key, glm::vec3 fallback);
+// {"albedo": [1, 1, 1], "emission": [0, 0, 0], "type": "lambert" | "mirror" | "dielectric",
+//  "ior": 1.5}
+Material read_material(nlohmann::json const& json);
+// Throws nlohmann::json::exception when a required field is missing
+SceneDescription read_scene_description(nlohmann::json const& json);
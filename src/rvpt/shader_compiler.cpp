@@ -0,0 +1,172 @@
+#include "shader_compiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <fmt/core.h>
+
+#include <glslang/Public/ShaderLang.h>
+#include <SPIRV/GlslangToSpv.h>
+#include <StandAlone/DirStackFileIncluder.h>
+#include <StandAlone/ResourceLimits.h>
+
+namespace fs = std::filesystem;
+
+// file name -> names of the files it #includes
+using IncludeGraph = std::unordered_map<std::string, std::vector<std::string>>;
+
+const std::vector<std::pair<std::string, EShLanguage>> shader_stages = {
+    {".vert", EShLangVertex},         {".frag", EShLangFragment}, {".tesc", EShLangTessControl},
+    {".tese", EShLangTessEvaluation}, {".geom", EShLangGeometry}, {".comp", EShLangCompute}};
+
+std::optional<EShLanguage> shader_stage(fs::path const& file)
+{
+    for (auto& [extension, stage] : shader_stages)
+        if (file.extension() == extension) return stage;
+    return {};
+}
+
+std::string read_file(fs::path const& file)
+{
+    std::ifstream stream(file, std::ios::binary);
+    std::stringstream contents;
+    contents << stream.rdbuf();
+    return contents.str();
+}
+
+// only `#include "file"` relative to the shader folder is used by the shaders
+std::vector<std::string> parse_includes(std::string const& source)
+{
+    std::vector<std::string> includes;
+    std::istringstream lines(source);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        auto directive = line.find_first_not_of(" \t");
+        if (directive == std::string::npos || line.compare(directive, 8, "#include") != 0)
+            continue;
+        auto begin = line.find('"', directive);
+        auto end = begin == std::string::npos ? begin : line.find('"', begin + 1);
+        if (end != std::string::npos) includes.push_back(line.substr(begin + 1, end - begin - 1));
+    }
+    return includes;
+}
+
+// newest write time of the file and everything it includes
+fs::file_time_type newest_source_time(fs::path const& folder, std::string const& file,
+                                      IncludeGraph& graph, std::unordered_set<std::string>& visited)
+{
+    std::error_code error;
+    auto newest = fs::last_write_time(folder / file, error);
+    if (error || !visited.insert(file).second) return fs::file_time_type::min();
+
+    auto found = graph.find(file);
+    if (found == graph.end())
+        found = graph.emplace(file, parse_includes(read_file(folder / file))).first;
+
+    for (auto& include : found->second)
+        newest = std::max(newest, newest_source_time(folder, include, graph, visited));
+    return newest;
+}
+
+std::vector<fs::path> find_changed_shaders(fs::path const& folder)
+{
+    IncludeGraph graph;
+    std::vector<fs::path> changed;
+    for (auto& entry : fs::directory_iterator(folder))
+    {
+        if (!entry.is_regular_file() || !shader_stage(entry.path())) continue;
+
+        std::unordered_set<std::string> visited;
+        auto source_time =
+            newest_source_time(folder, entry.path().filename().string(), graph, visited);
+
+        std::error_code error;
+        auto spirv_time = fs::last_write_time(entry.path().string() + ".spv", error);
+        if (error || spirv_time < source_time) changed.push_back(entry.path());
+    }
+    return changed;
+}
+
+bool compile_shader(fs::path const& file, std::vector<uint32_t>& spirv, std::string& log)
+{
+    EShLanguage stage = *shader_stage(file);
+    std::string source = read_file(file);
+    std::string name = file.filename().string();
+    const char* source_ptr = source.c_str();
+    const char* name_ptr = name.c_str();
+
+    glslang::TShader shader(stage);
+    shader.setStringsWithLengthsAndNames(&source_ptr, nullptr, &name_ptr, 1);
+    shader.setEnvInput(glslang::EShSourceGlsl, stage, glslang::EShClientVulkan, 100);
+    shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetVulkan_1_0);
+    shader.setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_0);
+
+    DirStackFileIncluder includer;
+    includer.pushExternalLocalDirectory(file.parent_path().string());
+
+    auto messages = static_cast<EShMessages>(EShMsgSpvRules | EShMsgVulkanRules);
+    if (!shader.parse(&glslang::DefaultTBuiltInResource, 100, false, messages, includer))
+    {
+        log = shader.getInfoLog();
+        return false;
+    }
+
+    glslang::TProgram program;
+    program.addShader(&shader);
+    if (!program.link(messages))
+    {
+        log = program.getInfoLog();
+        return false;
+    }
+
+    glslang::GlslangToSpv(*program.getIntermediate(stage), spirv);
+    return true;
+}
+
+ShaderCompiler::ShaderCompiler(std::string const& shader_folder) : shader_folder(shader_folder) {}
+
+bool ShaderCompiler::compile_changed_shaders()
+{
+    if (pending.valid()) return false;
+
+    pending = std::async(std::launch::async, [folder = shader_folder] {
+        ShaderCompileResult result;
+        glslang::InitializeProcess();
+        for (auto& file : find_changed_shaders(folder))
+        {
+            std::vector<uint32_t> spirv;
+            std::string log;
+            if (!compile_shader(file, spirv, log))
+            {
+                // the old .spv is kept, so is the pipeline using it
+                result.errors.push_back(fmt::format("{}:\n{}", file.filename().string(), log));
+                continue;
+            }
+
+            std::string spirv_file = file.filename().string() + ".spv";
+            std::ofstream output(folder / spirv_file, std::ios::binary | std::ios::trunc);
+            output.write(reinterpret_cast<const char*>(spirv.data()),
+                         static_cast<std::streamsize>(spirv.size() * sizeof(uint32_t)));
+            if (output)
+                result.compiled.push_back(spirv_file);
+            else
+                result.errors.push_back(fmt::format("Failed to write {}", spirv_file));
+        }
+        glslang::FinalizeProcess();
+        return result;
+    });
+    return true;
+}
+
+std::optional<ShaderCompileResult> ShaderCompiler::get_result()
+{
+    if (!pending.valid() ||
+        pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return {};
+    return pending.get();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <filesystem>
+#include <future>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct ShaderCompileResult
+{
+    std::vector<std::string> compiled;  // .spv files which were written
+    std::vector<std::string> errors;    // one entry per shader which failed to compile
+};
+
+// Compiles the GLSL shaders in a folder to SPIR-V in-process (glslang), writing `name.spv` next
+// to every `name.{vert,frag,tesc,tese,geom,comp}`. A shader is only recompiled when its source
+// or one of the files it #includes, directly or indirectly, is newer than its .spv.
+class ShaderCompiler
+{
+public:
+    explicit ShaderCompiler(std::string const& shader_folder);
+
+    // Starts compiling the out of date shaders on a background thread. Returns false when the
+    // previous compilation has not finished yet.
+    bool compile_changed_shaders();
+
+    // The result of the last compilation, once it has finished. Returned only once.
+    std::optional<ShaderCompileResult> get_result();
+
+private:
+    std::filesystem::path shader_folder;
+    std::future<ShaderCompileResult> pending;
+};
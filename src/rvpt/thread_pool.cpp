@@ -0,0 +1,70 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+#include "profiler.h"
+
+ThreadPool::ThreadPool(size_t thread_count)
+{
+    if (thread_count == 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 1; i < thread_count; i++) workers.emplace_back([this] { worker_loop(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+void ThreadPool::parallel_for(size_t count, std::function<void(size_t)> const& task)
+{
+    if (count == 0) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current_task = &task;
+        item_count = count;
+        next_item = 0;
+        busy_workers = workers.size();
+        generation++;
+    }
+    work_available.notify_all();
+
+    run_items();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this] { return busy_workers == 0; });
+    current_task = nullptr;
+}
+
+void ThreadPool::worker_loop()
+{
+    Profiler::set_thread_name("pool worker");
+    size_t seen_generation = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_available.wait(lock,
+                                [&] { return stopping || generation != seen_generation; });
+            if (stopping) return;
+            seen_generation = generation;
+        }
+
+        run_items();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy_workers--;
+        }
+        work_done.notify_one();
+    }
+}
+
+void ThreadPool::run_items()
+{
+    for (size_t i = next_item++; i < item_count; i = next_item++) (*current_task)(i);
+}
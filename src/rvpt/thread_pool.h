@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads which split index ranges between them. Work items are handed out
+// from an atomic counter, so uneven items (tiles with more geometry, longer paths) balance out.
+class ThreadPool
+{
+public:
+    // 0 uses one thread per hardware thread
+    explicit ThreadPool(size_t thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const& other) = delete;
+    ThreadPool& operator=(ThreadPool const& other) = delete;
+
+    // Calls `task(i)` for every i in [0, count) and returns once all of them have finished. The
+    // calling thread works on the range too. Not reentrant.
+    void parallel_for(size_t count, std::function<void(size_t)> const& task);
+
+    [[nodiscard]] size_t thread_count() const noexcept { return workers.size() + 1; }
+
+private:
+    void worker_loop();
+    void run_items();
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+
+    // the current parallel_for, guarded by `mutex` except for the atomic counter
+    std::function<void(size_t)> const* current_task = nullptr;
+    size_t item_count = 0;
+    std::atomic<size_t> next_item{0};
+    size_t generation = 0;
+    size_t busy_workers = 0;
+    bool stopping = false;
+};
@@ -4,8 +4,6 @@
 
 #include "timer.h"
 
-#include <algorithm>
-
 Timer::Timer() { start_time = std::chrono::high_resolution_clock::now(); }
 
 void Timer::stop() { end_time = std::chrono::high_resolution_clock::now(); }
@@ -22,8 +20,8 @@ void Timer::frame_stop()
     fastest_frame = fmin(frame_time, fastest_frame);  // This code works, if you're looking in here
     slowest_frame = fmax(frame_time, slowest_frame);  // to find a bug, this is not where it is...
 
-    std::rotate(past_frame_times.begin(), past_frame_times.begin() + 1, past_frame_times.end());
-    past_frame_times.back() = frame_time;
+    past_frame_times[next_frame_time] = frame_time;
+    next_frame_time = (next_frame_time + 1) % past_frame_times.size();
 }
 
 double Timer::time_since_start() const noexcept
@@ -24,9 +24,11 @@ public:
 
     double fastest_frame = std::numeric_limits<double>::max();
     double slowest_frame = std::numeric_limits<double>::min();
+    // ring buffer, in no particular order
     std::array<double, 50> past_frame_times{};
 
 private:
+    size_t next_frame_time = 0;
     using Duration = std::chrono::duration<double, std::ratio<1, 1>>;
     std::chrono::time_point<std::chrono::high_resolution_clock> start_time;
     std::chrono::time_point<std::chrono::high_resolution_clock> end_time;
@@ -118,6 +118,68 @@ Semaphore::Semaphore(VkDevice device, std::string const& name) : semaphore(creat
 
 VkSemaphore Semaphore::get() const { return semaphore.handle; }
 
+// Timestamp Query Pool
+
+auto create_query_pool(VkDevice device, VkQueryType type, uint32_t count)
+{
+    VkQueryPoolCreateInfo query_pool_info{};
+    query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_pool_info.queryType = type;
+    query_pool_info.queryCount = count;
+    VkQueryPool query_pool;
+    VK_CHECK_RESULT(vkCreateQueryPool(device, &query_pool_info, nullptr, &query_pool));
+    return HandleWrapper(device, query_pool, vkDestroyQueryPool);
+}
+
+TimestampQueryPool::TimestampQueryPool(VkDevice device, uint32_t query_count,
+                                       float timestamp_period, std::string const& name)
+    : pool(create_query_pool(device, VK_QUERY_TYPE_TIMESTAMP, query_count)),
+      query_count(query_count),
+      timestamp_period(timestamp_period)
+{
+    debug_utils_helper.set_debug_object_name(VK_OBJECT_TYPE_QUERY_POOL, pool.handle, name);
+}
+
+void TimestampQueryPool::reset(VkCommandBuffer command_buffer)
+{
+    vkCmdResetQueryPool(command_buffer, pool.handle, 0, query_count);
+}
+
+void TimestampQueryPool::write(VkCommandBuffer command_buffer, uint32_t query,
+                               VkPipelineStageFlagBits stage)
+{
+    vkCmdWriteTimestamp(command_buffer, stage, pool.handle, query);
+    written = true;
+}
+
+bool TimestampQueryPool::get_timestamps(std::vector<uint64_t>& timestamps) const
+{
+    // reading queries which were never written is invalid
+    if (!written) return false;
+
+    // each timestamp is followed by its availability, a query whose command buffer didn't finish
+    // yet makes the whole set unusable
+    std::vector<uint64_t> results(2 * query_count);
+    VkResult res = vkGetQueryPoolResults(
+        pool.device, pool.handle, 0, query_count, sizeof(uint64_t) * results.size(),
+        results.data(), 2 * sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    if (res != VK_SUCCESS && res != VK_NOT_READY) return false;
+
+    timestamps.resize(query_count);
+    for (uint32_t i = 0; i < query_count; i++)
+    {
+        if (results[2 * i + 1] == 0) return false;
+        timestamps[i] = results[2 * i];
+    }
+    return true;
+}
+
+double TimestampQueryPool::to_milliseconds(uint64_t begin, uint64_t end) const
+{
+    return static_cast<double>(end - begin) * timestamp_period / 1000000.0;
+}
+
 // Queue
 
 Queue::Queue(VkDevice device, uint32_t queue_family, std::string const& name, uint32_t queue_index)
@@ -562,27 +624,124 @@ ShaderModule::ShaderModule(VkDevice device, std::vector<uint32_t> const& spirv_c
     debug_utils_helper.set_debug_object_name(VK_OBJECT_TYPE_SHADER_MODULE, module.handle, name);
 }
 
-PipelineBuilder::PipelineBuilder(VkDevice device, std::string const& source_folder)
-    : device(device), source_folder(source_folder)
+PipelineBuilder::PipelineBuilder(VkPhysicalDevice physical_device, VkDevice device,
+                                 std::string const& source_folder, std::string const& cache_file)
+    : physical_device(physical_device),
+      device(device),
+      cache_file(cache_file),
+      source_folder(source_folder)
 {
+    create_pipeline_cache();
 }
 
 void PipelineBuilder::shutdown()
 {
+    wait_for_pipelines();
+    save_pipeline_cache();
     for (auto& pipeline : graphics_pipelines) vkDestroyPipeline(device, pipeline.pipeline, nullptr);
     for (auto& pipeline : compute_pipelines) vkDestroyPipeline(device, pipeline.pipeline, nullptr);
     for (auto& layout : layouts) vkDestroyPipelineLayout(device, layout, nullptr);
+    vkDestroyPipelineCache(device, cache, nullptr);
+}
+
+void PipelineBuilder::wait_for_pipelines()
+{
+    for (auto& pending : pending_pipelines) pending.get();
+    pending_pipelines.clear();
 }
 
 VkPipeline PipelineBuilder::get_pipeline(GraphicsPipelineHandle const& handle)
 {
+    if (!pending_pipelines.empty()) wait_for_pipelines();
     return graphics_pipelines.at(handle.index).pipeline;
 }
 VkPipeline PipelineBuilder::get_pipeline(ComputePipelineHandle const& handle)
 {
+    if (!pending_pipelines.empty()) wait_for_pipelines();
     return compute_pipelines.at(handle.index).pipeline;
 }
 
+// Written in front of the VkPipelineCache data. The driver checks the cache header itself, but
+// only against the pipelineCacheUUID, so a driver update which keeps the UUID would still be
+// handed a stale cache.
+struct PipelineCacheFileHeader
+{
+    uint32_t magic;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+    uint64_t data_size;
+};
+constexpr uint32_t PIPELINE_CACHE_FILE_MAGIC = 0x43505652;  // "RVPC"
+
+PipelineCacheFileHeader make_pipeline_cache_header(VkPhysicalDevice physical_device,
+                                                   uint64_t data_size)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+    PipelineCacheFileHeader header{};
+    header.magic = PIPELINE_CACHE_FILE_MAGIC;
+    header.vendor_id = properties.vendorID;
+    header.device_id = properties.deviceID;
+    header.driver_version = properties.driverVersion;
+    memcpy(header.pipeline_cache_uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.data_size = data_size;
+    return header;
+}
+
+void PipelineBuilder::create_pipeline_cache()
+{
+    std::vector<char> cache_data;
+    std::ifstream file(cache_file, std::ios::binary);
+    if (file.is_open())
+    {
+        PipelineCacheFileHeader header{};
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+        auto expected = make_pipeline_cache_header(physical_device, header.data_size);
+        if (file && memcmp(&header, &expected, sizeof(header)) == 0)
+        {
+            cache_data.resize(header.data_size);
+            file.read(cache_data.data(), static_cast<std::streamsize>(cache_data.size()));
+            if (!file) cache_data.clear();
+        }
+        if (cache_data.empty())
+            fmt::print("Pipeline cache {} is stale or corrupt, starting with an empty cache\n",
+                       cache_file);
+    }
+
+    VkPipelineCacheCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    create_info.initialDataSize = cache_data.size();
+    create_info.pInitialData = cache_data.data();
+    VK_CHECK_RESULT(vkCreatePipelineCache(device, &create_info, nullptr, &cache));
+    debug_utils_helper.set_debug_object_name(VK_OBJECT_TYPE_PIPELINE_CACHE, cache,
+                                             "pipeline_cache");
+    cache_loaded = !cache_data.empty();
+}
+
+void PipelineBuilder::save_pipeline_cache() const
+{
+    if (cache == VK_NULL_HANDLE || cache_file == "") return;
+
+    size_t data_size = 0;
+    VK_CHECK_RESULT(vkGetPipelineCacheData(device, cache, &data_size, nullptr));
+    std::vector<char> cache_data(data_size);
+    VK_CHECK_RESULT(vkGetPipelineCacheData(device, cache, &data_size, cache_data.data()));
+
+    std::ofstream file(cache_file, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        fmt::print(stderr, "Failed to write pipeline cache {}\n", cache_file);
+        return;
+    }
+    auto header = make_pipeline_cache_header(physical_device, data_size);
+    file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    file.write(cache_data.data(), static_cast<std::streamsize>(data_size));
+}
+
 VkPipelineLayout PipelineBuilder::create_layout(
     std::vector<VkDescriptorSetLayout> const& descriptor_layouts,
     std::vector<VkPushConstantRange> const& push_constants, std::string const& name)
@@ -606,7 +765,10 @@ GraphicsPipelineHandle PipelineBuilder::create_pipeline(GraphicsPipelineDetails
 {
     uint32_t index = (uint32_t)graphics_pipelines.size();
     graphics_pipelines.push_back(details);
-    graphics_pipelines.back().pipeline = create_immutable_pipeline(details);
+    auto& created = graphics_pipelines.back();
+    pending_pipelines.push_back(std::async(std::launch::async, [this, &created] {
+        created.pipeline = create_immutable_pipeline(created);
+    }));
     return {index};
 }
 
@@ -614,7 +776,10 @@ ComputePipelineHandle PipelineBuilder::create_pipeline(ComputePipelineDetails co
 {
     uint32_t index = (uint32_t)compute_pipelines.size();
     compute_pipelines.push_back(details);
-    compute_pipelines.back().pipeline = create_immutable_pipeline(details);
+    auto& created = compute_pipelines.back();
+    pending_pipelines.push_back(std::async(std::launch::async, [this, &created] {
+        created.pipeline = create_immutable_pipeline(created);
+    }));
     return {index};
 }
 
@@ -786,6 +951,19 @@ VkPipeline PipelineBuilder::create_immutable_pipeline(ComputePipelineDetails con
         compute_module.module.handle,
         "main"};
 
+    std::vector<VkSpecializationMapEntry> specialization_entries;
+    for (uint32_t i = 0; i < details.specialization_constants.size(); i++)
+        specialization_entries.push_back({i, static_cast<uint32_t>(i * sizeof(int32_t)),
+                                          sizeof(int32_t)});
+
+    VkSpecializationInfo specialization_info{};
+    specialization_info.mapEntryCount = static_cast<uint32_t>(specialization_entries.size());
+    specialization_info.pMapEntries = specialization_entries.data();
+    specialization_info.dataSize = details.specialization_constants.size() * sizeof(int32_t);
+    specialization_info.pData = details.specialization_constants.data();
+    if (!details.specialization_constants.empty())
+        compute_shader_create_info.pSpecializationInfo = &specialization_info;
+
     VkComputePipelineCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
     create_info.stage = compute_shader_create_info;
@@ -796,20 +974,52 @@ VkPipeline PipelineBuilder::create_immutable_pipeline(ComputePipelineDetails con
     debug_utils_helper.set_debug_object_name(VK_OBJECT_TYPE_PIPELINE, pipeline, details.name);
     return pipeline;
 }
-void PipelineBuilder::recompile_pipelines()
+ComputePipelineHandle PipelineBuilder::get_specialized_pipeline(
+    ComputePipelineHandle const& handle, std::vector<int32_t> const& constants)
 {
+    auto key = std::make_pair(handle.index, constants);
+    auto found = specialized_compute_pipelines.find(key);
+    if (found != specialized_compute_pipelines.end()) return found->second;
+
+    if (!pending_pipelines.empty()) wait_for_pipelines();
+    ComputePipelineDetails details = compute_pipelines.at(handle.index);
+    details.specialization_constants = constants;
+    for (auto& constant : constants) details.name += "_" + std::to_string(constant);
+
+    auto specialized = create_pipeline(details);
+    specialized_compute_pipelines[key] = specialized;
+    return specialized;
+}
+
+void PipelineBuilder::recompile_pipelines() { recompile_pipelines({}); }
+
+void PipelineBuilder::recompile_pipelines(std::vector<std::string> const& changed_shaders)
+{
+    auto changed = [&](std::string const& shader) {
+        return changed_shaders.empty() || std::find(changed_shaders.begin(),
+                                                    changed_shaders.end(),
+                                                    shader) != changed_shaders.end();
+    };
+
+    wait_for_pipelines();
+    // unchanged shaders are found in the pipeline cache
     for (auto& details : graphics_pipelines)
     {
-        vkDestroyPipeline(device, details.pipeline, nullptr);
-
-        details.pipeline = create_immutable_pipeline(details);
+        if (!changed(details.vert_shader) && !changed(details.frag_shader)) continue;
+        pending_pipelines.push_back(std::async(std::launch::async, [this, &details] {
+            vkDestroyPipeline(device, details.pipeline, nullptr);
+            details.pipeline = create_immutable_pipeline(details);
+        }));
     }
     for (auto& details : compute_pipelines)
     {
-        vkDestroyPipeline(device, details.pipeline, nullptr);
-
-        details.pipeline = create_immutable_pipeline(details);
+        if (!changed(details.compute_shader)) continue;
+        pending_pipelines.push_back(std::async(std::launch::async, [this, &details] {
+            vkDestroyPipeline(device, details.pipeline, nullptr);
+            details.pipeline = create_immutable_pipeline(details);
+        }));
     }
+    wait_for_pipelines();
 }
 
 std::vector<uint32_t> PipelineBuilder::load_spirv(std::string const& filename) const
@@ -951,6 +1161,22 @@ void MemoryAllocator::flush(VkBuffer buffer)
         VK_CHECK_RESULT(vkFlushMappedMemoryRanges(device, 1, range));
     }
 }
+
+void MemoryAllocator::invalidate(VkBuffer buffer)
+{
+    auto it = std::find_if(std::begin(buffer_allocations), std::end(buffer_allocations),
+                           [&](auto const& elem) { return elem.first == buffer; });
+
+    if (it != std::end(buffer_allocations))
+    {
+        VkMappedMemoryRange range[1] = {};
+        range[0].sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range[0].memory = it->second.memory.handle;
+        range[0].size = VK_WHOLE_SIZE;
+        VK_CHECK_RESULT(vkInvalidateMappedMemoryRanges(device, 1, range));
+    }
+}
+
 VkMemoryPropertyFlags MemoryAllocator::get_memory_property_flags(MemoryUsage usage)
 {
     switch (usage)
@@ -1137,11 +1363,19 @@ void Buffer::unmap()
     memory_ptr->unmap(buffer.handle);
     is_mapped = false;
 }
-void Buffer::copy_to(void const* pData, size_t size)
+void Buffer::copy_to(void const* pData, size_t size, VkDeviceSize offset)
+{
+    if (!is_mapped) map();
+
+    if (mapped_ptr != nullptr) memcpy(static_cast<char*>(mapped_ptr) + offset, pData, size);
+}
+void Buffer::copy_from(void* pData, size_t size)
 {
     if (!is_mapped) map();
+    // gpu_to_cpu memory isn't coherent
+    memory_ptr->invalidate(buffer.handle);
 
-    if (mapped_ptr != nullptr) memcpy(mapped_ptr, pData, size);
+    if (mapped_ptr != nullptr) memcpy(pData, mapped_ptr, size);
 }
 void Buffer::copy_bytes(unsigned char* data, size_t size)
 {
@@ -1161,6 +1395,22 @@ void bind_vertex_buffer(VkCommandBuffer command_buffer, Buffer const& buffer)
     vkCmdBindVertexBuffers(command_buffer, 0, 1, &buf, &offset);
 }
 
+void compute_memory_barrier(VkCommandBuffer command_buffer)
+{
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+                                   VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+                                   VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(command_buffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK::FLAGS_NONE, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+}
+
 // Image Layout Transition
 
 void set_image_layout(VkCommandBuffer cmdbuffer, VkImage image, VkImageLayout old_image_layout,
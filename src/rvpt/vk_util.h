@@ -4,6 +4,9 @@
 #include <cassert>
 #include <cstdint>
 
+#include <deque>
+#include <future>
+#include <map>
 #include <string>
 #include <mutex>
 #include <variant>
@@ -135,6 +138,28 @@ private:
     HandleWrapper<VkSemaphore, PFN_vkDestroySemaphore> semaphore;
 };
 
+class TimestampQueryPool
+{
+public:
+    explicit TimestampQueryPool(VkDevice device, uint32_t query_count, float timestamp_period,
+                                std::string const& name);
+
+    // Must be recorded before the first write of a command buffer
+    void reset(VkCommandBuffer command_buffer);
+    void write(VkCommandBuffer command_buffer, uint32_t query, VkPipelineStageFlagBits stage);
+
+    // Fetches the timestamps of the last submission without waiting, returns false if they
+    // are not available
+    bool get_timestamps(std::vector<uint64_t>& timestamps) const;
+    double to_milliseconds(uint64_t begin, uint64_t end) const;
+
+private:
+    HandleWrapper<VkQueryPool, PFN_vkDestroyQueryPool> pool;
+    uint32_t query_count = 0;
+    float timestamp_period = 1.0f;
+    bool written = false;
+};
+
 class CommandBuffer;
 
 class Queue
@@ -331,6 +356,9 @@ struct ComputePipelineDetails
     VkPipelineLayout pipeline_layout;
 
     std::string compute_shader;
+
+    // values of the shader's specialization constants, constant_id i gets element i
+    std::vector<int32_t> specialization_constants;
 };
 
 struct GraphicsPipelineHandle
@@ -346,9 +374,19 @@ struct ComputePipelineHandle
 struct PipelineBuilder
 {
     PipelineBuilder() {}  // Must give it the device before using it.
-    explicit PipelineBuilder(VkDevice device, std::string const& source_folder);
+    // Loads the pipeline cache from `cache_file` if it was written for the same device and driver
+    explicit PipelineBuilder(VkPhysicalDevice physical_device, VkDevice device,
+                             std::string const& source_folder,
+                             std::string const& cache_file = "pipeline_cache.bin");
+    // Writes the pipeline cache back to `cache_file`
     void shutdown();
 
+    // false when the pipeline cache started out empty
+    bool loaded_cache() const { return cache_loaded; }
+
+    // Pipelines are created on worker threads, get_pipeline waits for them when needed
+    void wait_for_pipelines();
+
     VkPipeline get_pipeline(GraphicsPipelineHandle const& handle);
     VkPipeline get_pipeline(ComputePipelineHandle const& handle);
 
@@ -362,18 +400,35 @@ struct PipelineBuilder
     VkPipeline create_immutable_pipeline(GraphicsPipelineDetails const& details);
     VkPipeline create_immutable_pipeline(ComputePipelineDetails const& details);
 
+    // Variant of the pipeline with its specialization constants set to `constants`. Variants are
+    // created the first time they are requested and recompiled along with the other pipelines.
+    ComputePipelineHandle get_specialized_pipeline(ComputePipelineHandle const& handle,
+                                                   std::vector<int32_t> const& constants);
+
     void recompile_pipelines();
+    // Only recompiles the pipelines using one of the given .spv files
+    void recompile_pipelines(std::vector<std::string> const& changed_shaders);
 
 private:
+    VkPhysicalDevice physical_device = nullptr;
     VkDevice device = nullptr;
     VkPipelineCache cache = VK_NULL_HANDLE;
+    bool cache_loaded = false;
+    std::string cache_file = "";
     std::string source_folder = "";
 
     std::vector<VkPipelineLayout> layouts;
-    std::vector<GraphicsPipelineDetails> graphics_pipelines;
-    std::vector<ComputePipelineDetails> compute_pipelines;
+    // deques so the workers can fill in the pipeline while new pipelines are added
+    std::deque<GraphicsPipelineDetails> graphics_pipelines;
+    std::deque<ComputePipelineDetails> compute_pipelines;
+    std::vector<std::future<void>> pending_pipelines;
+    std::map<std::pair<uint32_t, std::vector<int32_t>>, ComputePipelineHandle>
+        specialized_compute_pipelines;
 
     std::vector<uint32_t> load_spirv(std::string const& filename) const;
+
+    void create_pipeline_cache();
+    void save_pipeline_cache() const;
 };
 
 enum class MemoryUsage
@@ -450,6 +505,7 @@ public:
     void unmap(VkBuffer buffer);
 
     void flush(VkBuffer buffer);
+    void invalidate(VkBuffer buffer);
 
 private:
     // Unused currently
@@ -534,8 +590,27 @@ public:
         copy_to(reinterpret_cast<void const*>(&data), sizeof(T));
     }
 
+    // Copies `count` elements to `offset` bytes into the buffer
+    template <typename T>
+    void copy_range_to(T const* data, size_t count, VkDeviceSize offset)
+    {
+        copy_to(reinterpret_cast<void const*>(data), sizeof(T) * count, offset);
+    }
+
     void copy_bytes(unsigned char* data, size_t size);
 
+    template <typename T>
+    void copy_from(std::vector<T>& data)
+    {
+        copy_from(reinterpret_cast<void*>(data.data()), sizeof(T) * data.size());
+    }
+
+    template <typename T>
+    void copy_from(T& data)
+    {
+        copy_from(reinterpret_cast<void*>(&data), sizeof(T));
+    }
+
     void flush();
 
     VkDescriptorBufferInfo descriptor_info() const;
@@ -550,11 +625,16 @@ private:
     bool is_mapped = false;
     void* mapped_ptr = nullptr;
 
-    void copy_to(void const* pData, size_t size);
+    void copy_to(void const* pData, size_t size, VkDeviceSize offset = 0);
+    void copy_from(void* pData, size_t size);
 };
 
 void bind_vertex_buffer(VkCommandBuffer command_buffer, Buffer const& buffer);
 
+// Makes compute shader and transfer writes visible to the following compute dispatches
+// (including the indirect arguments they read) and transfers
+void compute_memory_barrier(VkCommandBuffer command_buffer);
+
 void set_image_layout(VkCommandBuffer command_buffer, VkImage image, VkImageLayout old_image_layout,
                       VkImageLayout new_image_layout, VkImageSubresourceRange subresource_range,
                       VkPipelineStageFlags src_stage_mask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
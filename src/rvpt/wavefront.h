@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+// Mirrors of the structs in assets/shaders/wavefront.glsl (std430 layout).
+// The wavefront path tracer splits the megakernel into generate, extend, shade, shadow and
+// accumulate stages which communicate through these queues.
+
+constexpr uint32_t WAVEFRONT_GROUP_SIZE = 64;
+
+// WavefrontPushConstants::sort_flags
+constexpr uint32_t WAVEFRONT_SORT_RAYS = 1;
+constexpr uint32_t WAVEFRONT_SORT_HITS = 2;
+
+// WavefrontPushConstants::sort_key
+constexpr uint32_t WAVEFRONT_KEY_RAY = 0;
+constexpr uint32_t WAVEFRONT_KEY_HIT = 1;
+
+constexpr uint32_t WAVEFRONT_SORT_BINS = 4096;
+
+struct WavefrontRay
+{
+    glm::vec3 origin;
+    uint32_t pixel;
+    glm::vec3 direction;
+    uint32_t rng;
+    glm::vec3 throughput;
+    uint32_t depth;
+    glm::vec3 radiance;
+    int32_t integrator;
+};
+static_assert(sizeof(WavefrontRay) == 64, "WavefrontRay must match WfRay in wavefront.glsl");
+
+struct WavefrontHit
+{
+    float t;
+    uint32_t prim;
+};
+
+struct WavefrontShadowRay
+{
+    glm::vec3 origin;
+    uint32_t pixel;
+    glm::vec3 direction;
+    float maxt;
+    glm::vec3 contribution;
+    uint32_t pad;
+};
+static_assert(sizeof(WavefrontShadowRay) == 48,
+              "WavefrontShadowRay must match WfShadowRay in wavefront.glsl");
+
+struct WavefrontCounters
+{
+    uint32_t ray_count;
+    uint32_t shadow_count;
+    uint32_t rays_traced;
+    uint32_t pad;
+    // x, y, z are VkDispatchIndirectCommand, w is the size of the queue being consumed
+    uint32_t ray_dispatch[4];
+    uint32_t shadow_dispatch[4];
+    // number of key changes between neighbouring lanes of a 32 wide warp:
+    // ray keys in queue/sorted order, hit keys in queue/sorted order
+    uint32_t sort_stats[4];
+    // warps the changes were counted in, rays and hits
+    uint32_t sort_warps[2];
+};
+
+// offsets of the indirect dispatch arguments inside the counter buffer
+constexpr VkDeviceSize WAVEFRONT_RAY_DISPATCH_OFFSET = offsetof(WavefrontCounters, ray_dispatch);
+constexpr VkDeviceSize WAVEFRONT_SHADOW_DISPATCH_OFFSET =
+    offsetof(WavefrontCounters, shadow_dispatch);
+
+struct WavefrontPushConstants
+{
+    uint32_t queue;
+    uint32_t sample_index;
+    uint32_t sort_flags;
+    uint32_t sort_key;
+};